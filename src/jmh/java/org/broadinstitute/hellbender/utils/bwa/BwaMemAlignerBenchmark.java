@@ -0,0 +1,215 @@
+package org.broadinstitute.hellbender.utils.bwa;
+
+import org.openjdk.jmh.annotations.*;
+
+import java.io.*;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.file.Files;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Random;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * Measures the separate steps of BwaMemAligner.alignSeqs:  packing the input, the native call, and decoding the
+ * results, as well as the whole thing.  Scores are reads per second.
+ * Run with "gradlew jmh" (which turns on the GC profiler, so you get allocation rates, too).
+ * The references are the tiny one used by the unit tests, and a larger one generated at random.
+ */
+@State(Scope.Benchmark)
+@BenchmarkMode(Mode.Throughput)
+@OutputTimeUnit(TimeUnit.SECONDS)
+@Warmup(iterations = 3, time = 2)
+@Measurement(iterations = 5, time = 2)
+@Fork(1)
+public class BwaMemAlignerBenchmark {
+    private static final int BATCH_SIZE = 1000;
+    private static final int GENERATED_CONTIG_LENGTH = 1000000;
+    private static final int GENERATED_N_CONTIGS = 4;
+    private static final byte[] BASES = { 'A', 'C', 'G', 'T' };
+
+    @Param({"ref.fa", "generated"})
+    public String reference;
+
+    @Param({"101", "151", "251"})
+    public int readLength;
+
+    @Param({"false", "true"})
+    public boolean packed;
+
+    private File tmpDir;
+    private BwaMemIndex index;
+    private BwaMemAligner aligner;
+    private List<byte[]> reads;
+    private ByteBuffer encodedReads; // as encode makes them:  align rewrites its input in place, so it gets a copy
+    private ByteBuffer alignsBuf;
+
+    /**
+     * align's input.  bwa converts the bases of ASCII input to 2-bit codes in place, after which they'd read as
+     * empty or truncated sequences, so the encoded reads are copied back in before each invocation.
+     */
+    @State(Scope.Thread)
+    public static class AlignInput {
+        private ByteBuffer contigBuf;
+
+        @Setup(Level.Invocation)
+        public void refill( final BwaMemAlignerBenchmark benchmark ) {
+            if ( contigBuf == null ) {
+                contigBuf = ByteBuffer.allocateDirect(benchmark.encodedReads.capacity());
+                contigBuf.order(ByteOrder.nativeOrder());
+            }
+            contigBuf.clear();
+            contigBuf.put((ByteBuffer)benchmark.encodedReads.duplicate().clear());
+            contigBuf.clear();
+        }
+    }
+
+    @Setup(Level.Trial)
+    public void setup() throws IOException {
+        tmpDir = Files.createTempDirectory("bwa-jmh").toFile();
+        final String imageFile = new File(tmpDir, "ref.img").getPath();
+        final Random random = new Random(11);
+        final List<byte[]> contigs;
+        if ( "ref.fa".equals(reference) ) {
+            BwaMemIndex.createIndexImageFromIndexFiles("src/test/resources/ref.fa", imageFile);
+            contigs = readFasta("src/test/resources/ref.fa");
+        } else {
+            final File fasta = new File(tmpDir, "generated.fa");
+            contigs = generateFasta(fasta, random);
+            BwaMemIndex.createIndexImageFromFastaFile(fasta.getPath(), imageFile);
+        }
+        reads = simulateReads(contigs, random);
+        index = new BwaMemIndex(imageFile);
+        aligner = new BwaMemAligner(index);
+        aligner.setPackedSeqsInput(packed);
+        encodedReads = aligner.encode(reads, read -> read);
+        final AlignInput input = new AlignInput();
+        input.refill(this);
+        alignsBuf = aligner.align(input.contigBuf);
+    }
+
+    @TearDown(Level.Trial)
+    public void tearDown() {
+        aligner.releaseAlignments(alignsBuf);
+        aligner.close();
+        index.close();
+        final File[] files = tmpDir.listFiles();
+        if ( files != null ) {
+            for ( final File file : files ) {
+                file.delete();
+            }
+        }
+        tmpDir.delete();
+    }
+
+    @Benchmark
+    @OperationsPerInvocation(BATCH_SIZE)
+    public ByteBuffer encode() {
+        return aligner.encode(reads, read -> read);
+    }
+
+    @Benchmark
+    @OperationsPerInvocation(BATCH_SIZE)
+    public int align( final AlignInput input ) {
+        final ByteBuffer buf = aligner.align(input.contigBuf);
+        final int size = buf.capacity();
+        aligner.releaseAlignments(buf);
+        return size;
+    }
+
+    @Benchmark
+    @OperationsPerInvocation(BATCH_SIZE)
+    public List<List<BwaMemAlignment>> decode() {
+        return BwaMemAligner.decodeAlignments(alignsBuf, BATCH_SIZE);
+    }
+
+    // what a caller of alignSeqsLazily that only wants the basics pays to go through a batch
+    @Benchmark
+    @OperationsPerInvocation(BATCH_SIZE)
+    public long decodeLazily() {
+        final BwaMemAlignmentBatch batch = new BwaMemAlignmentBatch(aligner, alignsBuf, true, BATCH_SIZE);
+        final BwaMemAlignmentView view = batch.newView();
+        long sum = 0;
+        for ( int seqIdx = 0; seqIdx != BATCH_SIZE; ++seqIdx ) {
+            for ( int alignIdx = 0, nAligns = batch.getNAlignments(seqIdx); alignIdx != nAligns; ++alignIdx ) {
+                view.moveTo(seqIdx, alignIdx);
+                sum += view.getSamFlag() + view.getRefId() + view.getRefStart() + view.getMapQual();
+            }
+        }
+        return sum;
+    }
+
+    @Benchmark
+    @OperationsPerInvocation(BATCH_SIZE)
+    public List<List<BwaMemAlignment>> alignSeqs() {
+        return aligner.alignSeqs(reads);
+    }
+
+    private static List<byte[]> readFasta( final String fileName ) throws IOException {
+        final List<byte[]> contigs = new ArrayList<>();
+        try ( final BufferedReader reader = new BufferedReader(new FileReader(fileName)) ) {
+            final ByteArrayOutputStream contig = new ByteArrayOutputStream();
+            String line;
+            while ( (line = reader.readLine()) != null ) {
+                if ( line.startsWith(">") ) {
+                    if ( contig.size() > 0 ) contigs.add(contig.toByteArray());
+                    contig.reset();
+                } else {
+                    contig.write(line.trim().getBytes());
+                }
+            }
+            if ( contig.size() > 0 ) contigs.add(contig.toByteArray());
+        }
+        return contigs;
+    }
+
+    private static List<byte[]> generateFasta( final File fasta, final Random random ) throws IOException {
+        final List<byte[]> contigs = new ArrayList<>(GENERATED_N_CONTIGS);
+        try ( final PrintWriter writer = new PrintWriter(new FileWriter(fasta)) ) {
+            for ( int contigIdx = 0; contigIdx != GENERATED_N_CONTIGS; ++contigIdx ) {
+                final byte[] contig = new byte[GENERATED_CONTIG_LENGTH];
+                for ( int idx = 0; idx != contig.length; ++idx ) {
+                    contig[idx] = BASES[random.nextInt(4)];
+                }
+                contigs.add(contig);
+                writer.println(">contig" + contigIdx);
+                for ( int idx = 0; idx < contig.length; idx += 70 ) {
+                    writer.println(new String(contig, idx, Math.min(70, contig.length - idx)));
+                }
+            }
+        }
+        return contigs;
+    }
+
+    // reads from random positions, with about 1% mismatches, half of them reverse-complemented
+    private List<byte[]> simulateReads( final List<byte[]> contigs, final Random random ) {
+        final List<byte[]> simulated = new ArrayList<>(BATCH_SIZE);
+        while ( simulated.size() < BATCH_SIZE ) {
+            final byte[] contig = contigs.get(random.nextInt(contigs.size()));
+            if ( contig.length < readLength ) continue;
+            final int start = random.nextInt(contig.length - readLength + 1);
+            final boolean isRC = random.nextBoolean();
+            final byte[] read = new byte[readLength];
+            for ( int idx = 0; idx != readLength; ++idx ) {
+                byte base = isRC ? complement(contig[start + readLength - 1 - idx]) : contig[start + idx];
+                if ( random.nextInt(100) == 0 ) {
+                    base = BASES[random.nextInt(4)];
+                }
+                read[idx] = base;
+            }
+            simulated.add(read);
+        }
+        return simulated;
+    }
+
+    private static byte complement( final byte base ) {
+        switch ( base ) {
+            case 'A': case 'a': return 'T';
+            case 'C': case 'c': return 'G';
+            case 'G': case 'g': return 'C';
+            case 'T': case 't': return 'A';
+            default: return 'N';
+        }
+    }
+}
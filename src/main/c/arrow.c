@@ -0,0 +1,181 @@
+/*
+ * arrow.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arrow.h"
+#include "columns.h"
+
+typedef struct {
+	char const* name;
+	char const* format;
+	int col; // the column it comes from (for a list or a string, the offsets), or -1 for seq
+	int flags;
+} arrow_field_t;
+
+#define ARROW_N_FIELDS 14
+#define ARROW_FIELD_CIGAR 5
+#define ARROW_FIELD_MD 9
+#define ARROW_FIELD_XA 10
+
+static arrow_field_t const gFields[ARROW_N_FIELDS] = {
+	{ "seq", "i", -1, 0 },
+	{ "flag", "i", JNIBWA_COL_FLAG, 0 },
+	{ "mapq", "i", JNIBWA_COL_MAPQ, 0 },
+	{ "refId", "i", JNIBWA_COL_REF_ID, 0 },
+	{ "pos", "i", JNIBWA_COL_POS, 0 },
+	{ "cigar", "+l", JNIBWA_COL_CIGAR_OFF, 0 },
+	{ "NM", "i", JNIBWA_COL_NM, 0 },
+	{ "AS", "i", JNIBWA_COL_AS, 0 },
+	{ "XS", "i", JNIBWA_COL_XS, 0 },
+	{ "MD", "u", JNIBWA_COL_MD_OFF, ARROW_FLAG_NULLABLE },
+	{ "XA", "u", JNIBWA_COL_XA_OFF, ARROW_FLAG_NULLABLE },
+	{ "mateRefId", "i", JNIBWA_COL_MATE_REF_ID, 0 },
+	{ "matePos", "i", JNIBWA_COL_MATE_POS, 0 },
+	{ "tlen", "i", JNIBWA_COL_TLEN, 0 }
+};
+
+// Everything the structs point to lives in one of these, which is freed once every struct that refers to it has
+// been released.  The consumer may move children out of their parents and release them whenever it likes, so each
+// struct holds a reference.  The top-level struct is the caller's.
+// The last element of schemas and arrays is the cigar list's child.
+typedef struct {
+	int refCount;
+	struct ArrowSchema schemas[ARROW_N_FIELDS + 1];
+	struct ArrowSchema* pSchemaChildren[ARROW_N_FIELDS + 1];
+} arrow_schema_data_t;
+
+typedef struct {
+	int refCount;
+	char* pColumns;
+	int32_t* pSeqs;
+	uint8_t* pValid[2]; // for MD and XA
+	struct ArrowArray arrays[ARROW_N_FIELDS + 1];
+	struct ArrowArray* pArrayChildren[ARROW_N_FIELDS + 1];
+	void const* buffers[ARROW_N_FIELDS + 2][3]; // the last is the top-level struct's
+} arrow_array_data_t;
+
+static void releaseSchema( struct ArrowSchema* pSchema ) {
+	arrow_schema_data_t* pData = pSchema->private_data;
+	int64_t idx;
+	for ( idx = 0; idx < pSchema->n_children; ++idx ) {
+		struct ArrowSchema* pChild = pSchema->children[idx];
+		if ( pChild->release ) pChild->release(pChild);
+	}
+	pSchema->release = 0;
+	if ( !__sync_sub_and_fetch(&pData->refCount, 1) ) free(pData);
+}
+
+static void releaseArray( struct ArrowArray* pArray ) {
+	arrow_array_data_t* pData = pArray->private_data;
+	int64_t idx;
+	for ( idx = 0; idx < pArray->n_children; ++idx ) {
+		struct ArrowArray* pChild = pArray->children[idx];
+		if ( pChild->release ) pChild->release(pChild);
+	}
+	pArray->release = 0;
+	if ( __sync_sub_and_fetch(&pData->refCount, 1) ) return;
+	free(pData->pColumns);
+	free(pData->pSeqs);
+	free(pData->pValid[0]);
+	free(pData->pValid[1]);
+	free(pData);
+}
+
+static void initSchema( struct ArrowSchema* pSchema, char const* format, char const* name, int64_t flags,
+						int64_t nChildren, struct ArrowSchema** children, arrow_schema_data_t* pData ) {
+	memset(pSchema, 0, sizeof(*pSchema));
+	pSchema->format = format;
+	pSchema->name = name;
+	pSchema->flags = flags;
+	pSchema->n_children = nChildren;
+	pSchema->children = children;
+	pSchema->release = releaseSchema;
+	pSchema->private_data = pData;
+}
+
+static void initArray( struct ArrowArray* pArray, int64_t length, int64_t nullCount, int64_t nBuffers,
+						void const** buffers, int64_t nChildren, struct ArrowArray** children, arrow_array_data_t* pData ) {
+	memset(pArray, 0, sizeof(*pArray));
+	pArray->length = length;
+	pArray->null_count = nullCount;
+	pArray->n_buffers = nBuffers;
+	pArray->buffers = buffers;
+	pArray->n_children = nChildren;
+	pArray->children = children;
+	pArray->release = releaseArray;
+	pArray->private_data = pData;
+}
+
+// a validity bitmap that marks the empty strings as null, or null if there aren't any, and the number of nulls
+static uint8_t* emptyIsNull( int32_t const* pOffsets, int32_t nAligns, int64_t* pNullCount ) {
+	int32_t idx;
+	int64_t nNulls = 0;
+	for ( idx = 0; idx < nAligns; ++idx ) nNulls += pOffsets[idx] == pOffsets[idx+1];
+	*pNullCount = nNulls;
+	if ( !nNulls ) return 0;
+	uint8_t* pValid = calloc((nAligns + 7) >> 3, 1);
+	for ( idx = 0; idx < nAligns; ++idx )
+		if ( pOffsets[idx] != pOffsets[idx+1] ) pValid[idx >> 3] |= 1 << (idx & 7);
+	return pValid;
+}
+
+void arrow_exportColumns( char* pColumns, struct ArrowSchema* pSchema, struct ArrowArray* pArray ) {
+	int32_t const* pHdr = (int32_t const*)pColumns;
+	int32_t nSeqs = pHdr[JNIBWA_COLS_N_SEQS];
+	int32_t nAligns = pHdr[JNIBWA_COLS_N_ALIGNS];
+	void const* pCol[JNIBWA_COLS_N];
+	int idx;
+	for ( idx = 0; idx < JNIBWA_COLS_N; ++idx ) pCol[idx] = pColumns + pHdr[JNIBWA_COLS_HDR_COUNTS + idx];
+
+	arrow_schema_data_t* pSchemaData = malloc(sizeof(arrow_schema_data_t));
+	pSchemaData->refCount = ARROW_N_FIELDS + 2;
+	for ( idx = 0; idx <= ARROW_N_FIELDS; ++idx ) pSchemaData->pSchemaChildren[idx] = pSchemaData->schemas + idx;
+	initSchema(pSchema, "+s", "", 0, ARROW_N_FIELDS, pSchemaData->pSchemaChildren, pSchemaData);
+	for ( idx = 0; idx < ARROW_N_FIELDS; ++idx ) {
+		arrow_field_t const* pField = gFields + idx;
+		int isList = idx == ARROW_FIELD_CIGAR;
+		initSchema(pSchemaData->schemas + idx, pField->format, pField->name, pField->flags, isList,
+					isList ? pSchemaData->pSchemaChildren + ARROW_N_FIELDS : 0, pSchemaData);
+	}
+	initSchema(pSchemaData->schemas + ARROW_N_FIELDS, "i", "item", 0, 0, 0, pSchemaData);
+
+	arrow_array_data_t* pData = calloc(1, sizeof(arrow_array_data_t));
+	pData->refCount = ARROW_N_FIELDS + 2;
+	pData->pColumns = pColumns;
+	pData->pSeqs = malloc((nAligns ? nAligns : 1)*sizeof(int32_t));
+	int32_t const* pFirstAlign = pCol[JNIBWA_COL_FIRST_ALIGN];
+	int32_t seqIdx;
+	for ( seqIdx = 0; seqIdx < nSeqs; ++seqIdx ) {
+		int32_t alignIdx;
+		for ( alignIdx = pFirstAlign[seqIdx]; alignIdx < pFirstAlign[seqIdx+1]; ++alignIdx )
+			pData->pSeqs[alignIdx] = seqIdx;
+	}
+	for ( idx = 0; idx <= ARROW_N_FIELDS; ++idx ) pData->pArrayChildren[idx] = pData->arrays + idx;
+	void const** pTopBuffers = pData->buffers[ARROW_N_FIELDS + 1];
+	initArray(pArray, nAligns, 0, 1, pTopBuffers, ARROW_N_FIELDS, pData->pArrayChildren, pData);
+	for ( idx = 0; idx < ARROW_N_FIELDS; ++idx ) {
+		arrow_field_t const* pField = gFields + idx;
+		void const** buffers = pData->buffers[idx];
+		struct ArrowArray* pChild = pData->arrays + idx;
+		if ( idx == ARROW_FIELD_CIGAR ) {
+			buffers[1] = pCol[JNIBWA_COL_CIGAR_OFF];
+			initArray(pChild, nAligns, 0, 2, buffers, 1, pData->pArrayChildren + ARROW_N_FIELDS, pData);
+		} else if ( idx == ARROW_FIELD_MD || idx == ARROW_FIELD_XA ) {
+			int64_t nullCount;
+			int isXA = idx == ARROW_FIELD_XA;
+			buffers[0] = pData->pValid[isXA] = emptyIsNull(pCol[pField->col], nAligns, &nullCount);
+			buffers[1] = pCol[pField->col];
+			buffers[2] = pCol[isXA ? JNIBWA_COL_XA : JNIBWA_COL_MD];
+			initArray(pChild, nAligns, nullCount, 3, buffers, 0, 0, pData);
+		} else {
+			buffers[1] = pField->col < 0 ? pData->pSeqs : pCol[pField->col];
+			initArray(pChild, nAligns, 0, 2, buffers, 0, 0, pData);
+		}
+	}
+	void const** pItemBuffers = pData->buffers[ARROW_N_FIELDS];
+	pItemBuffers[1] = pCol[JNIBWA_COL_CIGAR];
+	initArray(pData->arrays + ARROW_N_FIELDS, pHdr[JNIBWA_COLS_N_CIGAR_OPS], 0, 2, pItemBuffers, 0, 0, pData);
+}
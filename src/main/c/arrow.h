@@ -0,0 +1,63 @@
+/*
+ * arrow.h
+ */
+
+#ifndef ARROW_H_
+#define ARROW_H_
+
+#include <stdint.h>
+
+// The Apache Arrow C data interface, exactly as the Arrow spec gives it (it's meant to be copied into any project
+// that speaks it, so that there's no library to depend on).
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+	// Array type description
+	const char* format;
+	const char* name;
+	const char* metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema** children;
+	struct ArrowSchema* dictionary;
+
+	// Release callback
+	void (*release)(struct ArrowSchema*);
+	// Opaque producer-specific data
+	void* private_data;
+};
+
+struct ArrowArray {
+	// Array data description
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void** buffers;
+	struct ArrowArray** children;
+	struct ArrowArray* dictionary;
+
+	// Release callback
+	void (*release)(struct ArrowArray*);
+	// Opaque producer-specific data
+	void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+// Exports a batch's columns (see columns.h) as an Arrow struct array with one element per alignment, which any
+// Arrow implementation can import as a record batch.  Its fields are:
+//   seq (the read's index in the batch), flag, mapq, refId, pos, cigar (a list of packed ops), NM, AS, XS,
+//   MD and XA (strings, null if the alignment hasn't got the tag), mateRefId, matePos, and tlen
+// all int32 but for cigar, MD, and XA.  The array's buffers point into the columns, with no copying.  The array
+// takes over the columns (which must be malloc'd), and frees them when it (and every child that the consumer has
+// moved elsewhere) has been released.  The schema is released separately.
+void arrow_exportColumns( char* pColumns, struct ArrowSchema* pSchema, struct ArrowArray* pArray );
+
+#endif /* ARROW_H_ */
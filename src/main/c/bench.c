@@ -0,0 +1,289 @@
+/*
+ * bench.c
+ *
+ * Times the JNI wrapper layer (jnibwa_openIndex and jnibwa_createAlignments) without a JVM.
+ * For each combination of read length, batch size, and thread count, it aligns batches of reads and reports
+ * the throughput, percentiles of the batch latency and of each stage's latency, and the peak RSS (on Linux, the
+ * combination's own peak;  elsewhere, the process's peak so far).
+ * Reads are simulated from the reference (with about 1% mismatches, half of them reverse-complemented),
+ * or taken from a FASTQ file (plain or gzipped) and truncated to each read length.
+ *
+ * usage: bench [options] index.img
+ *   -l LENS     comma-separated read lengths [101,151,251]
+ *   -b SIZES    comma-separated batch sizes, in reads [1000,10000]
+ *   -t THREADS  comma-separated thread counts [1,4]
+ *   -n N        reads to align for each combination [100000]
+ *   -q FILE     take reads from this FASTQ file, rather than simulating them
+ *   -p          align the reads as pairs
+ *   -s SEED     random seed [11]
+ *   -P          pre-populate the index mapping
+ *   -d          align each distinct read (or pair) in a batch just once
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <zlib.h>
+#include <sys/resource.h>
+
+#include "jnibwa.h"
+#include "pool.h"
+#include "stats.h"
+#include "bwa/bntseq.h"
+
+#define MAX_LIST 16
+
+typedef struct {
+	int vals[MAX_LIST];
+	int n;
+} int_list_t;
+
+static int parseList( char const* str, int_list_t* pList ) {
+	pList->n = 0;
+	while ( *str && pList->n < MAX_LIST ) {
+		char* end;
+		long val = strtol(str, &end, 10);
+		if ( end == str || val <= 0 ) return -1;
+		pList->vals[pList->n++] = val;
+		str = *end == ',' ? end + 1 : end;
+	}
+	return pList->n ? 0 : -1;
+}
+
+// a collection of reads, as null-terminated ASCII strings
+typedef struct {
+	char** seqs;
+	int nSeqs;
+	int cap;
+} reads_t;
+
+static void reads_add( reads_t* pReads, char* seq ) {
+	if ( pReads->nSeqs == pReads->cap ) {
+		pReads->cap = pReads->cap ? 2*pReads->cap : 1024;
+		pReads->seqs = realloc(pReads->seqs, pReads->cap*sizeof(char*));
+	}
+	pReads->seqs[pReads->nSeqs++] = seq;
+}
+
+static void reads_destroy( reads_t* pReads ) {
+	int idx;
+	for ( idx = 0; idx < pReads->nSeqs; ++idx ) free(pReads->seqs[idx]);
+	free(pReads->seqs);
+	memset(pReads, 0, sizeof(reads_t));
+}
+
+static void simulateReads( bwaidx_t* pIdx, int readLen, int nReads, int isPaired, reads_t* pReads ) {
+	static char const BASES[] = "ACGT";
+	int64_t lPac = pIdx->bns->l_pac;
+	int fragLen = isPaired ? 3*readLen : readLen;
+	if ( lPac <= fragLen ) {
+		fprintf(stderr, "The reference is too short to simulate reads of length %d\n", readLen);
+		exit(1);
+	}
+	while ( pReads->nSeqs < nReads ) {
+		int64_t beg = (int64_t)(drand48()*(lPac - fragLen));
+		int mate;
+		for ( mate = 0; mate < (isPaired ? 2 : 1); ++mate ) {
+			char* seq = malloc(readLen + 1);
+			int isRC = isPaired ? mate : lrand48() & 1;
+			int64_t off = mate ? beg + fragLen - readLen : beg;
+			int idx;
+			for ( idx = 0; idx < readLen; ++idx ) {
+				int64_t pos = isRC ? off + readLen - 1 - idx : off + idx;
+				int base = pIdx->pac[pos>>2] >> ((~pos&3)<<1) & 3;
+				if ( isRC ) base = 3 - base;
+				if ( drand48() < .01 ) base = (base + 1 + lrand48()%3) & 3;
+				seq[idx] = BASES[base];
+			}
+			seq[readLen] = 0;
+			reads_add(pReads, seq);
+		}
+	}
+}
+
+static void readFastq( char const* fileName, int readLen, int nReads, reads_t* pReads ) {
+	gzFile fp = gzopen(fileName, "r");
+	if ( !fp ) {
+		fprintf(stderr, "Can't open %s\n", fileName);
+		exit(1);
+	}
+	char line[65536];
+	long lineNo = 0;
+	while ( pReads->nSeqs < nReads && gzgets(fp, line, sizeof(line)) ) {
+		if ( (lineNo++ & 3) != 1 ) continue;
+		size_t len = strcspn(line, "\r\n");
+		if ( len < readLen ) continue;
+		line[readLen] = 0;
+		reads_add(pReads, strdup(line));
+	}
+	gzclose(fp);
+	if ( !pReads->nSeqs ) {
+		fprintf(stderr, "No reads of length %d or more in %s\n", readLen, fileName);
+		exit(1);
+	}
+}
+
+static int cmpInt64( void const* p1, void const* p2 ) {
+	int64_t v1 = *(int64_t const*)p1;
+	int64_t v2 = *(int64_t const*)p2;
+	return v1 < v2 ? -1 : v1 > v2;
+}
+
+static double percentileMs( int64_t* vals, int nVals, double pct ) {
+	int idx = (int)(pct*(nVals - 1) + .5);
+	return vals[idx]*1e-6;
+}
+
+// On Linux, the peak RSS reported for each combination is VmHWM, which writing 5 to clear_refs resets to the
+// current RSS before the combination starts.  Elsewhere it's getrusage's high-water mark for the whole process.
+static void resetPeakRSS( void ) {
+#ifdef __linux__
+	int fd = open("/proc/self/clear_refs", O_WRONLY);
+	if ( fd != -1 ) {
+		if ( write(fd, "5", 1) != 1 ) fprintf(stderr, "Can't reset the peak RSS\n");
+		close(fd);
+	}
+#endif
+}
+
+static long peakRSSMB( void ) {
+#ifdef __linux__
+	FILE* fp = fopen("/proc/self/status", "r");
+	if ( fp ) {
+		char line[256];
+		long kb = -1;
+		while ( kb < 0 && fgets(line, sizeof(line), fp) )
+			if ( !strncmp(line, "VmHWM:", 6) ) kb = strtol(line + 6, 0, 10);
+		fclose(fp);
+		if ( kb >= 0 ) return kb >> 10;
+	}
+#endif
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss >> 20;
+#else
+	return usage.ru_maxrss >> 10;
+#endif
+}
+
+static int64_t const* stageCol( int64_t const* pStats, int stage ) { return pStats + 1 + stage; }
+
+static void runBenchmark( bwaidx_t* pIdx, reads_t* pReads, int readLen, int batchSize, int nThreads, int isPaired,
+							int jobFlags ) {
+	if ( isPaired && (batchSize & 1) ) batchSize += 1;
+	resetPeakRSS();
+	mem_opt_t* pOpts = mem_opt_init();
+	pOpts->n_threads = nThreads;
+	if ( isPaired ) pOpts->flag |= MEM_F_PE;
+	pool_configure(nThreads > 1 ? nThreads - 1 : 0, 0);
+
+	int nBatches = (pReads->nSeqs + batchSize - 1) / batchSize;
+	int64_t* latencies = malloc(nBatches*sizeof(int64_t));
+	int64_t* stageLatencies = malloc(JNIBWA_STATS_N_STAGES*nBatches*sizeof(int64_t));
+	size_t statsSize = stats_exportSize(nThreads);
+	int64_t* pStats = malloc(statsSize);
+	char* seqBuf = malloc(sizeof(uint32_t) + batchSize*(readLen + 1));
+
+	int64_t begNs = stats_nowNs();
+	int batch;
+	for ( batch = 0; batch < nBatches; ++batch ) {
+		int first = batch*batchSize;
+		int nSeqs = pReads->nSeqs - first < batchSize ? pReads->nSeqs - first : batchSize;
+		*(uint32_t*)seqBuf = nSeqs;
+		char* pSeq = seqBuf + sizeof(uint32_t);
+		int idx;
+		for ( idx = first; idx < first + nSeqs; ++idx ) pSeq = stpcpy(pSeq, pReads->seqs[idx]) + 1;
+
+		int64_t batchBegNs = stats_nowNs();
+		size_t resultsSize;
+		void* pResults = jnibwa_createAlignments(pIdx, pOpts, 0, seqBuf, JNIBWA_SEQS_ASCII, JNIBWA_OUTPUT_BAMISH,
+													jobFlags, 0, 0, pStats, statsSize, &resultsSize);
+		latencies[batch] = stats_nowNs() - batchBegNs;
+		free(pResults);
+		int stage;
+		for ( stage = 0; stage < JNIBWA_STATS_N_STAGES; ++stage )
+			stageLatencies[stage*nBatches + batch] = *stageCol(pStats, stage);
+	}
+	double elapsedSecs = (stats_nowNs() - begNs)*1e-9;
+
+	long maxRSSMB = peakRSSMB();
+	qsort(latencies, nBatches, sizeof(int64_t), cmpInt64);
+	printf("%d\t%d\t%d\t%d\t%.0f\t%.3f\t%.3f\t%.3f", readLen, batchSize, nThreads, pReads->nSeqs,
+			pReads->nSeqs/elapsedSecs, percentileMs(latencies, nBatches, .5), percentileMs(latencies, nBatches, .9),
+			percentileMs(latencies, nBatches, .99));
+	int stage;
+	for ( stage = 0; stage < JNIBWA_STATS_TOTAL; ++stage ) {
+		int64_t* pVals = stageLatencies + stage*nBatches;
+		qsort(pVals, nBatches, sizeof(int64_t), cmpInt64);
+		printf("\t%.3f/%.3f", percentileMs(pVals, nBatches, .5), percentileMs(pVals, nBatches, .99));
+	}
+	printf("\t%ld\n", maxRSSMB);
+	fflush(stdout);
+
+	free(seqBuf);
+	free(pStats);
+	free(stageLatencies);
+	free(latencies);
+	free(pOpts);
+}
+
+static void usage( void ) {
+	fprintf(stderr, "usage: bench [-l lens] [-b batchSizes] [-t threadCounts] [-n nReads] [-q reads.fq] [-p] [-s seed] [-P] [-d] index.img\n");
+	exit(1);
+}
+
+int main( int argc, char** argv ) {
+	int_list_t readLens = { { 101, 151, 251 }, 3 };
+	int_list_t batchSizes = { { 1000, 10000 }, 2 };
+	int_list_t threadCounts = { { 1, 4 }, 2 };
+	int nReads = 100000;
+	char const* fastqName = 0;
+	int isPaired = 0;
+	long seed = 11;
+	int openOptions = 0;
+	int jobFlags = 0;
+	int opt;
+	while ( (opt = getopt(argc, argv, "l:b:t:n:q:ps:Pd")) != -1 ) {
+		switch ( opt ) {
+		case 'l': if ( parseList(optarg, &readLens) ) usage(); break;
+		case 'b': if ( parseList(optarg, &batchSizes) ) usage(); break;
+		case 't': if ( parseList(optarg, &threadCounts) ) usage(); break;
+		case 'n': nReads = atoi(optarg); break;
+		case 'q': fastqName = optarg; break;
+		case 'p': isPaired = 1; break;
+		case 's': seed = atol(optarg); break;
+		case 'P': openOptions |= JNIBWA_OPEN_POPULATE; break;
+		case 'd': jobFlags |= JNIBWA_JOB_DEDUP; break;
+		default: usage();
+		}
+	}
+	if ( optind != argc - 1 || nReads <= 0 ) usage();
+
+	int fd = open(argv[optind], O_RDONLY);
+	bwaidx_t* pIdx = fd == -1 ? 0 : jnibwa_openIndex(fd, openOptions);
+	if ( !pIdx ) {
+		fprintf(stderr, "Can't open index image %s\n", argv[optind]);
+		return 1;
+	}
+	srand48(seed);
+
+	printf("readLen\tbatchSize\tthreads\treads\treadsPerSec\tbatchMs.p50\tbatchMs.p90\tbatchMs.p99"
+			"\tparseMs.p50/p99\tseedExtendMs.p50/p99\tpestatMs.p50/p99\tpairFormatMs.p50/p99\tmaxRSSMB\n");
+	int lenIdx, batchIdx, threadIdx;
+	for ( lenIdx = 0; lenIdx < readLens.n; ++lenIdx ) {
+		reads_t reads = { 0, 0, 0 };
+		if ( fastqName ) readFastq(fastqName, readLens.vals[lenIdx], nReads, &reads);
+		else simulateReads(pIdx, readLens.vals[lenIdx], nReads, isPaired, &reads);
+		for ( batchIdx = 0; batchIdx < batchSizes.n; ++batchIdx )
+			for ( threadIdx = 0; threadIdx < threadCounts.n; ++threadIdx )
+				runBenchmark(pIdx, &reads, readLens.vals[lenIdx], batchSizes.vals[batchIdx],
+								threadCounts.vals[threadIdx], isPaired, jobFlags);
+		reads_destroy(&reads);
+	}
+	jnibwa_destroyIndex(pIdx);
+	return 0;
+}
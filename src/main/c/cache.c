@@ -0,0 +1,159 @@
+/*
+ * cache.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+#define CACHE_MIN_BUCKETS 1024
+
+static size_t entrySize( uint32_t seqLen, uint32_t resultLen ) {
+	return sizeof(cache_entry_t) + seqLen + resultLen;
+}
+
+static uint32_t bucketIdx( jnibwa_cache_t* pCache, uint64_t seqHash, uint64_t optsHash ) {
+	uint64_t hash = (seqHash ^ optsHash) * 0x9e3779b97f4a7c15ULL;
+	return (hash >> 32) & (pCache->nBuckets - 1);
+}
+
+static void lru_unlink( cache_entry_t* pEntry ) {
+	pEntry->pLRUPrev->pLRUNext = pEntry->pLRUNext;
+	pEntry->pLRUNext->pLRUPrev = pEntry->pLRUPrev;
+}
+
+static void lru_pushFront( jnibwa_cache_t* pCache, cache_entry_t* pEntry ) {
+	pEntry->pLRUPrev = &pCache->lru;
+	pEntry->pLRUNext = pCache->lru.pLRUNext;
+	pEntry->pLRUNext->pLRUPrev = pEntry;
+	pCache->lru.pLRUNext = pEntry;
+}
+
+static cache_entry_t** findSlot( jnibwa_cache_t* pCache, uint64_t seqHash, uint64_t optsHash,
+									char const* pSeq, uint32_t seqLen ) {
+	cache_entry_t** ppEntry = pCache->pBuckets + bucketIdx(pCache, seqHash, optsHash);
+	cache_entry_t* pEntry;
+	while ( (pEntry = *ppEntry) ) {
+		if ( pEntry->seqHash == seqHash && pEntry->optsHash == optsHash && pEntry->seqLen == seqLen &&
+				!memcmp(pEntry->data, pSeq, seqLen) )
+			break;
+		ppEntry = &pEntry->pHashNext;
+	}
+	return ppEntry;
+}
+
+static void evict( jnibwa_cache_t* pCache, cache_entry_t* pEntry ) {
+	cache_entry_t** ppEntry = findSlot(pCache, pEntry->seqHash, pEntry->optsHash, pEntry->data, pEntry->seqLen);
+	*ppEntry = pEntry->pHashNext;
+	lru_unlink(pEntry);
+	pCache->usedBytes -= entrySize(pEntry->seqLen, pEntry->resultLen);
+	pCache->nEntries -= 1;
+	pCache->nEvictions += 1;
+	free(pEntry);
+}
+
+static void evictUntil( jnibwa_cache_t* pCache, size_t maxBytes ) {
+	while ( pCache->usedBytes > maxBytes && pCache->lru.pLRUPrev != &pCache->lru )
+		evict(pCache, pCache->lru.pLRUPrev);
+}
+
+// doubles the number of buckets once the chains get long
+static void grow( jnibwa_cache_t* pCache ) {
+	uint32_t nOldBuckets = pCache->nBuckets;
+	cache_entry_t** pOldBuckets = pCache->pBuckets;
+	cache_entry_t** pNewBuckets = calloc(2*nOldBuckets, sizeof(cache_entry_t*));
+	if ( !pNewBuckets ) return;
+	pCache->nBuckets = 2*nOldBuckets;
+	pCache->pBuckets = pNewBuckets;
+	uint32_t idx;
+	for ( idx = 0; idx < nOldBuckets; ++idx ) {
+		cache_entry_t* pEntry = pOldBuckets[idx];
+		while ( pEntry ) {
+			cache_entry_t* pNext = pEntry->pHashNext;
+			cache_entry_t** ppBucket = pNewBuckets + bucketIdx(pCache, pEntry->seqHash, pEntry->optsHash);
+			pEntry->pHashNext = *ppBucket;
+			*ppBucket = pEntry;
+			pEntry = pNext;
+		}
+	}
+	free(pOldBuckets);
+}
+
+jnibwa_cache_t* cache_create( size_t capBytes ) {
+	jnibwa_cache_t* pCache = calloc(1, sizeof(jnibwa_cache_t));
+	pthread_mutex_init(&pCache->lock, 0);
+	pCache->capBytes = capBytes;
+	pCache->nBuckets = CACHE_MIN_BUCKETS;
+	pCache->pBuckets = calloc(pCache->nBuckets, sizeof(cache_entry_t*));
+	pCache->lru.pLRUPrev = pCache->lru.pLRUNext = &pCache->lru;
+	return pCache;
+}
+
+void cache_destroy( jnibwa_cache_t* pCache ) {
+	cache_entry_t* pEntry = pCache->lru.pLRUNext;
+	while ( pEntry != &pCache->lru ) {
+		cache_entry_t* pNext = pEntry->pLRUNext;
+		free(pEntry);
+		pEntry = pNext;
+	}
+	free(pCache->pBuckets);
+	pthread_mutex_destroy(&pCache->lock);
+	free(pCache);
+}
+
+void cache_setCapacity( jnibwa_cache_t* pCache, size_t capBytes ) {
+	cache_lock(pCache);
+	pCache->capBytes = capBytes;
+	evictUntil(pCache, capBytes);
+	cache_unlock(pCache);
+}
+
+void cache_getCounters( jnibwa_cache_t* pCache, int64_t counters[JNIBWA_CACHE_N_COUNTERS] ) {
+	cache_lock(pCache);
+	counters[JNIBWA_CACHE_HITS] = pCache->nHits;
+	counters[JNIBWA_CACHE_MISSES] = pCache->nMisses;
+	counters[JNIBWA_CACHE_INSERTS] = pCache->nInserts;
+	counters[JNIBWA_CACHE_EVICTIONS] = pCache->nEvictions;
+	counters[JNIBWA_CACHE_ENTRIES] = pCache->nEntries;
+	counters[JNIBWA_CACHE_BYTES] = pCache->usedBytes;
+	counters[JNIBWA_CACHE_CAPACITY] = pCache->capBytes;
+	cache_unlock(pCache);
+}
+
+cache_entry_t const* cache_find( jnibwa_cache_t* pCache, uint64_t seqHash, uint64_t optsHash,
+									char const* pSeq, uint32_t seqLen ) {
+	cache_entry_t* pEntry = *findSlot(pCache, seqHash, optsHash, pSeq, seqLen);
+	if ( !pEntry ) {
+		pCache->nMisses += 1;
+		return 0;
+	}
+	pCache->nHits += 1;
+	lru_unlink(pEntry);
+	lru_pushFront(pCache, pEntry);
+	return pEntry;
+}
+
+void cache_insert( jnibwa_cache_t* pCache, uint64_t seqHash, uint64_t optsHash, char const* pSeq, uint32_t seqLen,
+					char const* pResult, uint32_t resultLen ) {
+	size_t size = entrySize(seqLen, resultLen);
+	if ( size > pCache->capBytes ) return;
+	cache_entry_t** ppEntry = findSlot(pCache, seqHash, optsHash, pSeq, seqLen);
+	if ( *ppEntry ) return; // another batch got here first
+	cache_entry_t* pEntry = malloc(size);
+	if ( !pEntry ) return;
+	pEntry->seqHash = seqHash;
+	pEntry->optsHash = optsHash;
+	pEntry->seqLen = seqLen;
+	pEntry->resultLen = resultLen;
+	memcpy(pEntry->data, pSeq, seqLen);
+	memcpy(pEntry->data + seqLen, pResult, resultLen);
+	pEntry->pHashNext = 0;
+	*ppEntry = pEntry;
+	lru_pushFront(pCache, pEntry);
+	pCache->usedBytes += size;
+	pCache->nEntries += 1;
+	pCache->nInserts += 1;
+	evictUntil(pCache, pCache->capBytes);
+	if ( pCache->nEntries > 2*pCache->nBuckets ) grow(pCache);
+}
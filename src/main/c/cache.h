@@ -0,0 +1,77 @@
+/*
+ * cache.h
+ */
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// A bounded LRU cache of formatted results for unpaired reads, attached to an index.
+// Entries are keyed by a hash of the read's bases (as bwa's 0-4 codes) and a hash of the options it was aligned
+// with, and they hold a copy of the bases (so that a hash collision can't return the wrong read's results) and a
+// copy of the read's results, just as they were put into the arena.
+// The capacity is in bytes, counting the entries' bases and results and their bookkeeping.
+// Callers lock the cache around a series of finds or inserts, so a batch takes the lock once to look up all its
+// reads, and once more to insert the ones that missed.
+
+typedef struct cache_entry_s cache_entry_t;
+struct cache_entry_s {
+	uint64_t seqHash;
+	uint64_t optsHash;
+	cache_entry_t* pHashNext; // next entry in the same bucket
+	cache_entry_t* pLRUPrev;  // toward the most recently used
+	cache_entry_t* pLRUNext;  // toward the least recently used
+	uint32_t seqLen;
+	uint32_t resultLen;
+	char data[];              // seqLen bases, then resultLen bytes of results
+};
+
+// counters exported by cache_getCounters, in this order
+#define JNIBWA_CACHE_HITS 0
+#define JNIBWA_CACHE_MISSES 1
+#define JNIBWA_CACHE_INSERTS 2
+#define JNIBWA_CACHE_EVICTIONS 3
+#define JNIBWA_CACHE_ENTRIES 4
+#define JNIBWA_CACHE_BYTES 5
+#define JNIBWA_CACHE_CAPACITY 6
+#define JNIBWA_CACHE_N_COUNTERS 7
+
+typedef struct {
+	pthread_mutex_t lock;
+	size_t capBytes;
+	size_t usedBytes;
+	uint32_t nBuckets;
+	uint32_t nEntries;
+	cache_entry_t** pBuckets;
+	cache_entry_t lru; // sentinel:  lru.pLRUNext is the most recently used entry, lru.pLRUPrev the least
+	int64_t nHits;
+	int64_t nMisses;
+	int64_t nInserts;
+	int64_t nEvictions;
+} jnibwa_cache_t;
+
+jnibwa_cache_t* cache_create( size_t capBytes );
+void cache_destroy( jnibwa_cache_t* pCache );
+
+// a capacity of 0 empties the cache, and it stays empty until it's given some room
+void cache_setCapacity( jnibwa_cache_t* pCache, size_t capBytes );
+void cache_getCounters( jnibwa_cache_t* pCache, int64_t counters[JNIBWA_CACHE_N_COUNTERS] );
+
+// the rest must be called with the cache locked
+static inline void cache_lock( jnibwa_cache_t* pCache ) { pthread_mutex_lock(&pCache->lock); }
+static inline void cache_unlock( jnibwa_cache_t* pCache ) { pthread_mutex_unlock(&pCache->lock); }
+
+// returns the matching entry, or null, and counts a hit or a miss
+// the entry is valid only until the cache is unlocked
+cache_entry_t const* cache_find( jnibwa_cache_t* pCache, uint64_t seqHash, uint64_t optsHash,
+									char const* pSeq, uint32_t seqLen );
+
+// adds an entry (unless there's already one for the same read and options, or it's too big to fit at all),
+// evicting the least recently used entries to make room
+void cache_insert( jnibwa_cache_t* pCache, uint64_t seqHash, uint64_t optsHash, char const* pSeq, uint32_t seqLen,
+					char const* pResult, uint32_t resultLen );
+
+#endif /* CACHE_H_ */
@@ -0,0 +1,145 @@
+/*
+ * columns.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "columns.h"
+
+// one BAMish record (see fmt_BAMish in jnibwa.c), picked apart
+typedef struct {
+	int32_t flag;
+	int32_t mapQ;
+	int32_t const* pMapped; // refID, pos, NM, AS, XS, or null if unmapped
+	int32_t nCigar;
+	int32_t const* pCigar;
+	int32_t nMD;
+	char const* pMD;
+	int32_t nXA;
+	char const* pXA;
+	int32_t const* pMate; // mateRefID, matePos, tlen, or null if there's no mapped mate
+} bamish_rec_t;
+
+// fills pRec with the record at pWord, and returns the word just past it
+static int32_t const* parseRecord( int32_t const* pWord, bamish_rec_t* pRec ) {
+	int32_t flag_mapQ = *pWord++;
+	pRec->flag = (uint32_t)flag_mapQ >> 16;
+	pRec->mapQ = flag_mapQ & 0xff;
+	pRec->pMapped = 0;
+	pRec->nCigar = pRec->nMD = pRec->nXA = 0;
+	if ( !(pRec->flag & 0x4) ) {
+		pRec->pMapped = pWord;
+		pWord += 5;
+		pRec->nCigar = *pWord++;
+		pRec->pCigar = pWord;
+		pWord += pRec->nCigar;
+		pRec->nMD = *pWord++;
+		pRec->pMD = (char const*)pWord;
+		pWord += (pRec->nMD + 3) >> 2;
+		pRec->nXA = *pWord++;
+		pRec->pXA = (char const*)pWord;
+		pWord += (pRec->nXA + 3) >> 2;
+	}
+	pRec->pMate = 0;
+	if ( (pRec->flag & 0x9) == 1 ) {
+		pRec->pMate = pWord;
+		pWord += 3;
+	}
+	return pWord;
+}
+
+static size_t align8( size_t len ) { return (len + 7) & ~(size_t)7; }
+
+void* columns_fromBAMish( char const* pResults, uint32_t nSeqs, char* pBuf, size_t bufSize, size_t* pLen ) {
+	int32_t const* pOffsets = (int32_t const*)pResults;
+	bamish_rec_t rec;
+	uint32_t seqIdx;
+	int32_t idx;
+
+	// the first pass just counts
+	int32_t counts[JNIBWA_COLS_HDR_COUNTS] = { nSeqs, 0, 0, 0, 0 };
+	for ( seqIdx = 0; seqIdx < nSeqs; ++seqIdx ) {
+		int32_t const* pWord = (int32_t const*)(pResults + pOffsets[seqIdx]);
+		int32_t nAligns = *pWord++;
+		counts[JNIBWA_COLS_N_ALIGNS] += nAligns;
+		for ( idx = 0; idx < nAligns; ++idx ) {
+			pWord = parseRecord(pWord, &rec);
+			counts[JNIBWA_COLS_N_CIGAR_OPS] += rec.nCigar;
+			counts[JNIBWA_COLS_N_MD_CHARS] += rec.nMD;
+			counts[JNIBWA_COLS_N_XA_CHARS] += rec.nXA;
+		}
+	}
+
+	size_t nAligns = counts[JNIBWA_COLS_N_ALIGNS];
+	size_t colLens[JNIBWA_COLS_N];
+	colLens[JNIBWA_COL_FIRST_ALIGN] = (nSeqs + 1)*sizeof(int32_t);
+	for ( idx = JNIBWA_COL_FLAG; idx <= JNIBWA_COL_TLEN; ++idx ) colLens[idx] = nAligns*sizeof(int32_t);
+	for ( idx = JNIBWA_COL_CIGAR_OFF; idx <= JNIBWA_COL_XA_OFF; ++idx ) colLens[idx] = (nAligns + 1)*sizeof(int32_t);
+	colLens[JNIBWA_COL_CIGAR] = counts[JNIBWA_COLS_N_CIGAR_OPS]*sizeof(int32_t);
+	colLens[JNIBWA_COL_MD] = counts[JNIBWA_COLS_N_MD_CHARS];
+	colLens[JNIBWA_COL_XA] = counts[JNIBWA_COLS_N_XA_CHARS];
+	size_t colOffs[JNIBWA_COLS_N];
+	size_t len = JNIBWA_COLS_HDR_SIZE;
+	for ( idx = 0; idx < JNIBWA_COLS_N; ++idx ) {
+		colOffs[idx] = len;
+		len = align8(len + colLens[idx]);
+	}
+
+	if ( len > INT32_MAX ) return 0; // the header's int32 column offsets couldn't address it
+	char* pCols = pBuf && bufSize >= len ? pBuf : malloc(len);
+	int32_t* pHdr = (int32_t*)pCols;
+	memcpy(pHdr, counts, sizeof(counts));
+	int32_t* pCol[JNIBWA_COLS_N];
+	for ( idx = 0; idx < JNIBWA_COLS_N; ++idx ) {
+		pHdr[JNIBWA_COLS_HDR_COUNTS + idx] = colOffs[idx];
+		pCol[idx] = (int32_t*)(pCols + colOffs[idx]);
+		size_t padBeg = colOffs[idx] + colLens[idx];
+		memset(pCols + padBeg, 0, align8(padBeg) - padBeg);
+	}
+	char* pMDChars = (char*)pCol[JNIBWA_COL_MD];
+	char* pXAChars = (char*)pCol[JNIBWA_COL_XA];
+
+	// the second pass fills in the columns
+	int32_t alignIdx = 0, cigarIdx = 0, mdIdx = 0, xaIdx = 0;
+	for ( seqIdx = 0; seqIdx < nSeqs; ++seqIdx ) {
+		int32_t const* pWord = (int32_t const*)(pResults + pOffsets[seqIdx]);
+		int32_t nSeqAligns = *pWord++;
+		pCol[JNIBWA_COL_FIRST_ALIGN][seqIdx] = alignIdx;
+		for ( idx = 0; idx < nSeqAligns; ++idx, ++alignIdx ) {
+			pWord = parseRecord(pWord, &rec);
+			pCol[JNIBWA_COL_FLAG][alignIdx] = rec.flag;
+			pCol[JNIBWA_COL_MAPQ][alignIdx] = rec.mapQ;
+			pCol[JNIBWA_COL_REF_ID][alignIdx] = rec.pMapped ? rec.pMapped[0] : -1;
+			pCol[JNIBWA_COL_POS][alignIdx] = rec.pMapped ? rec.pMapped[1] : -1;
+			pCol[JNIBWA_COL_NM][alignIdx] = rec.pMapped ? rec.pMapped[2] : 0;
+			pCol[JNIBWA_COL_AS][alignIdx] = rec.pMapped ? rec.pMapped[3] : 0;
+			pCol[JNIBWA_COL_XS][alignIdx] = rec.pMapped ? rec.pMapped[4] : 0;
+			pCol[JNIBWA_COL_MATE_REF_ID][alignIdx] = rec.pMate ? rec.pMate[0] : -1;
+			pCol[JNIBWA_COL_MATE_POS][alignIdx] = rec.pMate ? rec.pMate[1] : -1;
+			pCol[JNIBWA_COL_TLEN][alignIdx] = rec.pMate ? rec.pMate[2] : 0;
+			pCol[JNIBWA_COL_CIGAR_OFF][alignIdx] = cigarIdx;
+			pCol[JNIBWA_COL_MD_OFF][alignIdx] = mdIdx;
+			pCol[JNIBWA_COL_XA_OFF][alignIdx] = xaIdx;
+			if ( !rec.pMapped ) continue;
+			memcpy(pCol[JNIBWA_COL_CIGAR] + cigarIdx, rec.pCigar, rec.nCigar*sizeof(int32_t));
+			cigarIdx += rec.nCigar;
+			memcpy(pMDChars + mdIdx, rec.pMD, rec.nMD);
+			mdIdx += rec.nMD;
+			memcpy(pXAChars + xaIdx, rec.pXA, rec.nXA);
+			xaIdx += rec.nXA;
+		}
+	}
+	pCol[JNIBWA_COL_FIRST_ALIGN][nSeqs] = alignIdx;
+	pCol[JNIBWA_COL_CIGAR_OFF][alignIdx] = cigarIdx;
+	pCol[JNIBWA_COL_MD_OFF][alignIdx] = mdIdx;
+	pCol[JNIBWA_COL_XA_OFF][alignIdx] = xaIdx;
+
+	*pLen = len;
+	return pCols;
+}
+
+size_t columns_size( char const* pColumns ) {
+	int32_t const* pHdr = (int32_t const*)pColumns;
+	return align8(pHdr[JNIBWA_COLS_HDR_COUNTS + JNIBWA_COL_XA] + pHdr[JNIBWA_COLS_N_XA_CHARS]);
+}
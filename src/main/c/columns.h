@@ -0,0 +1,58 @@
+/*
+ * columns.h
+ */
+
+#ifndef COLUMNS_H_
+#define COLUMNS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The JNIBWA_OUTPUT_COLUMNS layout:  a batch's alignments as parallel arrays (one element per alignment, with
+// each read's alignments together, and the reads in input order), so that alignment i is found without parsing
+// anything before it, and a whole column can be copied or scanned at once.
+// It starts with a header of int32_t's:
+//   the number of reads, alignments, and cigar ops, and the number of MD and XA characters
+//   the byte offset of each of the JNIBWA_COLS_N columns below, in that order (each starts on an 8-byte boundary)
+// Every column is int32_t's except the MD and XA characters.  A column of offsets has one more element than it
+// indexes, so the last one marks the end.  The MD and XA strings are packed end to end, with no terminators or
+// padding, and an alignment without the tag has an empty string.  Unmapped alignments have a refId and pos of -1,
+// 0 for NM, AS, and XS, and no cigar ops, and alignments without a mapped mate have a mate refId and pos of -1
+// and a tlen of 0.
+#define JNIBWA_COLS_N_SEQS 0
+#define JNIBWA_COLS_N_ALIGNS 1
+#define JNIBWA_COLS_N_CIGAR_OPS 2
+#define JNIBWA_COLS_N_MD_CHARS 3
+#define JNIBWA_COLS_N_XA_CHARS 4
+#define JNIBWA_COLS_HDR_COUNTS 5
+
+#define JNIBWA_COL_FIRST_ALIGN 0   // nSeqs+1:  the index of each read's first alignment
+#define JNIBWA_COL_FLAG 1          // nAligns:  the SAM flag
+#define JNIBWA_COL_MAPQ 2          // nAligns
+#define JNIBWA_COL_REF_ID 3        // nAligns
+#define JNIBWA_COL_POS 4           // nAligns:  0-based
+#define JNIBWA_COL_NM 5            // nAligns
+#define JNIBWA_COL_AS 6            // nAligns
+#define JNIBWA_COL_XS 7            // nAligns
+#define JNIBWA_COL_MATE_REF_ID 8   // nAligns
+#define JNIBWA_COL_MATE_POS 9      // nAligns
+#define JNIBWA_COL_TLEN 10         // nAligns
+#define JNIBWA_COL_CIGAR_OFF 11    // nAligns+1:  the index of each alignment's first cigar op
+#define JNIBWA_COL_MD_OFF 12       // nAligns+1:  the index of each alignment's first MD character
+#define JNIBWA_COL_XA_OFF 13       // nAligns+1:  the index of each alignment's first XA character
+#define JNIBWA_COL_CIGAR 14        // nCigarOps:  len<<4 | op (BAM op codes)
+#define JNIBWA_COL_MD 15           // nMDChars
+#define JNIBWA_COL_XA 16           // nXAChars
+#define JNIBWA_COLS_N 17
+
+#define JNIBWA_COLS_HDR_SIZE ((JNIBWA_COLS_HDR_COUNTS + JNIBWA_COLS_N)*sizeof(int32_t))
+
+// rearranges a batch's results in the JNIBWA_OUTPUT_BAMISH layout (the per-read offsets and the records) into
+// columns, which are written to pBuf if they'll fit, and otherwise to memory that the caller must free
+// returns null if the columns would pass 2 GB
+void* columns_fromBAMish( char const* pResults, uint32_t nSeqs, char* pBuf, size_t bufSize, size_t* pLen );
+
+// the length of the columns that start at pColumns
+size_t columns_size( char const* pColumns );
+
+#endif /* COLUMNS_H_ */
@@ -0,0 +1,645 @@
+/*
+ * image.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "image.h"
+#include "pool.h"
+#include "bwa/bwa.h"
+#include "bwa/bntseq.h"
+#include "bwa/bwt.h"
+#include "bwa/bwa_commit.h"
+
+// Writes an index image with exactly the layout that bwa_idx2mem builds in memory (and that bwa_mem2idx
+// expects), without ever holding the whole index in memory:
+//   bwt_t, bwt array, suffix array, bntseq_t, ambs, anns, name and anno strings, pac
+// The big components (bwt, sa, pac) are copied straight from the index files.  A reader thread fills one
+// buffer while the calling thread writes the other, so reading and writing overlap, and memory use is
+// bounded by the two buffers plus the (small) reference dictionary.
+// The integrity header (see image.h) goes in the first page of the file, which is left empty until the rest of
+// the image is written and its CRCs are known.  The CRCs are computed by the thread pool as each buffer goes by.
+
+#define IMAGE_BUF_SIZE (64L<<20)
+
+// A compressed image is the same image, cut into IMAGE_ZBLOCK_SIZE blocks, each deflated on its own (with zlib),
+// so that the blocks can be inflated in parallel, each straight into its place in memory.  The file is:
+//   image_zheader_t
+//   a table of nBlocks+1 uint64_t file offsets:  block i is the bytes from offset i up to offset i+1
+//   the compressed blocks
+// The blocks run right across the boundaries between components:  the big components, which are nearly all of
+// the image, are many blocks apiece anyway.
+#define IMAGE_ZBLOCK_SIZE (4L<<20)
+#define IMAGE_ZBLOCKS_PER_BUF (IMAGE_BUF_SIZE/IMAGE_ZBLOCK_SIZE)
+#define IMAGE_ZMAGIC 0x474d495a4157424aULL // "JBWAZIMG"
+#define IMAGE_ZVERSION 1
+
+typedef struct {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t blockSize;
+	uint64_t imageSize;
+	uint64_t nBlocks;
+} image_zheader_t;
+
+static int nCPUs( void ) {
+	long nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	return nThreads < 1 ? 1 : nThreads;
+}
+
+// CRCs are computed in pieces of this size by the thread pool, and then combined
+#define IMAGE_CRC_PIECE_SIZE (4L<<20)
+
+typedef struct {
+	uint8_t const* buf;
+	size_t len;
+	uint32_t* crcs;
+} image_crc_t;
+
+static void crcPiece( void* data, int i, int tid ) {
+	image_crc_t* pCrc = data;
+	size_t off = (size_t)i*IMAGE_CRC_PIECE_SIZE;
+	size_t len = pCrc->len - off < IMAGE_CRC_PIECE_SIZE ? pCrc->len - off : IMAGE_CRC_PIECE_SIZE;
+	pCrc->crcs[i] = crc32(0, pCrc->buf + off, len);
+}
+
+// appends buf to the data whose CRC32 is crc
+static uint32_t crcAppend( uint32_t crc, uint8_t const* buf, size_t len ) {
+	int nPieces = (len + IMAGE_CRC_PIECE_SIZE - 1) / IMAGE_CRC_PIECE_SIZE;
+	uint32_t* crcs = nPieces > 1 ? malloc(nPieces*sizeof(uint32_t)) : 0;
+	if ( !crcs ) {
+		while ( len ) {
+			size_t pieceLen = len < IMAGE_CRC_PIECE_SIZE ? len : IMAGE_CRC_PIECE_SIZE;
+			crc = crc32(crc, buf, pieceLen);
+			buf += pieceLen;
+			len -= pieceLen;
+		}
+		return crc;
+	}
+	image_crc_t job = { buf, len, crcs };
+	kt_for(nCPUs(), crcPiece, &job, nPieces);
+	int idx;
+	for ( idx = 0; idx < nPieces; ++idx ) {
+		size_t off = (size_t)idx*IMAGE_CRC_PIECE_SIZE;
+		crc = crc32_combine(crc, crcs[idx], len - off < IMAGE_CRC_PIECE_SIZE ? len - off : IMAGE_CRC_PIECE_SIZE);
+	}
+	free(crcs);
+	return crc;
+}
+
+// adds the piece of the image at imageOff to the CRCs of the components it overlaps
+static void crcImagePiece( image_header_t* pHdr, uint64_t imageOff, uint8_t const* buf, size_t len ) {
+	int idx;
+	for ( idx = 0; idx < IMAGE_N_COMPONENTS; ++idx ) {
+		image_component_t* pComp = pHdr->components + idx;
+		uint64_t beg = imageOff > pComp->off ? imageOff : pComp->off;
+		uint64_t end = imageOff + len < pComp->off + pComp->len ? imageOff + len : pComp->off + pComp->len;
+		if ( beg < end ) pComp->crc = crcAppend(pComp->crc, buf + (beg - imageOff), end - beg);
+	}
+}
+
+// the reference dictionary's part of the reference checksum
+static uint32_t crcDict( bntseq_t const* pBns ) {
+	uint32_t crc = 0;
+	int idx;
+	for ( idx = 0; idx < pBns->n_seqs; ++idx ) {
+		bntann1_t const* pAnn = pBns->anns + idx;
+		crc = crc32(crc, (Bytef const*)pAnn->name, strlen(pAnn->name) + 1);
+		uint8_t lenBytes[8];
+		int byteIdx;
+		for ( byteIdx = 0; byteIdx < 8; ++byteIdx ) lenBytes[byteIdx] = (uint64_t)pAnn->len >> (8*byteIdx);
+		crc = crc32(crc, lenBytes, sizeof(lenBytes));
+	}
+	return crc;
+}
+
+static uint32_t crcHeader( image_header_t const* pHdr ) {
+	return crc32(0, (Bytef const*)pHdr, offsetof(image_header_t, hdrCrc));
+}
+
+// .bwt starts with primary and L2[1..4];  .sa starts with primary, L2[1..4], sa_intv, and seq_len
+#define BWT_HDR_SIZE (5*sizeof(bwtint_t))
+#define SA_HDR_SIZE (7*sizeof(bwtint_t))
+
+// a piece of the image:  either some memory, or a range of an index file
+typedef struct {
+	void const* pMem;
+	int fd;
+	off_t off;
+	size_t len;
+	int comp; // the IMAGE_COMPONENT_* it's part of
+} image_seg_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char* bufs[2];
+	size_t lens[2];
+	int isFull[2]; // ready for the writer
+	int isLast[2]; // the last buffer of the image
+	int err;
+	image_seg_t* pSegs;
+	int nSegs;
+} image_pipe_t;
+
+static int readFully( int fd, char* buf, size_t len, off_t off ) {
+	while ( len ) {
+		ssize_t nRead = pread(fd, buf, len, off);
+		if ( nRead <= 0 ) return -1;
+		buf += nRead;
+		len -= nRead;
+		off += nRead;
+	}
+	return 0;
+}
+
+static int writeFully( int fd, char const* buf, size_t len ) {
+	while ( len ) {
+		ssize_t nWrote = write(fd, buf, len);
+		if ( nWrote <= 0 ) return -1;
+		buf += nWrote;
+		len -= nWrote;
+	}
+	return 0;
+}
+
+// where the writer puts the image:  either straight into the file, or through the compressor
+typedef struct {
+	int fd;
+	off_t baseOff; // where the compressed container starts:  its offsets are relative to this
+	int compress;
+	uint64_t nBlocks;
+	uint64_t nBlocksDone;
+	uint64_t fileOff;
+	uint64_t* pTable;
+	char const* src; // the buffer being compressed
+	size_t srcLen;
+	char* zbufs[IMAGE_ZBLOCKS_PER_BUF];
+	uLongf zlens[IMAGE_ZBLOCKS_PER_BUF];
+	int nErrs;
+} image_out_t;
+
+static int out_init( image_out_t* pOut, int fd, int compress, size_t imageSize ) {
+	memset(pOut, 0, sizeof(*pOut));
+	pOut->fd = fd;
+	pOut->baseOff = IMAGE_HDR_SIZE;
+	pOut->compress = compress;
+	if ( !compress ) return 0;
+	pOut->nBlocks = (imageSize + IMAGE_ZBLOCK_SIZE - 1) / IMAGE_ZBLOCK_SIZE;
+	pOut->pTable = calloc(pOut->nBlocks + 1, sizeof(uint64_t));
+	if ( !pOut->pTable ) return -1;
+	int idx;
+	for ( idx = 0; idx < IMAGE_ZBLOCKS_PER_BUF; ++idx )
+		if ( !(pOut->zbufs[idx] = malloc(compressBound(IMAGE_ZBLOCK_SIZE))) ) return -1;
+	image_zheader_t hdr = { IMAGE_ZMAGIC, IMAGE_ZVERSION, IMAGE_ZBLOCK_SIZE, imageSize, pOut->nBlocks };
+	// the table is written for real once we know where the blocks ended up
+	pOut->fileOff = sizeof(hdr) + (pOut->nBlocks + 1)*sizeof(uint64_t);
+	if ( writeFully(fd, (char const*)&hdr, sizeof(hdr)) ||
+		 writeFully(fd, (char const*)pOut->pTable, (pOut->nBlocks + 1)*sizeof(uint64_t)) ) return -1;
+	return 0;
+}
+
+static void out_compressBlock( void* data, int i, int tid ) {
+	image_out_t* pOut = data;
+	size_t off = i*IMAGE_ZBLOCK_SIZE;
+	size_t len = pOut->srcLen - off < IMAGE_ZBLOCK_SIZE ? pOut->srcLen - off : IMAGE_ZBLOCK_SIZE;
+	pOut->zlens[i] = compressBound(IMAGE_ZBLOCK_SIZE);
+	if ( compress2((Bytef*)pOut->zbufs[i], &pOut->zlens[i], (Bytef const*)pOut->src + off, len,
+					Z_DEFAULT_COMPRESSION) != Z_OK )
+		__sync_fetch_and_add(&pOut->nErrs, 1);
+}
+
+// all but the last buffer of the image are full, so blocks never straddle buffers
+static int out_write( image_out_t* pOut, char const* buf, size_t len ) {
+	if ( !pOut->compress ) return writeFully(pOut->fd, buf, len);
+	int nBlocks = (len + IMAGE_ZBLOCK_SIZE - 1) / IMAGE_ZBLOCK_SIZE;
+	pOut->src = buf;
+	pOut->srcLen = len;
+	kt_for(nCPUs(), out_compressBlock, pOut, nBlocks);
+	if ( pOut->nErrs || pOut->nBlocksDone + nBlocks > pOut->nBlocks ) { errno = EIO; return -1; }
+	int idx;
+	for ( idx = 0; idx < nBlocks; ++idx ) {
+		if ( writeFully(pOut->fd, pOut->zbufs[idx], pOut->zlens[idx]) ) return -1;
+		pOut->pTable[pOut->nBlocksDone++] = pOut->fileOff;
+		pOut->fileOff += pOut->zlens[idx];
+	}
+	return 0;
+}
+
+static int out_finish( image_out_t* pOut ) {
+	if ( !pOut->compress ) return 0;
+	if ( pOut->nBlocksDone != pOut->nBlocks ) { errno = EIO; return -1; }
+	pOut->pTable[pOut->nBlocks] = pOut->fileOff;
+	size_t tableLen = (pOut->nBlocks + 1)*sizeof(uint64_t);
+	return pwrite(pOut->fd, pOut->pTable, tableLen, pOut->baseOff + sizeof(image_zheader_t)) == tableLen ? 0 : -1;
+}
+
+static void out_destroy( image_out_t* pOut ) {
+	int idx;
+	for ( idx = 0; idx < IMAGE_ZBLOCKS_PER_BUF; ++idx ) free(pOut->zbufs[idx]);
+	free(pOut->pTable);
+}
+
+// hands off the current buffer, and waits for the writer to be done with the other one
+static int pipe_handOff( image_pipe_t* pPipe, int slot, int isLast ) {
+	pthread_mutex_lock(&pPipe->lock);
+	pPipe->isFull[slot] = 1;
+	pPipe->isLast[slot] = isLast;
+	pthread_cond_broadcast(&pPipe->cond);
+	slot ^= 1;
+	while ( pPipe->isFull[slot] && !pPipe->err ) pthread_cond_wait(&pPipe->cond, &pPipe->lock);
+	int err = pPipe->err;
+	pthread_mutex_unlock(&pPipe->lock);
+	pPipe->lens[slot] = 0;
+	return err ? -1 : slot;
+}
+
+static void* pipe_reader( void* arg ) {
+	image_pipe_t* pPipe = arg;
+	int slot = 0;
+	image_seg_t* pSeg;
+	for ( pSeg = pPipe->pSegs; pSeg != pPipe->pSegs + pPipe->nSegs; ++pSeg ) {
+		size_t segOff = 0;
+		while ( segOff < pSeg->len ) {
+			if ( pPipe->lens[slot] == IMAGE_BUF_SIZE && (slot = pipe_handOff(pPipe, slot, 0)) < 0 ) return 0;
+			size_t len = pSeg->len - segOff;
+			if ( len > IMAGE_BUF_SIZE - pPipe->lens[slot] ) len = IMAGE_BUF_SIZE - pPipe->lens[slot];
+			char* pDst = pPipe->bufs[slot] + pPipe->lens[slot];
+			if ( pSeg->pMem ) memcpy(pDst, (char const*)pSeg->pMem + segOff, len);
+			else if ( readFully(pSeg->fd, pDst, len, pSeg->off + segOff) ) {
+				pthread_mutex_lock(&pPipe->lock);
+				pPipe->err = errno ? errno : EIO;
+				pthread_cond_broadcast(&pPipe->cond);
+				pthread_mutex_unlock(&pPipe->lock);
+				return 0;
+			}
+			pPipe->lens[slot] += len;
+			segOff += len;
+		}
+	}
+	pipe_handOff(pPipe, slot, 1);
+	return 0;
+}
+
+// returns the open file descriptor and its size, or -1
+static int openComponent( char const* indexPrefix, char const* ext, off_t* pSize ) {
+	size_t len = strlen(indexPrefix);
+	char* fname = malloc(len + strlen(ext) + 1);
+	strcpy(fname, indexPrefix);
+	strcpy(fname + len, ext);
+	int fd = open(fname, O_RDONLY);
+	struct stat statBuf;
+	if ( fd == -1 || fstat(fd, &statBuf) == -1 ) {
+		printf("Failed to open %s: %s\n", fname, strerror(errno));
+		if ( fd != -1 ) close(fd);
+		fd = -1;
+	}
+	else *pSize = statBuf.st_size;
+	free(fname);
+	return fd;
+}
+
+int image_write( char const* indexPrefix, char const* imgName, int compress, image_progress_fn progress,
+					void* progressArg ) {
+	int result = 2;
+	int bwtFd = -1, saFd = -1, pacFd = -1, imgFd = -1;
+	bntseq_t* pBns = 0;
+	char* pStrings = 0;
+	image_pipe_t pipe;
+	memset(&pipe, 0, sizeof(pipe));
+	image_out_t out;
+	memset(&out, 0, sizeof(out));
+	off_t bwtFileSize, saFileSize, pacFileSize;
+	if ( (bwtFd = openComponent(indexPrefix, ".bwt", &bwtFileSize)) == -1 ||
+		 (saFd = openComponent(indexPrefix, ".sa", &saFileSize)) == -1 ||
+		 (pacFd = openComponent(indexPrefix, ".pac", &pacFileSize)) == -1 )
+		goto cleanup;
+
+	// the bwt_t is rebuilt just as bwt_restore_bwt and bwt_restore_sa would do it
+	bwt_t bwt;
+	memset(&bwt, 0, sizeof(bwt));
+	bwtint_t hdr[7];
+	if ( bwtFileSize < BWT_HDR_SIZE || readFully(bwtFd, (char*)hdr, BWT_HDR_SIZE, 0) ) {
+		printf("Failed to read %s.bwt: it's truncated\n", indexPrefix);
+		goto cleanup;
+	}
+	bwt.primary = hdr[0];
+	memcpy(bwt.L2+1, hdr+1, 4*sizeof(bwtint_t));
+	bwt.seq_len = bwt.L2[4];
+	bwt.bwt_size = (bwtFileSize - BWT_HDR_SIZE) >> 2;
+	bwt_gen_cnt_table(&bwt);
+	if ( saFileSize < SA_HDR_SIZE || readFully(saFd, (char*)hdr, SA_HDR_SIZE, 0) ) {
+		printf("Failed to read %s.sa: it's truncated\n", indexPrefix);
+		goto cleanup;
+	}
+	bwt.sa_intv = (int)hdr[5];
+	if ( hdr[0] != bwt.primary || hdr[6] != bwt.seq_len || bwt.sa_intv <= 0 ) {
+		printf("SA-BWT inconsistency for %s\n", indexPrefix);
+		goto cleanup;
+	}
+	bwt.n_sa = (bwt.seq_len + bwt.sa_intv) / bwt.sa_intv;
+	if ( saFileSize < SA_HDR_SIZE + (bwt.n_sa - 1)*sizeof(bwtint_t) ) {
+		printf("Failed to read %s.sa: it's truncated\n", indexPrefix);
+		goto cleanup;
+	}
+	static bwtint_t const saFirst = (bwtint_t)-1;
+
+	// the reference dictionary is small, so we let bwa read it
+	pBns = bns_restore(indexPrefix);
+	if ( pBns->fp_pac ) { fclose(pBns->fp_pac); pBns->fp_pac = 0; }
+	size_t pacLen = pBns->l_pac/4 + 1;
+	if ( pacFileSize < pacLen ) {
+		printf("Failed to read %s.pac: it's truncated\n", indexPrefix);
+		goto cleanup;
+	}
+	size_t stringsLen = 0;
+	int idx;
+	for ( idx = 0; idx < pBns->n_seqs; ++idx )
+		stringsLen += strlen(pBns->anns[idx].name) + strlen(pBns->anns[idx].anno) + 2;
+	pStrings = malloc(stringsLen ? stringsLen : 1);
+	char* pStr = pStrings;
+	for ( idx = 0; idx < pBns->n_seqs; ++idx ) {
+		pStr = stpcpy(pStr, pBns->anns[idx].name) + 1;
+		pStr = stpcpy(pStr, pBns->anns[idx].anno) + 1;
+	}
+	bntseq_t bns = *pBns;
+	bns.anns = 0;
+	bns.ambs = 0;
+
+	image_seg_t segs[] = {
+		{ &bwt, -1, 0, sizeof(bwt_t), IMAGE_COMPONENT_BWT },
+		{ 0, bwtFd, BWT_HDR_SIZE, bwt.bwt_size*sizeof(uint32_t), IMAGE_COMPONENT_BWT },
+		{ &saFirst, -1, 0, sizeof(bwtint_t), IMAGE_COMPONENT_SA },
+		{ 0, saFd, SA_HDR_SIZE, (bwt.n_sa - 1)*sizeof(bwtint_t), IMAGE_COMPONENT_SA },
+		{ &bns, -1, 0, sizeof(bntseq_t), IMAGE_COMPONENT_BNS },
+		{ pBns->ambs, -1, 0, pBns->n_holes*sizeof(bntamb1_t), IMAGE_COMPONENT_BNS },
+		{ pBns->anns, -1, 0, pBns->n_seqs*sizeof(bntann1_t), IMAGE_COMPONENT_BNS },
+		{ pStrings, -1, 0, stringsLen, IMAGE_COMPONENT_BNS },
+		{ 0, pacFd, 0, pacLen, IMAGE_COMPONENT_PAC } };
+	pipe.pSegs = segs;
+	pipe.nSegs = sizeof(segs)/sizeof(segs[0]);
+	image_header_t imgHdr;
+	memset(&imgHdr, 0, sizeof(imgHdr));
+	imgHdr.magic = IMAGE_MAGIC;
+	imgHdr.version = IMAGE_VERSION;
+	imgHdr.hdrLen = IMAGE_HDR_SIZE;
+	strncpy(imgHdr.bwaCommit, BWA_COMMIT, sizeof(imgHdr.bwaCommit) - 1);
+	imgHdr.isCompressed = compress != 0;
+	imgHdr.nComponents = IMAGE_N_COMPONENTS;
+	size_t imageSize = 0;
+	for ( idx = 0; idx < pipe.nSegs; ++idx ) {
+		image_component_t* pComp = imgHdr.components + segs[idx].comp;
+		if ( !pComp->len ) pComp->off = imageSize;
+		pComp->len += segs[idx].len;
+		imageSize += segs[idx].len;
+	}
+	imgHdr.imageLen = imageSize;
+	uint32_t dictCrc = crcDict(pBns);
+
+	imgFd = open(imgName, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if ( imgFd == -1 ) {
+		printf("Failed to open %s for writing: %s\n", imgName, strerror(errno));
+		goto cleanup;
+	}
+	pthread_mutex_init(&pipe.lock, 0);
+	pthread_cond_init(&pipe.cond, 0);
+	static char const emptyHdr[IMAGE_HDR_SIZE];
+	if ( writeFully(imgFd, emptyHdr, IMAGE_HDR_SIZE) || out_init(&out, imgFd, compress, imageSize) ) {
+		printf("Failed to start writing %s: %s\n", imgName, strerror(errno ? errno : ENOMEM));
+		goto cleanupPipe;
+	}
+	pipe.bufs[0] = malloc(IMAGE_BUF_SIZE);
+	pipe.bufs[1] = malloc(IMAGE_BUF_SIZE);
+	pthread_t reader;
+	if ( !pipe.bufs[0] || !pipe.bufs[1] || pthread_create(&reader, 0, pipe_reader, &pipe) ) {
+		printf("Failed to start reading %s\n", indexPrefix);
+		goto cleanupPipe;
+	}
+
+	// progress counts the header page, which is already written (if empty), so the total is the file's size
+	// (for an uncompressed image)
+	size_t nWritten = IMAGE_HDR_SIZE;
+	size_t progressSize = imageSize + IMAGE_HDR_SIZE;
+	int slot = 0;
+	int isLast = 0;
+	char const* errMsg = 0;
+	while ( !isLast ) {
+		pthread_mutex_lock(&pipe.lock);
+		while ( !pipe.isFull[slot] && !pipe.err ) pthread_cond_wait(&pipe.cond, &pipe.lock);
+		int err = pipe.err;
+		pthread_mutex_unlock(&pipe.lock);
+		if ( err ) { errno = err; errMsg = "Failed to read index files for"; break; }
+		size_t len = pipe.lens[slot];
+		isLast = pipe.isLast[slot];
+		crcImagePiece(&imgHdr, nWritten - IMAGE_HDR_SIZE, (uint8_t const*)pipe.bufs[slot], len);
+		if ( out_write(&out, pipe.bufs[slot], len) || (isLast && out_finish(&out)) ) errMsg = "Failed to write";
+		else {
+			nWritten += len;
+			if ( progress && progress(progressArg, nWritten, progressSize) ) { errno = ECANCELED; errMsg = "Abandoned"; }
+		}
+		pthread_mutex_lock(&pipe.lock);
+		if ( errMsg ) pipe.err = errno ? errno : EIO;
+		pipe.isFull[slot] = 0;
+		pthread_cond_broadcast(&pipe.cond);
+		pthread_mutex_unlock(&pipe.lock);
+		if ( errMsg ) break;
+		slot ^= 1;
+	}
+	pthread_join(reader, 0);
+	if ( !errMsg ) {
+		imgHdr.fileLen = compress ? out.baseOff + out.fileOff : IMAGE_HDR_SIZE + imageSize;
+		imgHdr.refChecksum = crc32_combine(dictCrc, imgHdr.components[IMAGE_COMPONENT_PAC].crc, pacLen);
+		imgHdr.hdrCrc = crcHeader(&imgHdr);
+		if ( pwrite(imgFd, &imgHdr, sizeof(imgHdr), 0) != sizeof(imgHdr) ) {
+			pipe.err = errno ? errno : EIO;
+			errMsg = "Failed to write the header of";
+		}
+	}
+	if ( errMsg ) printf("%s %s: %s\n", errMsg, imgName, strerror(pipe.err));
+	else result = 0;
+
+cleanupPipe:
+	pthread_mutex_destroy(&pipe.lock);
+	pthread_cond_destroy(&pipe.cond);
+	free(pipe.bufs[0]);
+	free(pipe.bufs[1]);
+	out_destroy(&out);
+	if ( close(imgFd) != 0 && !result ) {
+		printf("Failed to close %s: %s\n", imgName, strerror(errno));
+		result = 2;
+	}
+	if ( result ) unlink(imgName);
+cleanup:
+	if ( bwtFd != -1 ) close(bwtFd);
+	if ( saFd != -1 ) close(saFd);
+	if ( pacFd != -1 ) close(pacFd);
+	if ( pBns ) bns_destroy(pBns);
+	free(pStrings);
+	return result;
+}
+
+// checks the compressed container at off:  returns 1 if there is one, 0 if there isn't, and -1 if it's mangled
+static int probeCompressed( int fd, size_t off, size_t fileLen, size_t* pImageLen ) {
+	image_zheader_t hdr;
+	if ( fileLen < off + sizeof(hdr) || pread(fd, &hdr, sizeof(hdr), off) != sizeof(hdr) || hdr.magic != IMAGE_ZMAGIC )
+		return 0;
+	size_t containerLen = fileLen - off;
+	if ( hdr.version != IMAGE_ZVERSION || hdr.blockSize != IMAGE_ZBLOCK_SIZE ||
+			hdr.nBlocks != (hdr.imageSize + IMAGE_ZBLOCK_SIZE - 1) / IMAGE_ZBLOCK_SIZE ||
+			hdr.nBlocks >= (containerLen - sizeof(hdr)) / sizeof(uint64_t) )
+		return -1;
+	// the table must be in order, and must account for the whole rest of the file
+	size_t tableLen = (hdr.nBlocks + 1)*sizeof(uint64_t);
+	uint64_t* pTable = malloc(tableLen);
+	if ( !pTable ) return -1;
+	int result = 1;
+	if ( pread(fd, pTable, tableLen, off + sizeof(hdr)) != tableLen ) result = -1;
+	else {
+		uint64_t prevOff = sizeof(hdr) + tableLen;
+		uint64_t idx;
+		for ( idx = 0; idx <= hdr.nBlocks && result == 1; ++idx ) {
+			if ( pTable[idx] < prevOff ) result = -1;
+			prevOff = pTable[idx];
+		}
+		if ( prevOff != containerLen ) result = -1;
+	}
+	free(pTable);
+	if ( result == 1 ) *pImageLen = hdr.imageSize;
+	return result;
+}
+
+int image_probe( int fd, size_t fileLen, image_info_t* pInfo ) {
+	memset(pInfo, 0, sizeof(*pInfo));
+	image_header_t* pHdr = &pInfo->hdr;
+	if ( fileLen >= IMAGE_HDR_SIZE && pread(fd, pHdr, sizeof(*pHdr), 0) == sizeof(*pHdr) &&
+			pHdr->magic == IMAGE_MAGIC ) {
+		pInfo->hasHeader = 1;
+		// an image from another bwa might have differently laid-out structs in it
+		if ( pHdr->version != IMAGE_VERSION || pHdr->hdrCrc != crcHeader(pHdr) ||
+				pHdr->hdrLen != IMAGE_HDR_SIZE || pHdr->fileLen != fileLen ||
+				pHdr->nComponents != IMAGE_N_COMPONENTS ||
+				strncmp(pHdr->bwaCommit, BWA_COMMIT, sizeof(pHdr->bwaCommit)) )
+			return -1;
+		uint64_t off = 0;
+		int idx;
+		for ( idx = 0; idx < IMAGE_N_COMPONENTS; ++idx ) {
+			if ( pHdr->components[idx].off != off ) return -1;
+			off += pHdr->components[idx].len;
+		}
+		if ( off != pHdr->imageLen ) return -1;
+		pInfo->imageOff = pHdr->hdrLen;
+	}
+	pInfo->imageLen = fileLen - pInfo->imageOff;
+	pInfo->isCompressed = probeCompressed(fd, pInfo->imageOff, fileLen, &pInfo->imageLen);
+	if ( pInfo->isCompressed == -1 ) return -1;
+	if ( pInfo->hasHeader && (pInfo->isCompressed != pHdr->isCompressed || pInfo->imageLen != pHdr->imageLen) )
+		return -1;
+	return 0;
+}
+
+typedef struct {
+	int fd;
+	size_t imageOff;
+	char* dst;
+	size_t imageLen;
+	uint64_t const* pTable;
+	int nErrs;
+} image_inflate_t;
+
+static void inflateBlock( void* data, int i, int tid ) {
+	image_inflate_t* pInf = data;
+	size_t off = (size_t)i*IMAGE_ZBLOCK_SIZE;
+	uLongf len = pInf->imageLen - off < IMAGE_ZBLOCK_SIZE ? pInf->imageLen - off : IMAGE_ZBLOCK_SIZE;
+	size_t zlen = pInf->pTable[i+1] - pInf->pTable[i];
+	char* zbuf = malloc(zlen);
+	uLongf expectedLen = len;
+	if ( !zbuf || pread(pInf->fd, zbuf, zlen, pInf->imageOff + pInf->pTable[i]) != zlen ||
+			uncompress((Bytef*)pInf->dst + off, &len, (Bytef const*)zbuf, zlen) != Z_OK || len != expectedLen )
+		__sync_fetch_and_add(&pInf->nErrs, 1);
+	free(zbuf);
+}
+
+int image_decompress( int fd, size_t imageOff, char* dst, size_t imageLen ) {
+	image_zheader_t hdr;
+	if ( pread(fd, &hdr, sizeof(hdr), imageOff) != sizeof(hdr) || hdr.imageSize != imageLen ) return -1;
+	size_t tableLen = (hdr.nBlocks + 1)*sizeof(uint64_t);
+	uint64_t* pTable = malloc(tableLen);
+	if ( !pTable ) return -1;
+	image_inflate_t inf = { fd, imageOff, dst, imageLen, pTable, 0 };
+	if ( pread(fd, pTable, tableLen, imageOff + sizeof(hdr)) != tableLen ) inf.nErrs = 1;
+	else kt_for(nCPUs(), inflateBlock, &inf, hdr.nBlocks);
+	free(pTable);
+	return inf.nErrs ? -1 : 0;
+}
+
+// takes len bytes at *pOff, if there are that many left in the image
+static int layout_take( size_t* pOff, size_t imageLen, uint64_t len ) {
+	if ( len > imageLen - *pOff ) return -1;
+	*pOff += len;
+	return 0;
+}
+
+int image_checkLayout( uint8_t const* image, image_info_t const* pInfo ) {
+	size_t len = pInfo->imageLen;
+	size_t off = 0;
+	size_t ends[IMAGE_N_COMPONENTS];
+	bwt_t bwt;
+	if ( layout_take(&off, len, sizeof(bwt)) ) return -1;
+	memcpy(&bwt, image, sizeof(bwt));
+	if ( bwt.bwt_size > len/sizeof(uint32_t) || layout_take(&off, len, bwt.bwt_size*sizeof(uint32_t)) ) return -1;
+	ends[IMAGE_COMPONENT_BWT] = off;
+	if ( bwt.sa_intv <= 0 || bwt.n_sa != (bwt.seq_len + bwt.sa_intv) / bwt.sa_intv || bwt.primary > bwt.seq_len ||
+			bwt.n_sa > len/sizeof(bwtint_t) || layout_take(&off, len, bwt.n_sa*sizeof(bwtint_t)) )
+		return -1;
+	ends[IMAGE_COMPONENT_SA] = off;
+	bntseq_t bns;
+	if ( layout_take(&off, len, sizeof(bns)) ) return -1;
+	memcpy(&bns, image + off - sizeof(bns), sizeof(bns));
+	if ( bns.n_holes < 0 || bns.n_seqs < 0 || bns.l_pac < 0 || bwt.seq_len != 2*(bwtint_t)bns.l_pac ||
+			layout_take(&off, len, (uint64_t)bns.n_holes*sizeof(bntamb1_t)) )
+		return -1;
+	bntann1_t const* pAnns = (bntann1_t const*)(image + off);
+	if ( layout_take(&off, len, (uint64_t)bns.n_seqs*sizeof(bntann1_t)) ) return -1;
+	int idx;
+	for ( idx = 0; idx < bns.n_seqs; ++idx ) {
+		bntann1_t ann;
+		memcpy(&ann, pAnns + idx, sizeof(ann));
+		if ( ann.offset < 0 || ann.len < 0 || ann.offset + ann.len > bns.l_pac ) return -1;
+		int nStrings;
+		for ( nStrings = 0; nStrings < 2; ++nStrings ) { // the name and the anno
+			uint8_t const* pNull = memchr(image + off, 0, len - off);
+			if ( !pNull ) return -1;
+			off = pNull + 1 - image;
+		}
+	}
+	ends[IMAGE_COMPONENT_BNS] = off;
+	if ( len - off != bns.l_pac/4 + 1 ) return -1;
+	ends[IMAGE_COMPONENT_PAC] = len;
+	if ( pInfo->hasHeader ) {
+		for ( idx = 0; idx < IMAGE_N_COMPONENTS; ++idx ) {
+			image_component_t const* pComp = pInfo->hdr.components + idx;
+			if ( pComp->off + pComp->len != ends[idx] ) return -1;
+		}
+	}
+	return 0;
+}
+
+int image_verify( uint8_t const* image, image_info_t const* pInfo, bntseq_t const* pBns ) {
+	if ( !pInfo->hasHeader ) return 0;
+	image_header_t const* pHdr = &pInfo->hdr;
+	int idx;
+	for ( idx = 0; idx < IMAGE_N_COMPONENTS; ++idx ) {
+		image_component_t const* pComp = pHdr->components + idx;
+		if ( crcAppend(0, image + pComp->off, pComp->len) != pComp->crc ) return -1;
+	}
+	image_component_t const* pPac = pHdr->components + IMAGE_COMPONENT_PAC;
+	return crc32_combine(crcDict(pBns), pPac->crc, pPac->len) == pHdr->refChecksum ? 0 : -1;
+}
@@ -0,0 +1,85 @@
+/*
+ * image.h
+ */
+
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "bwa/bntseq.h"
+
+// An image file starts with a page holding this header, and the image proper (or its compressed container)
+// follows.  Images written before there was a header are still readable:  they're recognized by not starting
+// with the magic number, and get only the structural check.
+// The image is described as four components, which are contiguous, in this order:
+#define IMAGE_COMPONENT_BWT 0 // bwt_t and the BWT
+#define IMAGE_COMPONENT_SA 1  // the suffix array
+#define IMAGE_COMPONENT_BNS 2 // bntseq_t, ambs, anns, and the contigs' name and anno strings
+#define IMAGE_COMPONENT_PAC 3 // the packed reference
+#define IMAGE_N_COMPONENTS 4
+
+#define IMAGE_MAGIC 0x474d495f4157424aULL // "JBWA_IMG"
+#define IMAGE_VERSION 1
+#define IMAGE_HDR_SIZE 4096
+
+typedef struct {
+	uint64_t off; // within the image
+	uint64_t len;
+	uint32_t crc; // CRC32 of the component's bytes
+	uint32_t pad;
+} image_component_t;
+
+typedef struct {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t hdrLen;          // where the image starts in the file
+	char bwaCommit[48];       // the bwa that wrote the image (whose structs are in it)
+	uint64_t fileLen;         // to catch truncation
+	uint64_t imageLen;        // uncompressed
+	uint32_t isCompressed;
+	uint32_t nComponents;
+	image_component_t components[IMAGE_N_COMPONENTS];
+	uint32_t refChecksum;     // CRC32 of each contig's name (with its null) and 64-bit length, and then the pac
+	uint32_t hdrCrc;          // CRC32 of the header up to here
+} image_header_t;
+
+// what image_probe learns about an image file
+typedef struct {
+	size_t imageOff;          // where the image (or its compressed container) starts in the file
+	size_t imageLen;          // uncompressed
+	int isCompressed;
+	int hasHeader;            // 0 for an old image, without an integrity header
+	image_header_t hdr;
+} image_info_t;
+
+// called after each piece of the image is written:  return non-zero to abandon the write
+typedef int (*image_progress_fn)( void* arg, size_t nWritten, size_t imageSize );
+
+// writes the image (compressed, if compress is non-zero), and returns 0, or non-zero if it couldn't
+int image_write( char const* indexPrefix, char const* imgName, int compress, image_progress_fn progress,
+					void* progressArg );
+
+// Checks the header (if there is one) and the compressed container (if it's compressed) without reading the image
+// itself.  Compressed images are recognized by their magic number, so readers needn't be told which kind they have.
+// returns 0, or -1 if the image is truncated, mangled, or was written by some other bwa
+int image_probe( int fd, size_t fileLen, image_info_t* pInfo );
+
+// decompresses a compressed image into dst (which must have room for the whole image), in parallel
+// returns 0, or -1 if the image is unreadable
+int image_decompress( int fd, size_t imageOff, char* dst, size_t imageLen );
+
+// The cheap structural check:  walks the image just as bwa_mem2idx will, making sure that every component is the
+// size its header says and that they exactly fill the image (and agree with the integrity header, if there is
+// one), so that bwa_mem2idx won't run off the end of it.  It reads only the small structs and the contig names.
+// returns 0, or -1 if the image is malformed
+int image_checkLayout( uint8_t const* image, image_info_t const* pInfo );
+
+// The full check:  computes the CRC of each component (each in parallel pieces) and the reference checksum, and
+// compares them to the header.  The image must have passed image_checkLayout, and pBns must be the index's.
+// returns 0, or -1 if anything doesn't match (images without a header always pass)
+int image_verify( uint8_t const* image, image_info_t const* pInfo, bntseq_t const* pBns );
+
+#endif /* IMAGE_H_ */
@@ -2,6 +2,7 @@
  * jnibwa.c
  */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -9,12 +10,19 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/file.h>
 #include <time.h>
 #include <unistd.h>
 #include <zlib.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "jnibwa.h"
+#include "pool.h"
+#include "image.h"
+#include "stats.h"
+#include "cache.h"
+#include "columns.h"
 #include "bwa/kstring.h"
 #include "bwa/bntseq.h"
 #include "bwa/bwt.h"
@@ -23,6 +31,132 @@
 #include "bwa/rope.h"
 
 
+// The results for a batch are gathered into a single arena that's handed back to Java as is.
+// It starts with a table of per-read byte offsets (one int32_t per read), followed by an empty
+// result (a zero alignment count) that stands in for any read that never got formatted.
+// Each read's records are appended as soon as the read has been completely formatted, so the
+// records appear in the order in which the worker threads finished them, not in input order.
+// The arena can start out in a buffer supplied by the caller.  If the results outgrow it, they're moved to
+// native memory, and the caller can tell by checking whether the buffer it gets back is the one it supplied.
+// Workers reserve space for a read's results with an atomic add to len, and copy them in without waiting for
+// one another.  The lock is held shared while reserving and copying, and exclusively only to grow buf (which
+// may move it), so that's the only time a worker waits.
+typedef struct {
+	pthread_rwlock_t growLock;
+	char* buf;
+	size_t len; // bytes reserved so far, which may run past cap until someone grows buf
+	size_t cap;
+	int isCallers; // buf belongs to the caller:  don't realloc or free it
+	int isTooBig;  // the results ran past what the int32 offsets can address, so the batch fails
+} jnibwa_arena_t;
+
+// formats one of a read's records (which is the index in list of the one to format) into str
+typedef void (*jnibwa_fmt_fn)( mem_opt_t const* opt, bntseq_t const* bns, kstring_t* str, bseq1_t* s, int n,
+								mem_aln_t const* list, int which, mem_aln_t const* p, mem_aln_t const* m );
+
+// Per-call state.  bwa passes our mem_opt_t to the formatter, so the options come first, and the
+// formatter gets back to the rest of the context by casting the mem_opt_t pointer it's handed.
+// Everything about how a batch is formatted lives here, so batches in different output formats can run at the
+// same time on the same index.
+typedef struct {
+	mem_opt_t opt;
+	jnibwa_arena_t arena;
+	jnibwa_stats_t* pStats; // null unless we're collecting stats for the batch
+	jnibwa_fmt_fn fmt; // formats the records in the batch's output format
+	uint32_t* pResultLens; // where the formatter notes the size of each read's results, if they're to be cached
+} jnibwa_ctx_t;
+
+// Set in the flag of the options in a jnibwa_ctx_t (bwa has no flag this high), so that the formatter we install
+// in bwa can tell our calls from those of any other bwa user in the process.
+#define JNIBWA_F_CTX 0x40000000
+
+static void arena_init( jnibwa_arena_t* pArena, uint32_t nSeqs, char* callersBuf, size_t callersBufSize ) {
+	pthread_rwlock_init(&pArena->growLock, 0);
+	size_t hdrLen = (nSeqs + 1)*sizeof(int32_t);
+	if ( callersBuf && callersBufSize >= hdrLen ) {
+		pArena->cap = callersBufSize;
+		pArena->buf = callersBuf;
+		pArena->isCallers = 1;
+	} else {
+		pArena->cap = hdrLen + nSeqs*13*sizeof(int32_t); // a guess:  one mapped, unpaired alignment per read
+		pArena->buf = malloc(pArena->cap);
+		pArena->isCallers = 0;
+	}
+	pArena->len = hdrLen;
+	pArena->isTooBig = 0;
+	int32_t* pOffsets = (int32_t*)pArena->buf;
+	int32_t emptyOffset = nSeqs*sizeof(int32_t);
+	while ( nSeqs-- ) *pOffsets++ = emptyOffset;
+	*pOffsets = 0;
+}
+
+// makes buf big enough for everything that's been reserved
+static void arena_grow( jnibwa_arena_t* pArena ) {
+	pthread_rwlock_wrlock(&pArena->growLock);
+	if ( pArena->len > pArena->cap ) { // unless someone else got here first
+		size_t newCap = 2*pArena->cap;
+		if ( newCap < pArena->len ) newCap = pArena->len;
+		if ( newCap > INT32_MAX ) newCap = INT32_MAX; // anyone reserving past that gives up rather than growing
+		if ( pArena->isCallers ) {
+			char* newBuf = malloc(newCap);
+			memcpy(newBuf, pArena->buf, pArena->cap);
+			pArena->buf = newBuf;
+			pArena->isCallers = 0;
+		}
+		else pArena->buf = realloc(pArena->buf, newCap);
+		pArena->cap = newCap;
+	}
+	pthread_rwlock_unlock(&pArena->growLock);
+}
+
+// appends one read's results to the arena
+static void arena_putBytes( jnibwa_arena_t* pArena, int id, char const* pBytes, size_t len ) {
+	pthread_rwlock_rdlock(&pArena->growLock);
+	size_t off = __sync_fetch_and_add(&pArena->len, len);
+	if ( off + len > INT32_MAX ) {
+		__sync_fetch_and_or(&pArena->isTooBig, 1);
+		pthread_rwlock_unlock(&pArena->growLock);
+		return;
+	}
+	if ( off + len > pArena->cap ) {
+		// our space is reserved, but it's past the end of buf:  let go so that buf can be grown, and come back
+		pthread_rwlock_unlock(&pArena->growLock);
+		arena_grow(pArena);
+		pthread_rwlock_rdlock(&pArena->growLock);
+	}
+	((int32_t*)pArena->buf)[id] = off;
+	memcpy(pArena->buf + off, pBytes, len);
+	pthread_rwlock_unlock(&pArena->growLock);
+}
+
+// Appends one read's results to the arena.  The kstring is still bwa's:  it may format the mate's records into
+// it next, strdup it, or hand it to the read as its sam (which job_run frees), so it's left a valid, empty string
+// rather than freed.  It's shrunk, though, so that it doesn't hold on to a second copy of the results.
+#define ARENA_KSTRING_KEEP 64
+static void arena_put( jnibwa_arena_t* pArena, int id, kstring_t* str ) {
+	arena_putBytes(pArena, id, str->s, str->l);
+	str->l = 0;
+	if ( !str->s ) return;
+	if ( str->m > ARENA_KSTRING_KEEP ) {
+		str->m = ARENA_KSTRING_KEEP;
+		str->s = realloc(str->s, str->m);
+	}
+	str->s[0] = 0;
+}
+
+// returns null if the results were too big
+static void* arena_release( jnibwa_arena_t* pArena, size_t* pBufSize ) {
+	pthread_rwlock_destroy(&pArena->growLock);
+	if ( pArena->isTooBig ) {
+		if ( !pArena->isCallers ) free(pArena->buf);
+		*pBufSize = 0;
+		return 0;
+	}
+	*pBufSize = pArena->len;
+	if ( pArena->isCallers ) return pArena->buf;
+	return realloc(pArena->buf, pArena->len);
+}
+
 static inline void kput32( int32_t val, kstring_t* str ) {
 	kputsn((char*)&val, sizeof(int32_t), str);
 }
@@ -96,140 +230,1055 @@ static void fmt_BAMish(mem_opt_t const* opt, bntseq_t const* bns, kstring_t *str
 	}
 }
 
-static size_t bufLen( int32_t* pBuf ) {
-	size_t totLen = 1;
-	size_t nAligns = *pBuf++;
-	while ( nAligns-- ) {
-		int32_t flag = *pBuf++ >> 16;
-		totLen += 1; // for flags
-		if ( !(flag & 0x4) ) {
-			totLen += 8; // refId, pos, NM, AS, XS, nCigOps, nMDchars, nXAchars
-			pBuf += 5;
-			int32_t nCig = *pBuf++;
-			totLen += nCig;
-			pBuf += nCig;
-			int32_t nMD = (*pBuf++ + 3) >> 2;
-			totLen += nMD;
-			pBuf += nMD;
-			int32_t nXA = (*pBuf++ + 3) >> 2;
-			totLen += nXA;
-			pBuf += nXA;
-		}
-		if ( (flag & 0x9) == 1 ) {
-			totLen += 3; // mate rid, mate pos, tlen
-			pBuf += 3;
-		}
-	}
-	return totLen;
-}
-
-int jnibwa_createIndexFile( char const* refName, char const* imgName ) {
-  	bwaidx_t* pIdx = bwa_idx_load(refName, BWA_IDX_ALL);
-  	bwa_idx2mem(pIdx);
-  	int fd = open(imgName, O_WRONLY|O_CREAT|O_TRUNC, 0644);
-  	if ( fd == -1 ) {
-  		printf("Failed to open %s for writing: %s\n", imgName, strerror(errno));
-  		return 2;
-  	}
-  	size_t len = pIdx->l_mem;
-  	uint8_t* buf = pIdx->mem;
-  	while ( len ) {
-  		size_t toWrite = len;
-  		if ( toWrite > (1L<<30) ) toWrite = 1L<<30;
-  		if ( write(fd,buf,toWrite) != toWrite ) {
-  	  		printf("Failed to write %s: %s\n", imgName, strerror(errno));
-  	  		return 2;
-  		}
-  		buf += toWrite;
-  		len -= toWrite;
-  	}
-  	if ( close(fd) != 0 ) {
-  		printf("Failed to close %s: %s\n", imgName, strerror(errno));
-  		return 2;
-  	}
-	bwa_idx_destroy(pIdx);
+// In the JNIBWA_OUTPUT_BAM format, each read's result is a 32-bit byte count followed by that many bytes of
+// BAM alignment records (block_size first, exactly as they'd appear in an uncompressed BAM file), so the
+// caller can write them to a BGZF stream as is.  The records are made just as bwa's mem_aln2sam would make
+// SAM text:  supplementary alignments are hard-clipped (unless MEM_F_SOFTCLIP), secondary alignments have no
+// SEQ or QUAL, and the tags are NM, MD, MC, AS, XS, and XA.  (bwa's SA tag is left to the caller.)
+// BAM is little-endian, as is every platform we build for, so the integers are written in native order.
+
+// the BAM bin for a (0-based, half-open) reference interval, from the SAM spec
+static inline int reg2bin( int64_t beg, int64_t end ) {
+	--end;
+	if ( beg>>14 == end>>14 ) return ((1<<15)-1)/7 + (beg>>14);
+	if ( beg>>17 == end>>17 ) return ((1<<12)-1)/7 + (beg>>17);
+	if ( beg>>20 == end>>20 ) return ((1<<9)-1)/7 + (beg>>20);
+	if ( beg>>23 == end>>23 ) return ((1<<6)-1)/7 + (beg>>23);
+	if ( beg>>26 == end>>26 ) return ((1<<3)-1)/7 + (beg>>26);
+	return 0;
+}
+
+// a mem_aln_t cigar op (MIDSH) as a BAM cigar op (MIDNSH), with clipping chosen as in mem_aln2sam
+static inline uint32_t bamCigarOp( mem_opt_t const* opt, mem_aln_t const* p, int which, uint32_t lenOp ) {
+	static uint32_t const BAM_OPS[] = { 0, 1, 2, 4, 5 };
+	uint32_t op = lenOp & 0xf;
+	if ( !(opt->flag & MEM_F_SOFTCLIP) && !p->is_alt && (op == 3 || op == 4) ) op = which ? 4 : 3;
+	return (lenOp & ~0xfU) | BAM_OPS[op];
+}
+
+static inline void kputAux( char const* tag, char type, kstring_t* str ) {
+	kputsn(tag, 2, str);
+	kputc(type, str);
+}
+
+static void fmt_BAM(mem_opt_t const* opt, bntseq_t const* bns, kstring_t *str, bseq1_t *s, int n, mem_aln_t const* list, int which, mem_aln_t const* p, mem_aln_t const* m) {
+	static uint8_t const NT16[] = { 1, 2, 4, 8, 15 };    // ACGTN
+	static uint8_t const NT16_RC[] = { 8, 4, 2, 1, 15 }; // TGCAN
+	if ( !which ) kput32(0, str); // byte count for all the read's records, filled in below
+
+	int hasCoord = p->rid >= 0; // an unmapped read with a mapped mate is given its mate's position
+	int nCigar = hasCoord ? p->n_cigar : 0;
+	int flag = (p->flag & 0xffff) | (p->flag & 0x10000 ? 0x100 : 0);
+	char const* name = s->name && *s->name ? s->name : "*";
+	int lName = strlen(name);
+	if ( lName > 254 ) lName = 254;
+
+	// the part of the read that's shown:  none of it for secondary alignments, and less if it's hard-clipped
+	int qb = 0, qe = s->l_seq;
+	if ( p->flag & 0x100 ) qe = 0;
+	else if ( nCigar && which && !(opt->flag & MEM_F_SOFTCLIP) && !p->is_alt ) {
+		int firstOp = p->cigar[0] & 0xf, lastOp = p->cigar[nCigar-1] & 0xf;
+		int firstLen = firstOp == 3 || firstOp == 4 ? p->cigar[0] >> 4 : 0;
+		int lastLen = lastOp == 3 || lastOp == 4 ? p->cigar[nCigar-1] >> 4 : 0;
+		if ( p->is_rev ) qb += lastLen, qe -= firstLen;
+		else qb += firstLen, qe -= lastLen;
+	}
+	int lSeq = qe - qb;
+
+	int64_t pos = hasCoord ? p->pos : -1;
+	int refLen = cigarRefLen(nCigar, p->cigar);
+	int isMateMapped = m && m->rid >= 0;
+	int32_t tlen = 0;
+	if ( isMateMapped && p->rid == m->rid && m->n_cigar && nCigar ) {
+		int64_t p0 = p->pos + (p->is_rev ? refLen - 1 : 0);
+		int64_t p1 = m->pos + (m->is_rev ? cigarRefLen(m->n_cigar, m->cigar) - 1 : 0);
+		tlen = -(p0 - p1 + (p0 > p1 ? 1 : p0 < p1 ? -1 : 0));
+	}
+
+	size_t recBeg = str->l;
+	ks_resize(str, str->l + 36 + lName + 1 + 4*nCigar + (lSeq+1)/2 + lSeq + 64);
+	kput32(0, str); // block_size, filled in below
+	kput32(hasCoord ? p->rid : -1, str);
+	kput32(pos, str);
+	kput32(reg2bin(pos, pos + (refLen ? refLen : 1)) << 16 | (p->mapq & 0xff) << 8 | (lName + 1), str);
+	kput32(flag << 16 | nCigar, str);
+	kput32(lSeq, str);
+	kput32(isMateMapped ? m->rid : -1, str);
+	kput32(isMateMapped ? m->pos : -1, str);
+	kput32(tlen, str);
+	kputsn(name, lName, str);
+	kputc(0, str);
+	int idx;
+	for ( idx = 0; idx < nCigar; ++idx ) kput32(bamCigarOp(opt, p, which, p->cigar[idx]), str);
+
+	uint8_t* pSeq = (uint8_t*)str->s + str->l;
+	memset(pSeq, 0, (lSeq+1)/2);
+	for ( idx = 0; idx < lSeq; ++idx ) {
+		int base = p->is_rev ? NT16_RC[(int)s->seq[qe-1-idx]] : NT16[(int)s->seq[qb+idx]];
+		pSeq[idx>>1] |= (idx & 1) ? base : base << 4;
+	}
+	str->l += (lSeq+1)/2;
+	uint8_t* pQual = (uint8_t*)str->s + str->l;
+	if ( !s->qual ) memset(pQual, 0xff, lSeq);
+	else for ( idx = 0; idx < lSeq; ++idx )
+		pQual[idx] = (p->is_rev ? s->qual[qe-1-idx] : s->qual[qb+idx]) - 33;
+	str->l += lSeq;
+
+	if ( nCigar ) {
+		kputAux("NM", 'i', str); kput32(p->NM, str);
+		kputAux("MD", 'Z', str); kputs((char*)(p->cigar + nCigar), str); kputc(0, str);
+	}
+	if ( m && m->n_cigar ) {
+		kputAux("MC", 'Z', str);
+		for ( idx = 0; idx < m->n_cigar; ++idx ) {
+			uint32_t lenOp = bamCigarOp(opt, m, which, m->cigar[idx]);
+			kputw(lenOp >> 4, str);
+			kputc("MIDNSHP=X"[lenOp & 0xf], str);
+		}
+		kputc(0, str);
+	}
+	if ( p->score >= 0 ) { kputAux("AS", 'i', str); kput32(p->score, str); }
+	if ( p->sub >= 0 ) { kputAux("XS", 'i', str); kput32(p->sub, str); }
+	if ( p->XA ) { kputAux("XA", 'Z', str); kputs(p->XA, str); kputc(0, str); }
+	*(int32_t*)(str->s + recBeg) = str->l - recBeg - sizeof(int32_t);
+
+	if ( which == n-1 ) *(int32_t*)str->s = str->l - sizeof(int32_t);
+}
+
+// In the JNIBWA_OUTPUT_PRIMARY format, each read's result is a single fixed-size record for its primary
+// alignment, followed by its cigar ops (as in fmt_BAMish):  no count, no secondary or supplementary records, and
+// no MD or XA.  The job turns off bwa's XA hits and secondary alignments, so bwa needn't make them, either.
+static void fmt_primary(mem_opt_t const* opt, bntseq_t const* bns, kstring_t *str, bseq1_t *s, int n, mem_aln_t const* list, int which, mem_aln_t const* p, mem_aln_t const* m) {
+	if ( which ) return; // bwa always formats the primary alignment first
+	int isMapped = !(p->flag & 0x4);
+	int32_t nCig = isMapped ? p->n_cigar : 0;
+	ks_resize(str, (10 + nCig)*sizeof(int32_t));
+	int32_t flag_mapQ = p->flag;
+	if ( p->flag & 0x10000 ) flag_mapQ |= 0x100;
+	kput32((flag_mapQ << 16) | (p->mapq & 0xff), str);
+	kput32(isMapped ? p->rid : -1, str);
+	kput32(isMapped ? p->pos : -1, str);
+	kput32(isMapped ? p->NM : 0, str);
+	kput32(isMapped ? p->score : 0, str);
+	kput32(isMapped ? p->sub : 0, str);
+	if ( (p->flag & 0x9) == 1 ) {
+		kput32(m->rid, str);
+		kput32(m->pos, str);
+		if ( !isMapped || p->rid != m->rid ) kput32(0, str);
+		else { // just as fmt_BAMish does it
+			long p0 = p->pos;
+			if ( p->is_rev ) p0 += cigarRefLen(p->n_cigar, p->cigar) - 1;
+			long m0 = m->pos;
+			if ( m->is_rev ) m0 += cigarRefLen(m->n_cigar, m->cigar) - 1;
+			kput32(m0 - p0 + (p0 > m0 ? -1 : p0 < m0 ? 1 : 0), str);
+		}
+	} else {
+		kput32(-1, str);
+		kput32(-1, str);
+		kput32(0, str);
+	}
+	kput32(nCig, str);
+	uint32_t const* pCig = p->cigar;
+	while ( nCig-- ) {
+		uint32_t lenOp = *pCig++;
+		if ( (lenOp & 0xf) > 2 ) ++lenOp; // MIDSH to MIDNSH
+		kput32(lenOp, str);
+	}
+}
+
+// indexed by JNIBWA_OUTPUT_*
+// the columnar format is made from BAMish records once the batch is done (see columns.h)
+static jnibwa_fmt_fn const gFormatters[] = { fmt_BAMish, fmt_BAM, fmt_primary, fmt_BAMish };
+
+// whatever formatter bwa had before we installed ours (bwa's own SAM formatter, unless someone else got there first)
+static jnibwa_fmt_fn gPrevFmt;
+
+// the formatter we install in bwa:  it formats each record with the batch's formatter, and moves each read's
+// results into the arena once they're all formatted
+static void fmt_record(mem_opt_t const* opt, bntseq_t const* bns, kstring_t *str, bseq1_t *s, int n, mem_aln_t const* list, int which, mem_aln_t const* p, mem_aln_t const* m) {
+	if ( !(opt->flag & JNIBWA_F_CTX) ) {
+		gPrevFmt(opt, bns, str, s, n, list, which, p, m);
+		return;
+	}
+	jnibwa_ctx_t* pCtx = (jnibwa_ctx_t*)opt;
+	int64_t begNs = pCtx->pStats ? stats_nowNs() : 0;
+	pCtx->fmt(opt, bns, str, s, n, list, which, p, m);
+	if ( which == n-1 && pCtx->pResultLens ) pCtx->pResultLens[s->id] = str->l;
+	if ( !pCtx->pStats ) {
+		if ( which == n-1 ) arena_put(&pCtx->arena, s->id, str);
+		return;
+	}
+	int64_t endNs = stats_nowNs();
+	stats_add(pCtx->pStats, JNIBWA_STATS_FORMAT_WALL, endNs - begNs);
+	stats_add(pCtx->pStats, JNIBWA_STATS_RECORDS, 1);
+	if ( which == n-1 ) {
+		arena_put(&pCtx->arena, s->id, str);
+		stats_add(pCtx->pStats, JNIBWA_STATS_COPY_WALL, stats_nowNs() - endNs);
+	}
+}
+
+int jnibwa_createIndexFile( char const* refName, char const* imgName, int compress, image_progress_fn progress,
+							void* progressArg ) {
+	char* prefix = bwa_idx_infer_prefix(refName);
+	if ( !prefix ) {
+		printf("Failed to locate the index files for %s\n", refName);
+		return 2;
+	}
+	int result = image_write(prefix, imgName, compress, progress, progressArg);
+	free(prefix);
+	return result;
+}
+
+// The index, along with what we need to know to unmap it.
+// bwa_idx_destroy frees the bwaidx_t, so it must come first.
+typedef struct {
+	bwaidx_t idx;
+	void* pMap;
+	size_t mapLen;
+	int shmFd; // -1 unless the image is in a shared memory segment
+	char shmName[64];
+	jnibwa_cache_t* pCache; // results for unpaired reads, or null if no one has asked for a cache
+} jnibwa_idx_t;
+
+// The image is read or touched in pieces of this size by the thread pool.
+#define IMAGE_PIECE_SIZE (64L<<20)
+
+typedef struct {
+	int fd;
+	off_t fileOff; // where mem's contents start in the file
+	uint8_t* mem;
+	size_t len;
+	long pageSize;
+	int nErrs;
+} image_pieces_t;
+
+static int image_nPieces( image_pieces_t* pPieces ) {
+	return (pPieces->len + IMAGE_PIECE_SIZE - 1) / IMAGE_PIECE_SIZE;
+}
+
+static void image_touchPiece( void* data, int i, int tid ) {
+	image_pieces_t* pPieces = data;
+	size_t beg = i*IMAGE_PIECE_SIZE;
+	size_t end = beg + IMAGE_PIECE_SIZE;
+	if ( end > pPieces->len ) end = pPieces->len;
+	volatile uint8_t sum = 0;
+	size_t off;
+	for ( off = beg; off < end; off += pPieces->pageSize ) sum += pPieces->mem[off];
+}
+
+static void image_readPiece( void* data, int i, int tid ) {
+	image_pieces_t* pPieces = data;
+	size_t off = i*IMAGE_PIECE_SIZE;
+	size_t len = IMAGE_PIECE_SIZE;
+	if ( off + len > pPieces->len ) len = pPieces->len - off;
+	while ( len ) {
+		ssize_t nRead = pread(pPieces->fd, pPieces->mem + off, len, pPieces->fileOff + off);
+		if ( nRead <= 0 ) {
+			__sync_fetch_and_add(&pPieces->nErrs, 1);
+			return;
+		}
+		off += nRead;
+		len -= nRead;
+	}
+}
+
+static void image_forPieces( image_pieces_t* pPieces, void (*func)(void*,int,int) ) {
+	int nPieces = image_nPieces(pPieces);
+	long nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( nThreads < 1 ) nThreads = 1;
+	if ( nThreads > nPieces ) nThreads = nPieces;
+	kt_for(nThreads, func, pPieces, nPieces);
+}
+
+static size_t hugetlbPageSize( void ) {
+	size_t pageSize = 2L<<20;
+	FILE* fp = fopen("/proc/meminfo", "r");
+	if ( fp ) {
+		char line[256];
+		long kB;
+		while ( fgets(line, sizeof(line), fp) )
+			if ( sscanf(line, "Hugepagesize: %ld kB", &kB) == 1 ) { pageSize = kB*1024; break; }
+		fclose(fp);
+	}
+	return pageSize;
+}
+
+// reads the image (or inflates it, if it's compressed) into mem, and returns non-zero if it couldn't
+static int loadImage( int fd, uint8_t* mem, image_info_t const* pInfo ) {
+	if ( pInfo->isCompressed ) return image_decompress(fd, pInfo->imageOff, (char*)mem, pInfo->imageLen);
+	image_pieces_t pieces = { fd, pInfo->imageOff, mem, pInfo->imageLen, 0, 0 };
+	image_forPieces(&pieces, image_readPiece);
+	return pieces.nErrs;
+}
+
+// copy the image into anonymous memory, preferably backed by huge pages
+static uint8_t* mapImageCopy( int fd, image_info_t const* pInfo, int options, size_t* pMapLen ) {
+	size_t len = pInfo->imageLen;
+	uint8_t* mem = MAP_FAILED;
+	size_t mapLen = len;
+#if defined(MAP_HUGETLB)
+	if ( options & JNIBWA_OPEN_HUGETLB ) {
+		size_t hugePageSize = hugetlbPageSize();
+		mapLen = (len + hugePageSize - 1) / hugePageSize * hugePageSize;
+		mem = mmap(0, mapLen, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+	}
+#endif
+	if ( mem == MAP_FAILED ) {
+		mapLen = len;
+		mem = mmap(0, mapLen, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if ( mem == MAP_FAILED ) return 0;
+#if defined(MADV_HUGEPAGE)
+		madvise(mem, mapLen, MADV_HUGEPAGE);
+#endif
+	}
+	if ( loadImage(fd, mem, pInfo) ) {
+		munmap(mem, mapLen);
+		return 0;
+	}
+	*pMapLen = mapLen;
+	return mem;
+}
+
+// Shared images:  with JNIBWA_OPEN_SHM, the image is loaded once into a named POSIX shared memory segment, and
+// every process on the host that opens the same image file maps the same physical pages, so the image can't be
+// evicted from the page cache while anyone is using it, and later processes start without reading anything.
+// The segment is named for the image file's device, inode, size, and modification time, so a rebuilt image gets
+// a segment of its own.  It starts with a page that holds the header, and the image follows.
+// Attachment is tracked with flock, which the kernel drops when a process dies, so a killed process can't leave
+// the segment behind.  The process that creates the segment holds an exclusive lock while it loads the image,
+// and everyone else waits for a shared lock, so they find it ready.  Each attached process holds a shared lock
+// for as long as it's attached.  A detaching process asks for an exclusive lock without waiting, and if it gets
+// it, there's no one else attached, so it removes the segment.  (If the last process attached is killed, the
+// segment stays until the next process to attach detaches.)
+#define SHM_MAGIC 0x4d48535f4157424aULL // "JBWA_SHM"
+#define SHM_LOADING 0
+#define SHM_READY 1
+#define SHM_DEAD 2 // removed by its last user:  anyone who opened it just before then must make a new one
+#define SHM_WAIT_TRIES 100 // for a segment's creator to take the lock, at 10ms apiece
+
+typedef struct {
+	uint64_t magic;
+	uint64_t imageLen;
+	int32_t state;
+} shm_header_t;
+
+static void shmName( struct stat const* pStat, char* name, size_t nameLen ) {
+	snprintf(name, nameLen, "/jnibwa-%llx-%llx-%llx-%llx", (unsigned long long)pStat->st_dev,
+				(unsigned long long)pStat->st_ino, (unsigned long long)pStat->st_size,
+				(unsigned long long)pStat->st_mtime);
+}
+
+// gives the segment its full size, with memory behind it, so that a /dev/shm too small for the image fails here,
+// rather than with a SIGBUS when a page can't be had
+static int shmAllocate( int shmFd, size_t len ) {
+#if defined(__linux__)
+	return posix_fallocate(shmFd, 0, len);
+#else
+	return ftruncate(shmFd, len);
+#endif
+}
+
+// returns the mapping of the whole segment (the image is at *ppImage), or null if we can't share the image
+static uint8_t* mapImageShared( int fd, image_info_t const* pInfo, char const* name, int* pShmFd, size_t* pMapLen,
+								uint8_t** ppImage ) {
+	size_t len = pInfo->imageLen;
+	size_t hdrLen = sysconf(_SC_PAGESIZE);
+	size_t mapLen = hdrLen + len;
+	int nTries = 0;
+	while ( nTries++ < SHM_WAIT_TRIES ) {
+		int isCreator = 1;
+		int shmFd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0644);
+		if ( shmFd == -1 && errno == EEXIST ) {
+			isCreator = 0;
+			shmFd = shm_open(name, O_RDWR, 0);
+		}
+		if ( shmFd == -1 ) return 0;
+		flock(shmFd, isCreator ? LOCK_EX : LOCK_SH);
+		struct stat shmStat;
+		int sizeOK = isCreator ? shmAllocate(shmFd, mapLen) == 0 :
+									fstat(shmFd, &shmStat) == 0 && shmStat.st_size == mapLen;
+		uint8_t* mem = sizeOK ? mmap(0, mapLen, PROT_READ|PROT_WRITE, MAP_SHARED, shmFd, 0) : MAP_FAILED;
+		shm_header_t* pHdr = mem == MAP_FAILED ? 0 : (shm_header_t*)mem;
+		if ( isCreator && pHdr && !loadImage(fd, mem + hdrLen, pInfo) ) {
+			pHdr->magic = SHM_MAGIC;
+			pHdr->imageLen = len;
+			pHdr->state = SHM_READY;
+			// no one else can have attached yet, so it doesn't matter that the switch isn't atomic
+			flock(shmFd, LOCK_SH);
+		}
+		if ( pHdr && pHdr->magic == SHM_MAGIC && pHdr->state == SHM_READY && pHdr->imageLen == len ) {
+			mprotect(mem + hdrLen, len, PROT_READ);
+			*pShmFd = shmFd; // which keeps our shared lock until we detach
+			*pMapLen = mapLen;
+			*ppImage = mem + hdrLen;
+			return mem;
+		}
+		// We couldn't load it, or someone else's segment isn't usable.  If it's the full size, but not ready, its
+		// creator died while loading it (or it's some stranger's), and if we're the only one there, we get rid of
+		// it.  If it's short, its creator hasn't gotten the lock yet.  If it's dead, its name is already gone, and
+		// we can try again right away.
+		int isDead = pHdr && pHdr->state == SHM_DEAD;
+		if ( isCreator ) {
+			if ( pHdr ) pHdr->state = SHM_DEAD; // so that those waiting for us don't remove our successor
+			shm_unlink(name);
+		} else if ( pHdr && !isDead && flock(shmFd, LOCK_EX|LOCK_NB) == 0 ) {
+			pHdr->state = SHM_DEAD;
+			shm_unlink(name);
+			isDead = 1;
+		}
+		if ( pHdr ) munmap(mem, mapLen);
+		close(shmFd);
+		if ( isCreator ) return 0;
+		if ( !isDead ) {
+			if ( nTries < SHM_WAIT_TRIES ) usleep(10000);
+			else shm_unlink(name); // give up on it, so that the next process to open the image makes a new one
+		}
+	}
 	return 0;
 }
 
-bwaidx_t* jnibwa_openIndex( int fd ) {
+// if no one else holds a shared lock, we're the last one out
+static void unmapImageShared( jnibwa_idx_t* pJIdx ) {
+	shm_header_t* pHdr = pJIdx->pMap;
+	if ( flock(pJIdx->shmFd, LOCK_EX|LOCK_NB) == 0 ) {
+		pHdr->state = SHM_DEAD;
+		shm_unlink(pJIdx->shmName);
+	}
+	close(pJIdx->shmFd);
+}
+
+char const* jnibwa_getSharedMemoryName( bwaidx_t* pIdx ) {
+	jnibwa_idx_t* pJIdx = (jnibwa_idx_t*)pIdx;
+	return pJIdx->shmFd == -1 ? 0 : pJIdx->shmName;
+}
+
+// madvise wants a page-aligned address, so we widen the region to page boundaries
+static void adviseRegion( void* addr, size_t len, int advice ) {
+	if ( !len ) return;
+	uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+	uintptr_t beg = (uintptr_t)addr & ~(pageSize - 1);
+	uintptr_t end = ((uintptr_t)addr + len + pageSize - 1) & ~(pageSize - 1);
+	madvise((void*)beg, end - beg, advice);
+}
+
+// bwa has just the one formatter hook for the whole process, so we install ours once, and it hands anyone else's
+// calls on to the formatter it replaced.  bwa_verbose is a plain global that bwa's workers read, so it can't be
+// set per call:  we quiet bwa once, here.
+static pthread_once_t gHooksOnce = PTHREAD_ONCE_INIT;
+
+static void installHooks( void ) {
+	gPrevFmt = mem_fmt_fnc;
+	mem_fmt_fnc = &fmt_record;
+	bwa_verbose = 0;
+}
+
+bwaidx_t* jnibwa_openIndex( int fd, int options ) {
 	struct stat statBuf;
-	if ( fstat(fd, &statBuf) == -1 ) return 0;
-	uint8_t* mem = mmap(0, statBuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if ( fstat(fd, &statBuf) == -1 ) { close(fd); return 0; }
+	image_info_t info;
+	if ( image_probe(fd, statBuf.st_size, &info) ) { close(fd); return 0; }
+	size_t len = info.imageLen;
+	size_t mapLen = len;
+	uint8_t* mem = 0;
+	uint8_t* image = 0;
+	int shmFd = -1;
+	char name[64];
+	if ( options & JNIBWA_OPEN_SHM ) {
+		shmName(&statBuf, name, sizeof(name));
+		mem = mapImageShared(fd, &info, name, &shmFd, &mapLen, &image);
+	}
+	// a compressed image can't be mapped as is, so it's always inflated into a copy
+	if ( !mem && (info.isCompressed || (options & (JNIBWA_OPEN_THP|JNIBWA_OPEN_HUGETLB))) )
+		mem = mapImageCopy(fd, &info, options, &mapLen);
+	if ( !mem && info.isCompressed ) { close(fd); return 0; }
+	if ( !mem ) {
+		int flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+		if ( options & JNIBWA_OPEN_POPULATE ) flags |= MAP_POPULATE;
+#endif
+		// the whole file, header and all
+		mapLen = statBuf.st_size;
+		mem = mmap(0, mapLen, PROT_READ, flags, fd, 0);
+		if ( mem == MAP_FAILED ) { close(fd); return 0; }
+		image = mem + info.imageOff;
+		if ( options & JNIBWA_OPEN_TOUCH ) {
+			image_pieces_t pieces = { fd, 0, mem, mapLen, sysconf(_SC_PAGESIZE), 0 };
+			image_forPieces(&pieces, image_touchPiece);
+		}
+	}
 	close(fd);
-	bwaidx_t* pIdx = calloc(1, sizeof(bwaidx_t));
-	bwa_mem2idx(statBuf.st_size, mem, pIdx);
+	if ( !image ) image = mem;
+	jnibwa_idx_t* pJIdx = calloc(1, sizeof(jnibwa_idx_t));
+	pJIdx->pMap = mem;
+	pJIdx->mapLen = mapLen;
+	pJIdx->shmFd = shmFd;
+	if ( shmFd != -1 ) strcpy(pJIdx->shmName, name);
+	bwaidx_t* pIdx = &pJIdx->idx;
+	// make sure bwa_mem2idx won't wander off the end of a truncated or mangled image
+	if ( image_checkLayout(image, &info) ) {
+		if ( shmFd != -1 ) unmapImageShared(pJIdx);
+		munmap(mem, mapLen);
+		free(pJIdx);
+		return 0;
+	}
+	bwa_mem2idx(len, image, pIdx);
 	pIdx->is_shm = 1;
-	mem_fmt_fnc = &fmt_BAMish;
-	bwa_verbose = 0;
+	if ( (options & JNIBWA_OPEN_VERIFY) && image_verify(image, &info, pIdx->bns) ) {
+		jnibwa_destroyIndex(pIdx);
+		return 0;
+	}
+	if ( options & JNIBWA_OPEN_MLOCK ) mlock(mem, mapLen); // may well exceed RLIMIT_MEMLOCK, and that's all right
+
+	bwt_t* pBWT = pIdx->bwt;
+	if ( options & JNIBWA_OPEN_BWT_RANDOM ) adviseRegion(pBWT->bwt, pBWT->bwt_size*sizeof(uint32_t), MADV_RANDOM);
+	if ( options & JNIBWA_OPEN_BWT_WILLNEED ) adviseRegion(pBWT->bwt, pBWT->bwt_size*sizeof(uint32_t), MADV_WILLNEED);
+	if ( options & JNIBWA_OPEN_SA_RANDOM ) adviseRegion(pBWT->sa, pBWT->n_sa*sizeof(bwtint_t), MADV_RANDOM);
+	if ( options & JNIBWA_OPEN_SA_WILLNEED ) adviseRegion(pBWT->sa, pBWT->n_sa*sizeof(bwtint_t), MADV_WILLNEED);
+
+	pthread_once(&gHooksOnce, installHooks);
 	return pIdx;
 }
 
 int jnibwa_destroyIndex( bwaidx_t* pIdx ) {
-	void* pMem = pIdx->mem;
-	size_t memLen = pIdx->l_mem;
+	jnibwa_idx_t* pJIdx = (jnibwa_idx_t*)pIdx;
+	void* pMap = pJIdx->pMap;
+	size_t mapLen = pJIdx->mapLen;
+	if ( pJIdx->pCache ) cache_destroy(pJIdx->pCache);
+	if ( pJIdx->shmFd != -1 ) unmapImageShared(pJIdx);
 	bwa_idx_destroy(pIdx);
-	return munmap(pMem, memLen);
+	return munmap(pMap, mapLen);
+}
+
+// the cache is made the first time someone gives it some room, and lasts as long as the index
+void jnibwa_setResultCacheCapacity( bwaidx_t* pIdx, size_t capBytes ) {
+	jnibwa_idx_t* pJIdx = (jnibwa_idx_t*)pIdx;
+	if ( !pJIdx->pCache ) {
+		if ( !capBytes ) return;
+		jnibwa_cache_t* pCache = cache_create(capBytes);
+		if ( __sync_bool_compare_and_swap(&pJIdx->pCache, 0, pCache) ) return;
+		cache_destroy(pCache); // someone else beat us to it
+	}
+	cache_setCapacity(pJIdx->pCache, capBytes);
+}
+
+// fills counters (JNIBWA_CACHE_N_COUNTERS of them, as listed in cache.h) with zeros if there's no cache
+void jnibwa_getResultCacheCounters( bwaidx_t* pIdx, int64_t* counters ) {
+	jnibwa_cache_t* pCache = ((jnibwa_idx_t*)pIdx)->pCache;
+	if ( pCache ) cache_getCounters(pCache, counters);
+	else memset(counters, 0, JNIBWA_CACHE_N_COUNTERS*sizeof(int64_t));
 }
 
+// The reference dictionary, packed into a single buffer:
+//   a 32-bit count of the contigs, and a 32-bit count of the characters in all their names
+//   a fixed-size jnibwa_contig_t for each contig, in bwa's order (so a contig's index is its refID)
+//   the names, end to end, with no terminators
+typedef struct {
+	int64_t offset;     // where the contig starts in bwa's concatenation of the whole reference
+	int32_t len;
+	int32_t isAlt;      // 1 if the contig is an ALT contig (it's listed in the index's .alt file)
+	int32_t nameOffset; // where the name starts among the names
+	int32_t nameLen;
+} jnibwa_contig_t;
+
 void* jnibwa_getRefContigNames( bwaidx_t* pIdx, size_t* pBufSize ) {
 	int nRefContigs = pIdx->bns->n_seqs;
 	bntann1_t* pAnnoBeg = pIdx->bns->anns;
 	bntann1_t* pAnnoEnd = pAnnoBeg + nRefContigs;
 	bntann1_t* pAnno;
-	int bufSize = 4 + 4*nRefContigs; // for the ints that describe the number of contigs, and the length of each name
+	size_t namesLen = 0;
 	for ( pAnno = pAnnoBeg; pAnno != pAnnoEnd; ++pAnno ) {
-		bufSize += strlen(pAnno->name)+1;
+		namesLen += strlen(pAnno->name);
 	}
+	size_t hdrLen = 2*sizeof(int32_t) + nRefContigs*sizeof(jnibwa_contig_t);
+	size_t bufSize = hdrLen + namesLen;
 	char* bufMem = malloc(bufSize);
-	*(int32_t*)bufMem = nRefContigs;
-	char* pBuf = bufMem + sizeof(int32_t);
-	for ( pAnno = pAnnoBeg; pAnno != pAnnoEnd; ++pAnno ) {
+	((int32_t*)bufMem)[0] = nRefContigs;
+	((int32_t*)bufMem)[1] = namesLen;
+	jnibwa_contig_t* pContig = (jnibwa_contig_t*)(bufMem + 2*sizeof(int32_t));
+	char* pName = bufMem + hdrLen;
+	for ( pAnno = pAnnoBeg; pAnno != pAnnoEnd; ++pAnno, ++pContig ) {
 		size_t len = strlen(pAnno->name);
-		*(int32_t*)pBuf = len;
-		pBuf += sizeof(int32_t);
-		memcpy(pBuf, pAnno->name, len);
-		pBuf += len;
+		pContig->offset = pAnno->offset;
+		pContig->len = pAnno->len;
+		pContig->isAlt = pAnno->is_alt != 0;
+		pContig->nameOffset = pName - (bufMem + hdrLen);
+		pContig->nameLen = len;
+		memcpy(pName, pAnno->name, len);
+		pName += len;
 	}
 	*pBufSize = bufSize;
 	return bufMem;
 }
 
-void* jnibwa_createAlignments( bwaidx_t* pIdx, mem_opt_t* pOpts, mem_pestat_t* pPestat, char* pSeq, size_t* pBufSize) {
-	char c = 0;
-	char* emptyString = &c;
-	uint32_t nSeqs = *(uint32_t*)pSeq;
-	pSeq += sizeof(uint32_t);
-	bseq1_t* pSeq1Beg = calloc(nSeqs, sizeof(bseq1_t));
-	bseq1_t* pSeq1End = pSeq1Beg+nSeqs;
+// A batch of sequences to align, and, once it's been run, its results.
+struct jnibwa_job_s {
+	jnibwa_ctx_t ctx;
+	bwaidx_t* pIdx;
+	mem_pestat_t pestat[4];
+	int pestatProvided;
+	uint32_t nSeqs;
+	bseq1_t* pSeqs;
+	uint32_t nAllSeqs; // before removing duplicates and cached reads
+	uint32_t* pDupOf;  // for each sequence, the id of the one whose results it shares, or null if not deduplicating
+	jnibwa_cache_t* pCache; // where to put the results of the reads bwa aligns, or null if we're not caching
+	uint64_t optsHash;
+	uint64_t* pSeqHashes; // by id
+	char* pBases; // unpacked bases, if the sequences came to us packed
+	void* pResults;
+	size_t resultsSize;
+	int outputFormat;
+	char* pResultsBuf; // the caller's buffer for the columns, if the output is columnar
+	size_t resultsBufSize;
+	jnibwa_stats_t stats;
+	int64_t* pStatsOut; // where to put the stats, or null if we're not collecting them
+	jnibwa_job_t* next;
+};
+
+static void parseAsciiSeqs( char* pSeq, bseq1_t* pSeq1Beg, bseq1_t* pSeq1End ) {
 	bseq1_t* pSeq1;
 	for ( pSeq1 = pSeq1Beg; pSeq1 != pSeq1End; ++pSeq1 ) {
 		size_t seqLen = strlen(pSeq);
 		pSeq1->l_seq = seqLen;
 		pSeq1->seq = pSeq;
-		pSeq1->name = emptyString;
-		pSeq1->id = pSeq1-pSeq1Beg;
 		pSeq += seqLen + 1;
 	}
+}
 
-	mem_process_seqs(pOpts, pIdx->bwt, pIdx->bns, pIdx->pac, 0, nSeqs, pSeq1Beg, pPestat);
+// In the JNIBWA_SEQS_NAMED layout, each sequence is three null-terminated strings:  the read name, the base calls,
+// and the base qualities (phred+33, as in a FASTQ), which may be empty if there aren't any
+static void parseNamedSeqs( char* pSeq, bseq1_t* pSeq1Beg, bseq1_t* pSeq1End ) {
+	bseq1_t* pSeq1;
+	for ( pSeq1 = pSeq1Beg; pSeq1 != pSeq1End; ++pSeq1 ) {
+		pSeq1->name = pSeq;
+		pSeq += strlen(pSeq) + 1;
+		size_t seqLen = strlen(pSeq);
+		pSeq1->l_seq = seqLen;
+		pSeq1->seq = pSeq;
+		pSeq += seqLen + 1;
+		size_t qualLen = strlen(pSeq);
+		pSeq1->qual = qualLen == seqLen && seqLen ? pSeq : 0;
+		pSeq += qualLen + 1;
+	}
+}
 
-	size_t nInts = 0;
+// In the JNIBWA_SEQS_2BIT layout, each sequence is:
+//   a 32-bit integer giving the length of the sequence, L
+//   (L+3)/4 bytes of bases, 2 bits each (A=0, C=1, G=2, T=3), base i in bits 2*(i%4) and 2*(i%4)+1 of byte i/4
+//   (L+7)/8 bytes of mask, bit i%8 of byte i/8 set if base i is an N (or some other ambiguity code)
+//   padding to the next 4-byte boundary
+// bwa works with bases coded as 0-4 (for A, C, G, T, N), and it accepts sequences that are already coded that
+// way, so we unpack into a single buffer of coded bases, which is returned.
+static char* parsePackedSeqs( char* pSeq, bseq1_t* pSeq1Beg, bseq1_t* pSeq1End ) {
+	bseq1_t* pSeq1;
+	size_t nBases = 0;
+	char* pRec = pSeq;
 	for ( pSeq1 = pSeq1Beg; pSeq1 != pSeq1End; ++pSeq1 ) {
-		if ( pSeq1->sam ) nInts += bufLen((int32_t*)pSeq1->sam);
+		int32_t seqLen = *(int32_t*)pRec;
+		nBases += seqLen;
+		pRec += sizeof(int32_t) + ((((seqLen+3)>>2) + ((seqLen+7)>>3) + 3) & ~3);
 	}
-	int32_t* resultsBeg = malloc(nInts*sizeof(int32_t));
-	int32_t* pResults = resultsBeg;
+	char* pBases = malloc(nBases ? nBases : 1);
+	char* pOut = pBases;
+	pRec = pSeq;
 	for ( pSeq1 = pSeq1Beg; pSeq1 != pSeq1End; ++pSeq1 ) {
-		int32_t* pBuf = (int32_t*)pSeq1->sam;
-		if ( pBuf ) {
-			size_t len = bufLen(pBuf);
-			memcpy(pResults, pBuf, len*sizeof(int32_t));
-			free(pBuf);
-			pResults += len;
+		int32_t seqLen = *(int32_t*)pRec;
+		uint8_t const* pPacked = (uint8_t const*)(pRec + sizeof(int32_t));
+		uint8_t const* pMask = pPacked + ((seqLen+3)>>2);
+		int32_t idx;
+		for ( idx = 0; idx < seqLen; ++idx )
+			pOut[idx] = (pPacked[idx>>2] >> ((idx&3)<<1)) & 3;
+		for ( idx = 0; idx < seqLen; idx += 8 ) {
+			uint8_t mask = pMask[idx>>3];
+			while ( mask ) {
+				int bit = __builtin_ctz(mask);
+				pOut[idx+bit] = 4;
+				mask &= mask - 1;
+			}
 		}
+		pSeq1->l_seq = seqLen;
+		pSeq1->seq = pOut;
+		pOut += seqLen;
+		pRec += sizeof(int32_t) + ((((seqLen+3)>>2) + ((seqLen+7)>>3) + 3) & ~3);
+	}
+	return pBases;
+}
+
+// parses a sequences buffer into bseq1_t's (which point into the buffer), and returns them
+// if the bases had to be unpacked, *ppBases is set to the memory that holds them, which the caller must free
+static bseq1_t* parseSeqs( char* pSeq, int seqsFormat, uint32_t* pNSeqs, char** ppBases ) {
+	static char emptyString[1];
+	uint32_t nSeqs = *(uint32_t*)pSeq;
+	pSeq += sizeof(uint32_t);
+	bseq1_t* pSeq1Beg = calloc(nSeqs, sizeof(bseq1_t));
+	bseq1_t* pSeq1End = pSeq1Beg+nSeqs;
+	bseq1_t* pSeq1;
+	*ppBases = 0;
+	if ( seqsFormat == JNIBWA_SEQS_2BIT ) *ppBases = parsePackedSeqs(pSeq, pSeq1Beg, pSeq1End);
+	else if ( seqsFormat == JNIBWA_SEQS_NAMED ) parseNamedSeqs(pSeq, pSeq1Beg, pSeq1End);
+	else parseAsciiSeqs(pSeq, pSeq1Beg, pSeq1End);
+	for ( pSeq1 = pSeq1Beg; pSeq1 != pSeq1End; ++pSeq1 ) {
+		if ( !pSeq1->name ) pSeq1->name = emptyString;
+		pSeq1->id = pSeq1-pSeq1Beg;
+	}
+	*pNSeqs = nSeqs;
+	return pSeq1Beg;
+}
+
+// bwa translates ASCII bases into its 0-4 codes in place as it aligns them.  Doing it ahead of time lets us
+// compare sequences as bwa sees them (so "acgt" matches "ACGT", and any ambiguity code matches "N").
+static void normalizeSeqs( bseq1_t* pSeq1Beg, bseq1_t* pSeq1End ) {
+	bseq1_t* pSeq1;
+	for ( pSeq1 = pSeq1Beg; pSeq1 != pSeq1End; ++pSeq1 ) {
+		uint8_t* pBase = (uint8_t*)pSeq1->seq;
+		uint8_t* pEnd = pBase + pSeq1->l_seq;
+		for ( ; pBase != pEnd; ++pBase ) *pBase = nst_nt4_table[*pBase];
 	}
-	free(pSeq1Beg);
+}
+
+// Exact duplicates:  with JNIBWA_JOB_DEDUP, each distinct sequence (or, for pairs, each distinct pair of
+// sequences, since a read's alignment depends on its mate) is handed to bwa once, and the arena's offset for each
+// duplicate is pointed at the results of the first copy.  The layout of the results is unchanged.
+static uint64_t seqHash( char const* pSeq, int len, uint64_t hash ) {
+	hash ^= (uint64_t)len * 0x9e3779b97f4a7c15ULL;
+	while ( len > 0 ) {
+		uint64_t word = 0;
+		memcpy(&word, pSeq, len < 8 ? len : 8);
+		hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 32;
+		pSeq += 8;
+		len -= 8;
+	}
+	return hash;
+}
+
+static int sameSeqs( bseq1_t const* pSeq1, bseq1_t const* pSeq2, int unit ) {
+	int idx;
+	for ( idx = 0; idx < unit; ++idx ) {
+		if ( pSeq1[idx].l_seq != pSeq2[idx].l_seq || memcmp(pSeq1[idx].seq, pSeq2[idx].seq, pSeq1[idx].l_seq) )
+			return 0;
+	}
+	return 1;
+}
+
+// unit is 1 for unpaired reads, and 2 for pairs (a trailing unpaired read is kept, but never matched)
+// moves the distinct units to the front of pSeqs, and returns the number of sequences that remain
+// pDupOf gets the id of the sequence whose results each sequence will share (its own id, if it's kept)
+static uint32_t dedupSeqs( bseq1_t* pSeqs, uint32_t nSeqs, int unit, uint32_t* pDupOf ) {
+	typedef struct { uint64_t hash; uint32_t pos; } slot_t; // pos is 1 + the unit's index after compaction
+	uint32_t nUnits = nSeqs / unit;
+	uint32_t nSlots = 16;
+	while ( nSlots < 2*nUnits ) nSlots <<= 1;
+	slot_t* pSlots = calloc(nSlots, sizeof(slot_t));
+	uint32_t nKept = 0;
+	uint32_t unitIdx;
+	for ( unitIdx = 0; unitIdx < nUnits; ++unitIdx ) {
+		bseq1_t* pUnit = pSeqs + unitIdx*unit;
+		uint64_t hash = 0;
+		int idx;
+		for ( idx = 0; idx < unit; ++idx ) hash = seqHash(pUnit[idx].seq, pUnit[idx].l_seq, hash);
+		uint32_t slotIdx = hash & (nSlots - 1);
+		slot_t* pSlot;
+		while ( (pSlot = pSlots + slotIdx)->pos ) {
+			bseq1_t* pKept = pSeqs + (pSlot->pos - 1)*unit;
+			if ( pSlot->hash == hash && sameSeqs(pKept, pUnit, unit) ) break;
+			slotIdx = (slotIdx + 1) & (nSlots - 1);
+		}
+		if ( pSlot->pos ) {
+			bseq1_t* pKept = pSeqs + (pSlot->pos - 1)*unit;
+			for ( idx = 0; idx < unit; ++idx ) pDupOf[pUnit[idx].id] = pKept[idx].id;
+			continue;
+		}
+		pSlot->hash = hash;
+		pSlot->pos = ++nKept;
+		bseq1_t* pKept = pSeqs + (nKept - 1)*unit;
+		for ( idx = 0; idx < unit; ++idx ) {
+			pDupOf[pUnit[idx].id] = pUnit[idx].id;
+			pKept[idx] = pUnit[idx];
+		}
+	}
+	free(pSlots);
+	uint32_t nOut = nKept*unit;
+	uint32_t seqIdx;
+	for ( seqIdx = nUnits*unit; seqIdx < nSeqs; ++seqIdx ) {
+		pDupOf[pSeqs[seqIdx].id] = pSeqs[seqIdx].id;
+		pSeqs[nOut++] = pSeqs[seqIdx];
+	}
+	return nOut;
+}
+
+// Cached results:  if the index has a cache, unpaired reads whose results are there go straight into the arena,
+// and the rest are handed to bwa.  Their results are added to the cache when the batch is done.
+// Options that can't change a read's results (n_threads and chunk_size) are left out of the options' hash, and so
+// is the struct's padding (after zdrop, and after mat), which struct assignment needn't copy.  The fields within
+// each of the runs that are hashed are all ints and floats (and then the int8_t matrix), so there's no padding there.
+static uint64_t optsRunHash( mem_opt_t const* pOpts, size_t beg, size_t end, uint64_t hash ) {
+	return seqHash((char const*)pOpts + beg, end - beg, hash);
+}
+
+static uint64_t optsHash( mem_opt_t const* pOpts ) {
+	uint64_t hash = optsRunHash(pOpts, offsetof(mem_opt_t, a), offsetof(mem_opt_t, zdrop) + sizeof(pOpts->zdrop), 0);
+	hash = optsRunHash(pOpts, offsetof(mem_opt_t, max_mem_intv), offsetof(mem_opt_t, n_threads), hash);
+	return optsRunHash(pOpts, offsetof(mem_opt_t, mask_level), offsetof(mem_opt_t, mat) + sizeof(pOpts->mat), hash);
+}
+
+// returns the number of sequences that missed, which are moved to the front of pSeqs
+static uint32_t job_findCached( jnibwa_job_t* pJob, bseq1_t* pSeqs, uint32_t nSeqs ) {
+	jnibwa_cache_t* pCache = pJob->pCache;
+	pJob->optsHash = optsHash(&pJob->ctx.opt);
+	pJob->pSeqHashes = malloc((pJob->nAllSeqs ? pJob->nAllSeqs : 1)*sizeof(uint64_t));
+	uint32_t nMissed = 0;
+	uint32_t idx;
+	cache_lock(pCache);
+	for ( idx = 0; idx < nSeqs; ++idx ) {
+		bseq1_t* pSeq1 = pSeqs + idx;
+		uint64_t hash = seqHash(pSeq1->seq, pSeq1->l_seq, 0);
+		pJob->pSeqHashes[pSeq1->id] = hash;
+		cache_entry_t const* pEntry = cache_find(pCache, hash, pJob->optsHash, pSeq1->seq, pSeq1->l_seq);
+		if ( pEntry ) arena_putBytes(&pJob->ctx.arena, pSeq1->id, pEntry->data + pEntry->seqLen, pEntry->resultLen);
+		else pSeqs[nMissed++] = *pSeq1;
+	}
+	cache_unlock(pCache);
+	if ( nMissed ) pJob->ctx.pResultLens = calloc(pJob->nAllSeqs, sizeof(uint32_t));
+	return nMissed;
+}
+
+static void job_cacheResults( jnibwa_job_t* pJob ) {
+	jnibwa_cache_t* pCache = pJob->pCache;
+	char* pBuf = pJob->ctx.arena.buf;
+	int32_t const* pOffsets = (int32_t const*)pBuf;
+	bseq1_t* pSeq1End = pJob->pSeqs + pJob->nSeqs;
+	bseq1_t* pSeq1;
+	cache_lock(pCache);
+	for ( pSeq1 = pJob->pSeqs; pSeq1 != pSeq1End; ++pSeq1 ) {
+		int id = pSeq1->id;
+		if ( !pJob->ctx.pResultLens[id] ) continue; // never formatted
+		cache_insert(pCache, pJob->pSeqHashes[id], pJob->optsHash, pSeq1->seq, pSeq1->l_seq,
+						pBuf + pOffsets[id], pJob->ctx.pResultLens[id]);
+	}
+	cache_unlock(pCache);
+}
+
+// outputFormat is a JNIBWA_OUTPUT_*, and jobFlags are JNIBWA_JOB_* bits
+static void job_init( jnibwa_job_t* pJob, bwaidx_t* pIdx, mem_opt_t* pOpts, mem_pestat_t* pPestat, char* pSeq, int seqsFormat,
+						int outputFormat, int jobFlags, char* pResultsBuf, size_t resultsBufSize, int64_t* pStatsOut,
+						size_t statsOutSize ) {
+	int64_t begNs = stats_nowNs();
+	uint32_t nSeqs;
+	bseq1_t* pSeq1Beg = parseSeqs(pSeq, seqsFormat, &nSeqs, &pJob->pBases);
+	pJob->nAllSeqs = nSeqs;
+	pJob->pDupOf = 0;
+	pJob->pCache = 0;
+	pJob->pSeqHashes = 0;
+	pJob->ctx.opt = *pOpts;
+	pJob->ctx.opt.flag |= JNIBWA_F_CTX;
+	// columns are made from the arena's BAMish records, so it's the columns that go in the caller's buffer
+	int isColumns = outputFormat == JNIBWA_OUTPUT_COLUMNS;
+	arena_init(&pJob->ctx.arena, nSeqs, isColumns ? 0 : pResultsBuf, resultsBufSize);
+	pJob->outputFormat = outputFormat;
+	pJob->pResultsBuf = isColumns ? pResultsBuf : 0;
+	pJob->resultsBufSize = isColumns ? resultsBufSize : 0;
+	pJob->ctx.fmt = gFormatters[outputFormat];
+	pJob->ctx.pResultLens = 0;
+	if ( outputFormat == JNIBWA_OUTPUT_PRIMARY ) {
+		// the primary alignment is all we'll look at
+		pJob->ctx.opt.max_XA_hits = pJob->ctx.opt.max_XA_hits_alt = 0;
+		pJob->ctx.opt.flag &= ~MEM_F_ALL;
+	}
+
+	// named reads have their own names and qualities in the BAM records, so their results are never shared
+	// the cache is keyed by the options, and not by the output format, so it holds only BAMish results (which columns
+	// are made from, too)
+	int isPaired = (pOpts->flag & MEM_F_PE) != 0;
+	if ( seqsFormat != JNIBWA_SEQS_NAMED && outputFormat != JNIBWA_OUTPUT_BAM ) {
+		int dedup = (jobFlags & JNIBWA_JOB_DEDUP) != 0;
+		int isBAMish = outputFormat == JNIBWA_OUTPUT_BAMISH || isColumns;
+		jnibwa_cache_t* pCache = isPaired || !isBAMish ? 0 : ((jnibwa_idx_t*)pIdx)->pCache;
+		if ( pCache && pCache->capBytes ) pJob->pCache = pCache;
+		if ( (dedup || pJob->pCache) && seqsFormat == JNIBWA_SEQS_ASCII ) normalizeSeqs(pSeq1Beg, pSeq1Beg + nSeqs);
+		if ( dedup ) {
+			pJob->pDupOf = malloc((nSeqs ? nSeqs : 1)*sizeof(uint32_t));
+			nSeqs = dedupSeqs(pSeq1Beg, nSeqs, isPaired ? 2 : 1, pJob->pDupOf);
+		}
+		if ( pJob->pCache ) nSeqs = job_findCached(pJob, pSeq1Beg, nSeqs);
+	}
+
+	pJob->ctx.pStats = 0;
+	pJob->pStatsOut = 0;
+	if ( pStatsOut && statsOutSize >= stats_exportSize(pOpts->n_threads) ) {
+		stats_init(&pJob->stats, pOpts->n_threads);
+		pJob->stats.stageNs[JNIBWA_STATS_PARSE] = stats_nowNs() - begNs;
+		pJob->ctx.pStats = &pJob->stats;
+		pJob->pStatsOut = pStatsOut;
+	}
+	pJob->pIdx = pIdx;
+	pJob->pestatProvided = pPestat != 0;
+	if ( pPestat ) memcpy(pJob->pestat, pPestat, 4*sizeof(mem_pestat_t));
+	pJob->nSeqs = nSeqs;
+	pJob->pSeqs = pSeq1Beg;
+	pJob->pResults = 0;
+	pJob->resultsSize = 0;
+	pJob->next = 0;
+}
+
+static void job_run( jnibwa_job_t* pJob ) {
+	bwaidx_t* pIdx = pJob->pIdx;
+	jnibwa_stats_t* pStats = pJob->ctx.pStats;
+	int64_t begNs = 0;
+	if ( pStats ) {
+		begNs = stats_nowNs();
+		pool_setObserver(&pStats->obs);
+	}
+	if ( pJob->nSeqs ) {
+		mem_process_seqs(&pJob->ctx.opt, pIdx->bwt, pIdx->bns, pIdx->pac, 0, pJob->nSeqs, pJob->pSeqs,
+							pJob->pestatProvided ? pJob->pestat : 0);
+		if ( pJob->pCache && !pJob->ctx.arena.isTooBig ) job_cacheResults(pJob);
+	}
+	free(pJob->pSeqHashes);
+	pJob->pSeqHashes = 0;
+	free(pJob->ctx.pResultLens);
+	pJob->ctx.pResultLens = 0;
+
+	// the formatter has moved each read's results into the arena, so what's left here is an empty string
+	bseq1_t* pSeq1End = pJob->pSeqs + pJob->nSeqs;
+	bseq1_t* pSeq1;
+	for ( pSeq1 = pJob->pSeqs; pSeq1 != pSeq1End; ++pSeq1 ) {
+		free(pSeq1->sam);
+	}
+	free(pJob->pSeqs);
+	pJob->pSeqs = 0;
+	free(pJob->pBases);
+	pJob->pBases = 0;
+
+	if ( pJob->pDupOf ) {
+		int32_t* pOffsets = (int32_t*)pJob->ctx.arena.buf;
+		uint32_t idx;
+		for ( idx = 0; idx < pJob->nAllSeqs; ++idx ) pOffsets[idx] = pOffsets[pJob->pDupOf[idx]];
+		free(pJob->pDupOf);
+		pJob->pDupOf = 0;
+	}
+
+	pJob->pResults = arena_release(&pJob->ctx.arena, &pJob->resultsSize);
+	if ( pJob->pResults && pJob->outputFormat == JNIBWA_OUTPUT_COLUMNS ) {
+		void* pColumns = columns_fromBAMish(pJob->pResults, pJob->nAllSeqs, pJob->pResultsBuf, pJob->resultsBufSize,
+											&pJob->resultsSize);
+		free(pJob->pResults);
+		pJob->pResults = pColumns;
+	}
+
+	if ( pStats ) {
+		pool_setObserver(0);
+		pStats->stageNs[JNIBWA_STATS_TOTAL] = pStats->stageNs[JNIBWA_STATS_PARSE] + stats_nowNs() - begNs;
+		stats_export(pStats, pJob->pStatsOut);
+		stats_destroy(pStats);
+		pJob->ctx.pStats = 0;
+	}
+}
+
+// outputFormat is a JNIBWA_OUTPUT_*, and jobFlags are JNIBWA_JOB_* bits
+// if pResultsBuf is non-null, the results are written there if they'll fit, and pResultsBuf is returned
+// otherwise the results are returned in memory that the caller must free
+// returns null if the results would pass 2 GB, which the int32 offsets in every output format can't address
+// if pStatsOut is non-null, and there's room (see stats_exportSize), timings and counters for the batch are put there
+void* jnibwa_createAlignments( bwaidx_t* pIdx, mem_opt_t* pOpts, mem_pestat_t* pPestat, char* pSeq, int seqsFormat,
+								int outputFormat, int jobFlags, char* pResultsBuf, size_t resultsBufSize, int64_t* pStatsOut,
+								size_t statsOutSize, size_t* pBufSize ) {
+	jnibwa_job_t job;
+	job_init(&job, pIdx, pOpts, pPestat, pSeq, seqsFormat, outputFormat, jobFlags, pResultsBuf, resultsBufSize,
+				pStatsOut, statsOutSize);
+	job_run(&job);
+	*pBufSize = job.resultsSize;
+	return job.pResults;
+}
+
+// Pair-end stats inference, just as mem_process_seqs does it between its two passes:  align each read on its
+// own, and hand the alignment regions to mem_pestat.  That's only seeding, chaining, and extension -- no mate
+// rescue, no XA hits, and no formatting -- so it's a good deal cheaper than aligning the pairs.
+typedef struct {
+	mem_opt_t const* pOpts;
+	bwaidx_t* pIdx;
+	bseq1_t* pSeqs;
+	uint32_t nPairs;   // in pSeqs
+	uint32_t nSampled; // pairs we're actually aligning
+	mem_alnreg_v* pRegs; // for each sampled read
+} pestat_job_t;
+
+static void pestat_align1( void* data, int i, int tid ) {
+	pestat_job_t* pJob = data;
+	bwaidx_t* pIdx = pJob->pIdx;
+	// spread the sampled pairs evenly over the whole batch, so that sorted input doesn't skew the sample
+	uint32_t pairIdx = (uint64_t)(i >> 1) * pJob->nPairs / pJob->nSampled;
+	bseq1_t* pSeq1 = pJob->pSeqs + 2*pairIdx + (i & 1);
+	pJob->pRegs[i] = mem_align1(pJob->pOpts, pIdx->bwt, pIdx->bns, pIdx->pac, pSeq1->l_seq, pSeq1->seq);
+}
+
+// the sequences are pairs, with mates adjacent (a trailing unpaired read is ignored)
+// if maxPairs is non-zero, and there are more pairs than that, only maxPairs of them are examined
+// pes gets the stats for each of bwa's 4 orientations, and the number of pairs examined is returned
+int jnibwa_inferPairEndStats( bwaidx_t* pIdx, mem_opt_t* pOpts, char* pSeq, int seqsFormat, uint32_t maxPairs,
+								mem_pestat_t pes[4] ) {
+	uint32_t nSeqs;
+	char* pBases;
+	pestat_job_t job;
+	job.pOpts = pOpts;
+	job.pIdx = pIdx;
+	job.pSeqs = parseSeqs(pSeq, seqsFormat, &nSeqs, &pBases);
+	job.nPairs = nSeqs/2;
+	job.nSampled = maxPairs && maxPairs < job.nPairs ? maxPairs : job.nPairs;
+	int nSampledSeqs = 2*job.nSampled;
+	job.pRegs = calloc(nSampledSeqs ? nSampledSeqs : 1, sizeof(mem_alnreg_v));
+	kt_for(pOpts->n_threads, pestat_align1, &job, nSampledSeqs);
+	mem_pestat(pOpts, pIdx->bns->l_pac, nSampledSeqs, job.pRegs, pes);
+	int idx;
+	for ( idx = 0; idx < nSampledSeqs; ++idx ) free(job.pRegs[idx].a);
+	free(job.pRegs);
+	free(job.pSeqs);
+	free(pBases);
+	return job.nSampled;
+}
+
+// asynchronous jobs wait here, once they've been run, until someone claims them
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	jnibwa_job_t* head;
+	jnibwa_job_t* tail;
+} gDoneJobs = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0 };
+
+static void job_runAsync( void* data ) {
+	jnibwa_job_t* pJob = data;
+	job_run(pJob);
+	pthread_mutex_lock(&gDoneJobs.lock);
+	if ( gDoneJobs.tail ) gDoneJobs.tail->next = pJob;
+	else gDoneJobs.head = pJob;
+	gDoneJobs.tail = pJob;
+	pthread_cond_signal(&gDoneJobs.notEmpty);
+	pthread_mutex_unlock(&gDoneJobs.lock);
+}
+
+// queues a batch of sequences for alignment by the thread pool, and returns immediately
+// the options and pair-end stats are copied, but the sequences must stay put until the job is finished
+jnibwa_job_t* jnibwa_submitAlignments( bwaidx_t* pIdx, mem_opt_t* pOpts, mem_pestat_t* pPestat, char* pSeq, int seqsFormat,
+										int outputFormat, int jobFlags ) {
+	jnibwa_job_t* pJob = malloc(sizeof(jnibwa_job_t));
+	job_init(pJob, pIdx, pOpts, pPestat, pSeq, seqsFormat, outputFormat, jobFlags, 0, 0, 0, 0);
+	pool_submit(job_runAsync, pJob);
+	return pJob;
+}
+
+// blocks until some submitted job has been run, and returns it
+jnibwa_job_t* jnibwa_awaitAlignments( void ) {
+	pthread_mutex_lock(&gDoneJobs.lock);
+	while ( !gDoneJobs.head ) pthread_cond_wait(&gDoneJobs.notEmpty, &gDoneJobs.lock);
+	jnibwa_job_t* pJob = gDoneJobs.head;
+	if ( !(gDoneJobs.head = pJob->next) ) gDoneJobs.tail = 0;
+	pthread_mutex_unlock(&gDoneJobs.lock);
+	return pJob;
+}
 
-	*pBufSize = nInts*sizeof(int32_t);
-	return resultsBeg;
+// returns the results of a job that's been run, and disposes of the job
+void* jnibwa_finishAlignments( jnibwa_job_t* pJob, size_t* pBufSize ) {
+	void* pResults = pJob->pResults;
+	*pBufSize = pJob->resultsSize;
+	free(pJob);
+	return pResults;
 }
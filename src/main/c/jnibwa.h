@@ -6,13 +6,55 @@
 #define JNIBWA_H_
 
 #include "bwa/bwamem.h"
+#include "image.h"
 
+// layouts of the sequences buffer handed to jnibwa_createAlignments (and jnibwa_submitAlignments)
+// both start with a 32-bit count of the sequences to follow
+#define JNIBWA_SEQS_ASCII 0 // each sequence is a null-terminated string of base calls
+#define JNIBWA_SEQS_2BIT 1 // each sequence is a 32-bit length, 2-bit packed bases, and a mask for Ns (see jnibwa.c)
+#define JNIBWA_SEQS_NAMED 2 // each sequence is a null-terminated name, base calls, and phred+33 qualities (maybe empty)
+
+// layouts of the results
+#define JNIBWA_OUTPUT_BAMISH 0  // our own compact records (see fmt_BAMish in jnibwa.c)
+#define JNIBWA_OUTPUT_BAM 1     // BAM alignment records, ready to be BGZF-compressed (see fmt_BAM in jnibwa.c)
+#define JNIBWA_OUTPUT_PRIMARY 2 // one fixed-size record per read, for its primary alignment (see fmt_primary)
+#define JNIBWA_OUTPUT_COLUMNS 3 // the whole batch as parallel arrays (see columns.h)
+
+// options for jnibwa_createAlignments and jnibwa_submitAlignments (bit flags)
+#define JNIBWA_JOB_DEDUP 0x01 // align each distinct sequence (or pair) once, and share its results with duplicates
+
+// options for jnibwa_openIndex (bit flags)
+#define JNIBWA_OPEN_POPULATE 0x01     // fault in the whole mapping as it's made (MAP_POPULATE, Linux only)
+#define JNIBWA_OPEN_TOUCH 0x02        // fault in the whole mapping by touching each page from the thread pool
+#define JNIBWA_OPEN_THP 0x04          // copy the image into anonymous memory, asking for transparent huge pages
+#define JNIBWA_OPEN_HUGETLB 0x08      // copy the image into hugetlbfs pages (falls back to JNIBWA_OPEN_THP)
+#define JNIBWA_OPEN_BWT_RANDOM 0x10   // madvise(MADV_RANDOM) on the BWT
+#define JNIBWA_OPEN_BWT_WILLNEED 0x20 // madvise(MADV_WILLNEED) on the BWT
+#define JNIBWA_OPEN_SA_RANDOM 0x40    // madvise(MADV_RANDOM) on the suffix array
+#define JNIBWA_OPEN_SA_WILLNEED 0x80  // madvise(MADV_WILLNEED) on the suffix array
+#define JNIBWA_OPEN_SHM 0x100         // load the image into POSIX shared memory, shared by every process on the host
+#define JNIBWA_OPEN_MLOCK 0x200       // mlock the mapping, so it can't be paged out (best effort)
+#define JNIBWA_OPEN_VERIFY 0x400      // check the CRCs of the image's components (it's always checked structurally)
+
+typedef struct jnibwa_job_s jnibwa_job_t;
 
 int jnibwa_createReferenceIndex( char const* refFileName, char const* indexPrefix, char const* algoName);
-int jnibwa_createIndexFile( char const* refName, char const* imgSuffix );
-bwaidx_t* jnibwa_openIndex( int fd );
+int jnibwa_createIndexFile( char const* refName, char const* imgName, int compress, image_progress_fn progress,
+							void* progressArg );
+bwaidx_t* jnibwa_openIndex( int fd, int options );
 int jnibwa_destroyIndex( bwaidx_t* pIdx );
 void* jnibwa_getRefContigNames( bwaidx_t* pIdx, size_t* pBufSize );
-void* jnibwa_createAlignments( bwaidx_t* pIdx, mem_opt_t* pOpts, mem_pestat_t* peStats, char* pSeq, size_t* pBufSize);
+void jnibwa_setResultCacheCapacity( bwaidx_t* pIdx, size_t capBytes );
+void jnibwa_getResultCacheCounters( bwaidx_t* pIdx, int64_t* counters );
+char const* jnibwa_getSharedMemoryName( bwaidx_t* pIdx ); // null unless the image is in a shared segment
+void* jnibwa_createAlignments( bwaidx_t* pIdx, mem_opt_t* pOpts, mem_pestat_t* peStats, char* pSeq, int seqsFormat,
+								int outputFormat, int jobFlags, char* pResultsBuf, size_t resultsBufSize, int64_t* pStatsOut,
+								size_t statsOutSize, size_t* pBufSize );
+jnibwa_job_t* jnibwa_submitAlignments( bwaidx_t* pIdx, mem_opt_t* pOpts, mem_pestat_t* peStats, char* pSeq, int seqsFormat,
+										int outputFormat, int jobFlags );
+jnibwa_job_t* jnibwa_awaitAlignments( void );
+int jnibwa_inferPairEndStats( bwaidx_t* pIdx, mem_opt_t* pOpts, char* pSeq, int seqsFormat, uint32_t maxPairs,
+								mem_pestat_t pes[4] );
+void* jnibwa_finishAlignments( jnibwa_job_t* pJob, size_t* pBufSize );
 
 #endif /* JNIBWA_H_ */
@@ -3,6 +3,10 @@
 #include <stdlib.h>
 #include "jnibwa.h"
 #include "init.h"
+#include "pool.h"
+#include "cache.h"
+#include "columns.h"
+#include "arrow.h"
 #include "bwa/bwa_commit.h"
 
 
@@ -18,20 +22,25 @@ jint throwIllegalArgumentException(JNIEnv* env, char* message) {
    return (*env)->ThrowNew(env, iaeClass, message);
 }
 
-int jobject_to_mem_pestat_t(JNIEnv* env, jobject in, mem_pestat_t *out) {
+// fills all 4 of bwa's orientations (FF, FR, RF, RR) from an array of 4 BwaMemPairEndStats
+// a null element (or a null array) means that bwa should consider the orientation to have failed
+int jobject_to_mem_pestat_t(JNIEnv* env, jobjectArray in, mem_pestat_t *out) {
    if (in == NULL) {
      return 0;
    }
    memset(out, 0, sizeof(mem_pestat_t) * 4);
+   jsize len = (*env)->GetArrayLength(env, in);
    for (int i = 0; i < 4; i++, out++) {
-      if (i == 1) {
-         out->failed = (int) (*env)->GetBooleanField(env, in, peStatClass_failedID);
+      jobject stats = i < len ? (*env)->GetObjectArrayElement(env, in, i) : NULL;
+      if (stats != NULL) {
+         out->failed = (int) (*env)->GetBooleanField(env, stats, peStatClass_failedID);
          if (!out->failed) {
-            out->low = (int) (*env)->GetIntField(env, in, peStatClass_lowID);
-            out->high = (int) (*env)->GetIntField(env, in, peStatClass_highID);
-            out->avg = (double) (*env)->GetDoubleField(env, in, peStatClass_averageID);
-            out->std = (double) (*env)->GetDoubleField(env, in, peStatClass_stdID);
+            out->low = (int) (*env)->GetIntField(env, stats, peStatClass_lowID);
+            out->high = (int) (*env)->GetIntField(env, stats, peStatClass_highID);
+            out->avg = (double) (*env)->GetDoubleField(env, stats, peStatClass_averageID);
+            out->std = (double) (*env)->GetDoubleField(env, stats, peStatClass_stdID);
          }
+         (*env)->DeleteLocalRef(env, stats);
       } else {
          out->failed = 1;
       }
@@ -62,22 +71,44 @@ Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_createReferenceIndex( J
 	return res;
 }
 
+typedef struct {
+	JNIEnv* env;
+	jobject listener;
+	jmethodID progressID;
+} progress_listener_t;
+
+// relays image-writing progress to the Java listener:  an exception thrown by the listener abandons the write
+static int reportProgress( void* arg, size_t nWritten, size_t imageSize ) {
+	progress_listener_t* pListener = arg;
+	JNIEnv* env = pListener->env;
+	(*env)->CallVoidMethod(env, pListener->listener, pListener->progressID, (jlong)nWritten, (jlong)imageSize);
+	return (*env)->ExceptionCheck(env);
+}
+
+// the listener argument may be null, or an object with a "void progress(long,long)" method
 JNIEXPORT jboolean JNICALL
-Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_createIndexImageFile( JNIEnv* env, jclass cls, jstring referencePrefix, jstring imageFileName ) {
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_createIndexImageFile( JNIEnv* env, jclass cls, jstring referencePrefix, jstring imageFileName, jobject listener, jboolean compressed ) {
+	progress_listener_t progressListener = { env, listener, 0 };
+	if ( listener ) {
+		jclass listenerClass = (*env)->GetObjectClass(env, listener);
+		progressListener.progressID = (*env)->GetMethodID(env, listenerClass, "progress", "(JJ)V");
+		if ( !progressListener.progressID ) return 0;
+	}
 	char *refName = jstring_to_chars(env, referencePrefix);
 	char *imgName = jstring_to_chars(env, imageFileName);
-	jboolean res = !jnibwa_createIndexFile( refName, imgName );
+	jboolean res = !jnibwa_createIndexFile( refName, imgName, compressed, listener ? reportProgress : 0,
+											&progressListener );
 	free(refName); free(imgName);
 	return res;
 }
 
 JNIEXPORT jlong JNICALL
-Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_openIndex( JNIEnv* env, jclass cls, jstring memImgFilename ) {
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_openIndex( JNIEnv* env, jclass cls, jstring memImgFilename, jint options ) {
 	char *fname = jstring_to_chars(env, memImgFilename);
 	int fd = open(fname, O_RDONLY);
 	free(fname);
 	if ( fd == -1 ) return 0;
-	return (jlong)jnibwa_openIndex(fd);
+	return (jlong)jnibwa_openIndex(fd, options);
 }
 
 JNIEXPORT jint JNICALL
@@ -91,12 +122,17 @@ Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_createDefaultOptions( J
 	return (*env)->NewDirectByteBuffer(env, mem_opt_init(), sizeof(mem_opt_t));
 }
 
-// returns a ByteBuffer with the reference contig names
+// returns a ByteBuffer with the reference dictionary
 // returned ByteBuffer has:
-//   a 32-bit int giving the number of contig names
-//   for each contig name,
+//   a 32-bit int giving the number of contigs
+//   a 32-bit int giving the total length of their names
+//   for each contig, in bwa's order,
+//     a 64-bit int giving the contig's offset in bwa's concatenated reference
+//     a 32-bit int giving the contig's length
+//     a 32-bit int that's 1 if it's an ALT contig, and 0 otherwise
+//     a 32-bit int giving the offset of the contig's name among the names
 //     a 32-bit int giving the length of the name
-//     that many bytes of name
+//   the names, end to end
 JNIEXPORT jobject JNICALL
 Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_getRefContigNames( JNIEnv* env, jclass cls, jlong idxAddr ) {
 	if ( !idxAddr ) return 0;
@@ -107,15 +143,51 @@ Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_getRefContigNames( JNIE
 	return namesBuf;
 }
 
+// gives the index's cache of results for unpaired reads room for capBytes of them (0 empties it)
+JNIEXPORT void JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_setResultCacheCapacity(
+				JNIEnv* env, jclass cls, jlong idxAddr, jlong capBytes ) {
+	jnibwa_setResultCacheCapacity((bwaidx_t*)idxAddr, capBytes > 0 ? capBytes : 0);
+}
+
+// fills counters, a long[JNIBWA_CACHE_N_COUNTERS], with the cache's counters (see cache.h)
+JNIEXPORT void JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_getResultCacheCounters(
+				JNIEnv* env, jclass cls, jlong idxAddr, jlongArray counters ) {
+	int64_t vals[JNIBWA_CACHE_N_COUNTERS];
+	jnibwa_getResultCacheCounters((bwaidx_t*)idxAddr, vals);
+	(*env)->SetLongArrayRegion(env, counters, 0, JNIBWA_CACHE_N_COUNTERS, (jlong*)vals);
+}
+
+// returns the name of the shared memory segment that holds the image, or null if it isn't in one
+JNIEXPORT jstring JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_getSharedMemoryName( JNIEnv* env, jclass cls, jlong idxAddr ) {
+	char const* name = jnibwa_getSharedMemoryName((bwaidx_t*)idxAddr);
+	return name ? (*env)->NewStringUTF(env, name) : 0;
+}
+
 // we accept a ByteBuffer that contains:
 //   a 32-bit integer count of the number of sequences to follow
 //   each sequence is just a regular old C string (8-bit characters, null terminated) giving the bases in the sequence
+// or, if seqsFormat is JNIBWA_SEQS_2BIT, the sequences are packed 2 bits per base as described in jnibwa.c
+// or, if seqsFormat is JNIBWA_SEQS_NAMED, each sequence is three C strings:  name, bases, and qualities (maybe empty)
+// jobFlags are JNIBWA_JOB_* bits:  with JNIBWA_JOB_DEDUP, exact duplicates share their results (in the buffer, too)
 // the idxAddr is what you got from the createIndex method above
 // the optsBuf argument is a mem_opt_t structure wrapped by a ByteBuffer (from createDefaultOptions method)
+// the resultsBuf argument is optional:  if it's a direct ByteBuffer large enough to hold the results, we write them
+//   there and return resultsBuf itself;  otherwise we return a new ByteBuffer (which must be freed by destroyByteBuffer)
+// the statsBuf argument is optional:  if it's a direct ByteBuffer large enough (see stats.h for its layout and size),
+//   we fill it with timings and counters for the batch
 // we return a ByteBuffer that contains:
-// for each sequence,
-//   a 32-bit integer count of the number of alignments that follow
-//   for each alignment, a flattened BAM-like pseudo-structure like this:
+//   for each sequence, a 32-bit integer giving the byte offset within the buffer of that sequence's results
+//   the results for each sequence (not necessarily in the same order as the sequences), which are
+//     a 32-bit integer count of the number of alignments that follow
+//   for each alignment, a flattened BAM-like pseudo-structure like the one below
+// or, if outputFormat is JNIBWA_OUTPUT_BAM, each sequence's results are a 32-bit byte count followed by that many
+//   bytes of real BAM records (see fmt_BAM in jnibwa.c)
+// or, if outputFormat is JNIBWA_OUTPUT_PRIMARY, each sequence's result is a single PrimaryAlignment (below)
+// or, if outputFormat is JNIBWA_OUTPUT_COLUMNS, the buffer holds the whole batch as parallel arrays, in input
+//   order, rather than per-sequence offsets and results (see columns.h)
 /*
 typedef struct {
 	int32_t flag_mapQ; // flag<<16 | mapQ (the flag value is a SAM-formatted flag)
@@ -138,27 +210,156 @@ typedef struct {
 	int32_t matePos;   // mate's reference starting position (0-based)
 	int32_t tlen;      // inferred template length
 } Alignment;
+
+typedef struct {
+	int32_t flag_mapQ; // as in Alignment (the strand is flag&0x10)
+	int32_t refID;     // -1 if unmapped
+	int32_t pos;       // -1 if unmapped
+	int32_t NM;        // 0 if unmapped
+	int32_t AS;        // 0 if unmapped
+	int32_t XS;        // 0 if unmapped
+	int32_t mateRefID; // -1 unless the read is paired and the mate is mapped
+	int32_t matePos;   // -1 unless the read is paired and the mate is mapped
+	int32_t tlen;      // 0 unless the read is paired and the mate is mapped
+	int32_t nCigar;    // 0 if unmapped
+	int32_t cigarOp[nCigarOps]; // len<<4 | op
+} PrimaryAlignment;
 */
 JNIEXPORT jobject JNICALL
 Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_createAlignments(
-				JNIEnv* env, jclass cls, jobject seqsBuf, jlong idxAddr, jobject optsBuf, jobject frPEStats ) {
+				JNIEnv* env, jclass cls, jobject seqsBuf, jint seqsFormat, jint outputFormat, jint jobFlags, jlong idxAddr,
+				jobject optsBuf, jobjectArray peStatsArr, jobject resultsBuf, jobject statsBuf ) {
 	bwaidx_t* pIdx = (bwaidx_t*)idxAddr;
 	mem_opt_t* pOpts = (*env)->GetDirectBufferAddress(env, optsBuf);
 	mem_pestat_t peStats[4];
-	int pestatProvided = jobject_to_mem_pestat_t(env, frPEStats, peStats);
+	int pestatProvided = jobject_to_mem_pestat_t(env, peStatsArr, peStats);
 	char* pSeq = (*env)->GetDirectBufferAddress(env, seqsBuf);
+	char* pResultsBuf = 0;
+	size_t resultsBufSize = 0;
+	if ( resultsBuf ) {
+		pResultsBuf = (*env)->GetDirectBufferAddress(env, resultsBuf);
+		resultsBufSize = (*env)->GetDirectBufferCapacity(env, resultsBuf);
+	}
+	int64_t* pStatsOut = 0;
+	size_t statsOutSize = 0;
+	if ( statsBuf ) {
+		pStatsOut = (*env)->GetDirectBufferAddress(env, statsBuf);
+		statsOutSize = (*env)->GetDirectBufferCapacity(env, statsBuf);
+	}
 	size_t bufSize = 0;
-	void* bufMem = jnibwa_createAlignments(pIdx, pOpts, pestatProvided ? peStats : 0, pSeq, &bufSize);
+	void* bufMem = jnibwa_createAlignments(pIdx, pOpts, pestatProvided ? peStats : 0, pSeq, seqsFormat, outputFormat,
+											jobFlags, pResultsBuf, resultsBufSize, pStatsOut, statsOutSize, &bufSize);
+	if ( !bufMem ) return 0;
+	if ( pResultsBuf && bufMem == pResultsBuf ) return resultsBuf;
 	jobject alnBuf = (*env)->NewDirectByteBuffer(env, bufMem, bufSize);
 	if ( !alnBuf ) free(bufMem);
 	return alnBuf;
 }
 
+// same arguments as createAlignments, but the work is queued for the thread pool, and we return right away
+// the return value is a handle for the job, which will eventually be returned by awaitAlignments
+// the seqsBuf must not be disturbed until then
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_submitAlignments(
+				JNIEnv* env, jclass cls, jobject seqsBuf, jint seqsFormat, jint outputFormat, jint jobFlags, jlong idxAddr,
+				jobject optsBuf, jobjectArray peStatsArr ) {
+	bwaidx_t* pIdx = (bwaidx_t*)idxAddr;
+	mem_opt_t* pOpts = (*env)->GetDirectBufferAddress(env, optsBuf);
+	mem_pestat_t peStats[4];
+	int pestatProvided = jobject_to_mem_pestat_t(env, peStatsArr, peStats);
+	char* pSeq = (*env)->GetDirectBufferAddress(env, seqsBuf);
+	return (jlong)jnibwa_submitAlignments(pIdx, pOpts, pestatProvided ? peStats : 0, pSeq, seqsFormat, outputFormat,
+											jobFlags);
+}
+
+// infers the pair-end stats for the sequences in seqsBuf (pairs, with mates adjacent), as bwa would for a batch
+// if maxPairs is positive, no more than that many pairs, spread evenly over the batch, are examined
+// fills peStatsOut, a double[20], with failed (0 or 1), low, high, average, and std for each of the 4 orientations
+// returns the number of pairs examined
+JNIEXPORT jint JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_inferPairEndStats(
+				JNIEnv* env, jclass cls, jobject seqsBuf, jint seqsFormat, jlong idxAddr, jobject optsBuf,
+				jint maxPairs, jdoubleArray peStatsOut ) {
+	bwaidx_t* pIdx = (bwaidx_t*)idxAddr;
+	mem_opt_t* pOpts = (*env)->GetDirectBufferAddress(env, optsBuf);
+	char* pSeq = (*env)->GetDirectBufferAddress(env, seqsBuf);
+	mem_pestat_t pes[4];
+	int nPairs = jnibwa_inferPairEndStats(pIdx, pOpts, pSeq, seqsFormat, maxPairs > 0 ? maxPairs : 0, pes);
+	jdouble vals[20];
+	int i;
+	for ( i = 0; i < 4; ++i ) {
+		vals[5*i] = pes[i].failed ? 1 : 0;
+		vals[5*i+1] = pes[i].low;
+		vals[5*i+2] = pes[i].high;
+		vals[5*i+3] = pes[i].avg;
+		vals[5*i+4] = pes[i].std;
+	}
+	(*env)->SetDoubleArrayRegion(env, peStatsOut, 0, 20, vals);
+	return nPairs;
+}
+
+// blocks until some submitted job is complete, and returns its handle
+JNIEXPORT jlong JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_awaitAlignments( JNIEnv* env, jclass cls ) {
+	return (jlong)jnibwa_awaitAlignments();
+}
+
+// returns a ByteBuffer (just like the one createAlignments returns) with the results of a completed job
+// the job handle is no longer valid after this call
+JNIEXPORT jobject JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_getAlignments( JNIEnv* env, jclass cls, jlong jobAddr ) {
+	size_t bufSize = 0;
+	void* bufMem = jnibwa_finishAlignments((jnibwa_job_t*)jobAddr, &bufSize);
+	if ( !bufMem ) return 0;
+	jobject alnBuf = (*env)->NewDirectByteBuffer(env, bufMem, bufSize);
+	if ( !alnBuf ) free(bufMem);
+	return alnBuf;
+}
+
+// hands a buffer of columnar results (see columns.h) over to Arrow by filling the ArrowSchema and ArrowArray at the
+// given addresses (see arrow.h):  the array takes over the buffer's native memory, unless copy is set (because the
+// buffer belongs to Java), in which case it gets a copy
+JNIEXPORT void JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_exportColumnsToArrow(
+				JNIEnv* env, jclass cls, jobject columnsBuf, jboolean copy, jlong schemaAddr, jlong arrayAddr ) {
+	char* pColumns = (*env)->GetDirectBufferAddress(env, columnsBuf);
+	if ( copy ) {
+		size_t len = columns_size(pColumns);
+		char* pCopy = malloc(len);
+		memcpy(pCopy, pColumns, len);
+		pColumns = pCopy;
+	}
+	arrow_exportColumns(pColumns, (struct ArrowSchema*)schemaAddr, (struct ArrowArray*)arrayAddr);
+}
+
+// plays the part of an Arrow consumer, for the tests:  calls the release callback of the ArrowSchema (or ArrowArray)
+JNIEXPORT void JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_releaseArrowStruct(
+				JNIEnv* env, jclass cls, jlong addr, jboolean isArray ) {
+	if ( isArray ) {
+		struct ArrowArray* pArray = (struct ArrowArray*)addr;
+		if ( pArray->release ) pArray->release(pArray);
+	} else {
+		struct ArrowSchema* pSchema = (struct ArrowSchema*)addr;
+		if ( pSchema->release ) pSchema->release(pSchema);
+	}
+}
+
 JNIEXPORT void JNICALL
 Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_destroyByteBuffer( JNIEnv* env, jclass cls, jobject alnBuf ) {
 	free((*env)->GetDirectBufferAddress(env, alnBuf));
 }
 
+JNIEXPORT jboolean JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_setThreadPool( JNIEnv* env, jclass cls, jint nThreads, jboolean pinThreads ) {
+	return !pool_configure(nThreads, pinThreads);
+}
+
+JNIEXPORT jint JNICALL
+Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_getNPoolThreads( JNIEnv* env, jclass cls ) {
+	return pool_getNThreads();
+}
+
 JNIEXPORT jstring JNICALL
 Java_org_broadinstitute_hellbender_utils_bwa_BwaMemIndex_getVersion( JNIEnv* env, jclass cls ) {
 	return (*env)->NewStringUTF(env, BWA_COMMIT);
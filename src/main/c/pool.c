@@ -0,0 +1,270 @@
+/*
+ * pool.c
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+#include <alloca.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+// bwa's kt_for creates and joins a fresh set of threads every time it's called, and
+// mem_process_seqs calls it twice for each batch of reads.  The kt_for defined here takes the
+// place of the one in libbwa.a (the linker never has to pull in kthread.o), and hands the work
+// to a process-wide set of long-lived threads instead.
+// The work is divided up just as bwa does it:  each of the n_threads slots steps through the
+// indices with a stride of n_threads, and a slot that runs dry steals from whichever slot is
+// furthest behind.  The calling thread always works one of the slots, so a kt_for call makes
+// progress even when every pool thread is busy with someone else's batch.
+
+typedef struct pool_task_s {
+	void (*func)(void*);
+	void* data;
+	int* pNRunning; // counts the pool threads working on this task's kt_for job, or null for a pool_submit task
+	struct pool_task_s* next;
+} pool_task_t;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t hasWork;
+	pthread_cond_t taskDone;
+	pool_task_t* head;
+	pool_task_t* tail;
+	int nLive;       // number of pool threads, with ids 0..nLive-1 (except while shrinking)
+	int nTarget;     // pool threads with ids at or above this number exit
+	int isFixed;     // the size was set by pool_configure, so don't grow it on demand
+	int pin;         // pin each pool thread to a CPU
+	int isShrinking; // pool_shrink is waiting for threads to exit, so don't start any
+} gPool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, 0, 0, 0 };
+
+// one pool_configure at a time, so that a shrink can't have its target changed while it waits
+static pthread_mutex_t gConfigLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* pool_worker( void* arg ) {
+	int id = (int)(long)arg;
+#ifdef __linux__
+	if ( gPool.pin ) {
+		long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(id % (nCPUs > 0 ? nCPUs : 1), &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+#endif
+	pthread_mutex_lock(&gPool.lock);
+	for (;;) {
+		while ( !gPool.head && id < gPool.nTarget ) pthread_cond_wait(&gPool.hasWork, &gPool.lock);
+		if ( id >= gPool.nTarget ) break;
+		pool_task_t* pTask = gPool.head;
+		if ( !(gPool.head = pTask->next) ) gPool.tail = 0;
+		void (*func)(void*) = pTask->func;
+		void* data = pTask->data;
+		int* pNRunning = pTask->pNRunning;
+		if ( pNRunning ) ++*pNRunning;
+		else free(pTask);
+		pthread_mutex_unlock(&gPool.lock);
+		func(data);
+		pthread_mutex_lock(&gPool.lock);
+		if ( pNRunning && !--*pNRunning ) pthread_cond_broadcast(&gPool.taskDone);
+	}
+	gPool.nLive -= 1;
+	pthread_cond_broadcast(&gPool.taskDone);
+	pthread_mutex_unlock(&gPool.lock);
+	return 0;
+}
+
+// must be called with the pool lock held
+// does nothing while the pool is shrinking:  raising nTarget would keep the threads that pool_shrink is waiting
+// for alive, and a new thread numbered by nLive would share its id with one that hasn't yet exited
+static void pool_grow( int nThreads ) {
+	if ( gPool.isShrinking ) return;
+	if ( gPool.nTarget < nThreads ) gPool.nTarget = nThreads;
+	while ( gPool.nLive < gPool.nTarget ) {
+		pthread_t tid;
+		if ( pthread_create(&tid, 0, pool_worker, (void*)(long)gPool.nLive) ) {
+			gPool.nTarget = gPool.nLive;
+			break;
+		}
+		pthread_detach(tid);
+		gPool.nLive += 1;
+	}
+}
+
+// must be called with the pool lock held
+static void pool_shrink( int nThreads ) {
+	gPool.isShrinking = 1;
+	gPool.nTarget = nThreads;
+	pthread_cond_broadcast(&gPool.hasWork);
+	while ( gPool.nLive > nThreads ) pthread_cond_wait(&gPool.taskDone, &gPool.lock);
+	gPool.isShrinking = 0;
+}
+
+// sets the number of pool threads, and whether they're pinned to CPUs
+// if nThreads isn't positive, the pool grows on demand to match the largest n_threads requested
+// returns non-zero if the requested number of threads couldn't be started
+int pool_configure( int nThreads, int pinThreads ) {
+	pthread_mutex_lock(&gConfigLock);
+	pthread_mutex_lock(&gPool.lock);
+	if ( !pinThreads != !gPool.pin ) {
+		pool_shrink(0);
+		gPool.pin = pinThreads;
+	}
+	gPool.isFixed = nThreads > 0;
+	if ( nThreads < 0 ) nThreads = 0;
+	if ( nThreads < gPool.nLive ) pool_shrink(nThreads);
+	pool_grow(nThreads);
+	if ( gPool.head && !gPool.nLive ) pool_grow(1); // don't strand queued pool_submit tasks
+	int result = gPool.nLive != nThreads && gPool.isFixed;
+	pthread_mutex_unlock(&gPool.lock);
+	pthread_mutex_unlock(&gConfigLock);
+	return result;
+}
+
+int pool_getNThreads( void ) {
+	pthread_mutex_lock(&gPool.lock);
+	int nThreads = gPool.nLive;
+	pthread_mutex_unlock(&gPool.lock);
+	return nThreads;
+}
+
+// runs func(data) on a pool thread
+void pool_submit( void (*func)(void*), void* data ) {
+	pool_task_t* pTask = malloc(sizeof(pool_task_t));
+	pTask->func = func;
+	pTask->data = data;
+	pTask->pNRunning = 0;
+	pTask->next = 0;
+	pthread_mutex_lock(&gPool.lock);
+	if ( !gPool.nLive ) pool_grow(1);
+	if ( gPool.tail ) gPool.tail->next = pTask;
+	else gPool.head = pTask;
+	gPool.tail = pTask;
+	pthread_cond_signal(&gPool.hasWork);
+	pthread_mutex_unlock(&gPool.lock);
+}
+
+static __thread pool_observer_t* tObserver;
+static __thread int tSlot;
+
+void pool_setObserver( pool_observer_t* pObs ) { tObserver = pObs; tSlot = 0; }
+pool_observer_t* pool_getObserver( void ) { return tObserver; }
+int pool_getSlot( void ) { return tSlot; }
+
+typedef struct ktf_job_s ktf_job_t;
+
+typedef struct {
+	ktf_job_t* pJob;
+	long i;
+} ktf_slot_t;
+
+struct ktf_job_s {
+	void (*func)(void*,int,int);
+	void* data;
+	int n_threads;
+	long n;
+	ktf_slot_t* slots;
+	int nRunning;
+	pool_observer_t* pObs;
+};
+
+static inline long ktf_steal( ktf_job_t* pJob ) {
+	int i, min_i = 0;
+	long k, min = LONG_MAX;
+	for ( i = 0; i < pJob->n_threads; ++i )
+		if ( min > pJob->slots[i].i ) min = pJob->slots[i].i, min_i = i;
+	k = __sync_fetch_and_add(&pJob->slots[min_i].i, pJob->n_threads);
+	return k >= pJob->n ? -1 : k;
+}
+
+static void ktf_run( void* data ) {
+	ktf_slot_t* pSlot = data;
+	ktf_job_t* pJob = pSlot->pJob;
+	int tid = pSlot - pJob->slots;
+	pool_observer_t* pObs = pJob->pObs;
+	pool_observer_t* pSavedObs = tObserver;
+	int savedSlot = tSlot;
+	tObserver = pObs;
+	tSlot = tid;
+	if ( pObs ) pObs->onSlot(pObs, tid, 0);
+	long i;
+	for (;;) {
+		i = __sync_fetch_and_add(&pSlot->i, pJob->n_threads);
+		if ( i >= pJob->n ) break;
+		pJob->func(pJob->data, i, tid);
+	}
+	while ( (i = ktf_steal(pJob)) >= 0 )
+		pJob->func(pJob->data, i, tid);
+	if ( pObs ) pObs->onSlot(pObs, tid, 1);
+	tObserver = pSavedObs;
+	tSlot = savedSlot;
+}
+
+void kt_for( int n_threads, void (*func)(void*,int,int), void* data, int n ) {
+	int i;
+	pool_observer_t* pObs = tObserver;
+	if ( n_threads <= 1 || n <= 1 ) {
+		if ( pObs ) {
+			pObs->onFor(pObs, 1, 0);
+			pObs->onSlot(pObs, 0, 0);
+		}
+		int savedSlot = tSlot;
+		tSlot = 0;
+		for ( i = 0; i < n; ++i ) func(data, i, 0);
+		tSlot = savedSlot;
+		if ( pObs ) {
+			pObs->onSlot(pObs, 0, 1);
+			pObs->onFor(pObs, 1, 1);
+		}
+		return;
+	}
+	if ( pObs ) pObs->onFor(pObs, n_threads, 0);
+	ktf_job_t job;
+	job.func = func;
+	job.data = data;
+	job.n_threads = n_threads;
+	job.n = n;
+	job.nRunning = 0;
+	job.pObs = pObs;
+	job.slots = alloca(n_threads*sizeof(ktf_slot_t));
+	for ( i = 0; i < n_threads; ++i ) {
+		job.slots[i].pJob = &job;
+		job.slots[i].i = i;
+	}
+	// slot 0 is ours, the others go on the queue for the pool threads
+	pool_task_t* tasks = alloca((n_threads-1)*sizeof(pool_task_t));
+	pthread_mutex_lock(&gPool.lock);
+	if ( !gPool.isFixed ) pool_grow(n_threads-1);
+	for ( i = 1; i < n_threads; ++i ) {
+		pool_task_t* pTask = &tasks[i-1];
+		pTask->func = ktf_run;
+		pTask->data = &job.slots[i];
+		pTask->pNRunning = &job.nRunning;
+		pTask->next = 0;
+		if ( gPool.tail ) gPool.tail->next = pTask;
+		else gPool.head = pTask;
+		gPool.tail = pTask;
+	}
+	pthread_cond_broadcast(&gPool.hasWork);
+	pthread_mutex_unlock(&gPool.lock);
+
+	ktf_run(&job.slots[0]);
+
+	// by now all the work has been claimed, so take back any slots that no pool thread picked up,
+	// and wait for the pool threads that did pick one up to finish
+	pthread_mutex_lock(&gPool.lock);
+	pool_task_t** ppTask = &gPool.head;
+	gPool.tail = 0;
+	while ( *ppTask ) {
+		if ( (*ppTask)->pNRunning == &job.nRunning ) *ppTask = (*ppTask)->next;
+		else { gPool.tail = *ppTask; ppTask = &(*ppTask)->next; }
+	}
+	while ( job.nRunning ) pthread_cond_wait(&gPool.taskDone, &gPool.lock);
+	pthread_mutex_unlock(&gPool.lock);
+	if ( pObs ) pObs->onFor(pObs, n_threads, 1);
+}
@@ -0,0 +1,28 @@
+/*
+ * pool.h
+ */
+
+#ifndef POOL_H_
+#define POOL_H_
+
+int pool_configure( int nThreads, int pinThreads );
+int pool_getNThreads( void );
+void pool_submit( void (*func)(void*), void* data );
+
+// An observer can be attached to a thread to watch the kt_for calls it makes.  It's handed on to whichever
+// threads work the slots of those kt_for calls, for as long as they're working them, so code called from
+// within a kt_for (bwa's workers, our formatter) can find it, and the slot it's running in.
+typedef struct pool_observer_s pool_observer_t;
+struct pool_observer_s {
+	void (*onFor)( pool_observer_t* pObs, int nThreads, int isEnd ); // called by the thread calling kt_for
+	void (*onSlot)( pool_observer_t* pObs, int tid, int isEnd );     // called by the thread working the slot
+};
+
+void pool_setObserver( pool_observer_t* pObs );
+pool_observer_t* pool_getObserver( void );
+int pool_getSlot( void );
+
+// replaces the kt_for in bwa's kthread.c (mem_process_seqs declares it extern with this signature)
+void kt_for( int n_threads, void (*func)(void*,int,int), void* data, int n );
+
+#endif /* POOL_H_ */
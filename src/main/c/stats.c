@@ -0,0 +1,145 @@
+/*
+ * stats.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "bwa/bwt.h"
+#include "bwa/ksw.h"
+
+int64_t stats_nowNs( void ) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000L + ts.tv_nsec;
+}
+
+static int64_t stats_cpuNs( void ) {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec*1000000000L + ts.tv_nsec;
+}
+
+static void stats_onFor( pool_observer_t* pObs, int nThreads, int isEnd ) {
+	jnibwa_stats_t* pStats = (jnibwa_stats_t*)pObs;
+	int64_t now = stats_nowNs();
+	if ( !isEnd ) {
+		if ( pStats->nFors ) pStats->stageNs[JNIBWA_STATS_PESTAT] += now - pStats->lastForEndNs;
+		pStats->nFors += 1;
+		pStats->lastForEndNs = now; // until it really ends, this is when it began
+	} else {
+		int stage = pStats->nFors == 1 ? JNIBWA_STATS_SEED_EXTEND : JNIBWA_STATS_PAIR_FORMAT;
+		pStats->stageNs[stage] += now - pStats->lastForEndNs;
+		pStats->lastForEndNs = now;
+	}
+}
+
+static void stats_onSlot( pool_observer_t* pObs, int tid, int isEnd ) {
+	jnibwa_stats_t* pStats = (jnibwa_stats_t*)pObs;
+	if ( tid >= pStats->nThreads ) return;
+	int64_t* pRow = pStats->pRows + tid*STATS_ROW_STRIDE;
+	if ( !isEnd ) {
+		pRow[STATS_SLOT_WALL_BEG] = stats_nowNs();
+		pRow[STATS_SLOT_CPU_BEG] = stats_cpuNs();
+	} else {
+		int isFirst = pStats->nFors == 1;
+		pRow[isFirst ? JNIBWA_STATS_SEED_EXTEND_WALL : JNIBWA_STATS_PAIR_FORMAT_WALL] +=
+				stats_nowNs() - pRow[STATS_SLOT_WALL_BEG];
+		pRow[isFirst ? JNIBWA_STATS_SEED_EXTEND_CPU : JNIBWA_STATS_PAIR_FORMAT_CPU] +=
+				stats_cpuNs() - pRow[STATS_SLOT_CPU_BEG];
+	}
+}
+
+size_t stats_exportSize( int nThreads ) {
+	if ( nThreads < 1 ) nThreads = 1;
+	return (1 + JNIBWA_STATS_N_STAGES + nThreads*JNIBWA_STATS_N_COLS)*sizeof(int64_t);
+}
+
+void stats_init( jnibwa_stats_t* pStats, int nThreads ) {
+	if ( nThreads < 1 ) nThreads = 1;
+	pStats->obs.onFor = stats_onFor;
+	pStats->obs.onSlot = stats_onSlot;
+	pStats->nThreads = nThreads;
+	pStats->nFors = 0;
+	memset(pStats->stageNs, 0, sizeof(pStats->stageNs));
+	pStats->lastForEndNs = 0;
+	pStats->pRows = calloc(nThreads*STATS_ROW_STRIDE, sizeof(int64_t));
+}
+
+void stats_export( jnibwa_stats_t* pStats, int64_t* pOut ) {
+	*pOut++ = pStats->nThreads;
+	memcpy(pOut, pStats->stageNs, sizeof(pStats->stageNs));
+	pOut += JNIBWA_STATS_N_STAGES;
+	int tid;
+	for ( tid = 0; tid < pStats->nThreads; ++tid ) {
+		memcpy(pOut, pStats->pRows + tid*STATS_ROW_STRIDE, JNIBWA_STATS_N_COLS*sizeof(int64_t));
+		pOut += JNIBWA_STATS_N_COLS;
+	}
+}
+
+void stats_destroy( jnibwa_stats_t* pStats ) {
+	free(pStats->pRows);
+	pStats->pRows = 0;
+}
+
+// The counters come from bwa functions that are called from one of bwa's object files into another, which
+// the linker lets us intercept (with --wrap, on Linux).  They're counted only while stats are being collected
+// for the batch, i.e., when the calling thread has a stats observer.
+// --wrap can't see a call that stays within an object file:  bwt_smem1 (which seeds the first pass) calls
+// bwt_smem1a within bwt.o, so we wrap them both, and each SMEM search is counted once, by whichever of them
+// bwamem.o called.
+#ifdef JNIBWA_WRAP_BWA
+
+int __real_bwt_smem1( const bwt_t* bwt, int len, const uint8_t* q, int x, int min_intv, bwtintv_v* mem,
+						bwtintv_v* tmpvec[2] );
+int __real_bwt_smem1a( const bwt_t* bwt, int len, const uint8_t* q, int x, int min_intv, uint64_t max_intv,
+						bwtintv_v* mem, bwtintv_v* tmpvec[2] );
+bwtint_t __real_bwt_sa( const bwt_t* bwt, bwtint_t k );
+int __real_ksw_extend2( int qlen, const uint8_t* query, int tlen, const uint8_t* target, int m, const int8_t* mat,
+						int o_del, int e_del, int o_ins, int e_ins, int w, int end_bonus, int zdrop, int h0,
+						int* qle, int* tle, int* gtle, int* gscore, int* max_off );
+kswr_t __real_ksw_align2( int qlen, uint8_t* query, int tlen, uint8_t* target, int m, const int8_t* mat,
+						int o_del, int e_del, int o_ins, int e_ins, int xtra, kswq_t** qry );
+
+int __wrap_bwt_smem1( const bwt_t* bwt, int len, const uint8_t* q, int x, int min_intv, bwtintv_v* mem,
+						bwtintv_v* tmpvec[2] ) {
+	jnibwa_stats_t* pStats = (jnibwa_stats_t*)pool_getObserver();
+	if ( pStats ) stats_add(pStats, JNIBWA_STATS_SMEM_SEARCHES, 1);
+	return __real_bwt_smem1(bwt, len, q, x, min_intv, mem, tmpvec);
+}
+
+int __wrap_bwt_smem1a( const bwt_t* bwt, int len, const uint8_t* q, int x, int min_intv, uint64_t max_intv,
+						bwtintv_v* mem, bwtintv_v* tmpvec[2] ) {
+	jnibwa_stats_t* pStats = (jnibwa_stats_t*)pool_getObserver();
+	if ( pStats ) stats_add(pStats, JNIBWA_STATS_SMEM_SEARCHES, 1);
+	return __real_bwt_smem1a(bwt, len, q, x, min_intv, max_intv, mem, tmpvec);
+}
+
+bwtint_t __wrap_bwt_sa( const bwt_t* bwt, bwtint_t k ) {
+	jnibwa_stats_t* pStats = (jnibwa_stats_t*)pool_getObserver();
+	if ( pStats ) stats_add(pStats, JNIBWA_STATS_SEEDS, 1);
+	return __real_bwt_sa(bwt, k);
+}
+
+int __wrap_ksw_extend2( int qlen, const uint8_t* query, int tlen, const uint8_t* target, int m, const int8_t* mat,
+						int o_del, int e_del, int o_ins, int e_ins, int w, int end_bonus, int zdrop, int h0,
+						int* qle, int* tle, int* gtle, int* gscore, int* max_off ) {
+	jnibwa_stats_t* pStats = (jnibwa_stats_t*)pool_getObserver();
+	if ( pStats ) {
+		stats_add(pStats, JNIBWA_STATS_EXTENSIONS, 1);
+		stats_add(pStats, JNIBWA_STATS_SW_CELLS, (int64_t)qlen*tlen);
+	}
+	return __real_ksw_extend2(qlen, query, tlen, target, m, mat, o_del, e_del, o_ins, e_ins, w, end_bonus, zdrop, h0,
+								qle, tle, gtle, gscore, max_off);
+}
+
+kswr_t __wrap_ksw_align2( int qlen, uint8_t* query, int tlen, uint8_t* target, int m, const int8_t* mat,
+						int o_del, int e_del, int o_ins, int e_ins, int xtra, kswq_t** qry ) {
+	jnibwa_stats_t* pStats = (jnibwa_stats_t*)pool_getObserver();
+	if ( pStats ) stats_add(pStats, JNIBWA_STATS_MATE_RESCUES, 1);
+	return __real_ksw_align2(qlen, query, tlen, target, m, mat, o_del, e_del, o_ins, e_ins, xtra, qry);
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * stats.h
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pool.h"
+
+// Timings and counters for one batch of alignments, exported as an array of int64_t:
+//   the number of threads, N
+//   JNIBWA_STATS_N_STAGES wall-clock times (ns) for the batch as a whole
+//   N rows of JNIBWA_STATS_N_COLS per-thread values
+// mem_process_seqs makes two kt_for calls:  the first finds seeds, chains them, and extends them, and the
+// second pairs the reads (with mate rescue) and generates the records.  Between the two, it infers the
+// pair-end stats.  That's what the stages are.
+#define JNIBWA_STATS_PARSE 0         // unpacking the sequences (and finding duplicates and cached results)
+#define JNIBWA_STATS_SEED_EXTEND 1   // the first kt_for
+#define JNIBWA_STATS_PESTAT 2        // between the kt_for calls
+#define JNIBWA_STATS_PAIR_FORMAT 3   // the second kt_for
+#define JNIBWA_STATS_TOTAL 4
+#define JNIBWA_STATS_N_STAGES 5
+
+#define JNIBWA_STATS_SEED_EXTEND_WALL 0 // time spent working slots of the first kt_for
+#define JNIBWA_STATS_SEED_EXTEND_CPU 1
+#define JNIBWA_STATS_PAIR_FORMAT_WALL 2 // time spent working slots of the second kt_for
+#define JNIBWA_STATS_PAIR_FORMAT_CPU 3
+#define JNIBWA_STATS_FORMAT_WALL 4      // time spent in our formatter (a part of the second kt_for)
+#define JNIBWA_STATS_COPY_WALL 5        // time spent copying results into the arena (also part of the second)
+#define JNIBWA_STATS_SMEM_SEARCHES 6    // calls to bwt_smem1 and bwt_smem1a
+#define JNIBWA_STATS_SEEDS 7            // seed positions looked up in the suffix array
+#define JNIBWA_STATS_EXTENSIONS 8       // banded Smith-Waterman extensions (ksw_extend2)
+#define JNIBWA_STATS_SW_CELLS 9         // query length times target length, summed over the extensions
+#define JNIBWA_STATS_MATE_RESCUES 10    // Smith-Waterman alignments attempted to rescue a mate (ksw_align2)
+#define JNIBWA_STATS_RECORDS 11         // alignment records generated
+#define JNIBWA_STATS_N_COLS 12
+
+// each thread's row is padded to keep threads from sharing cache lines
+#define STATS_ROW_STRIDE 16
+#define STATS_SLOT_WALL_BEG 14
+#define STATS_SLOT_CPU_BEG 15
+
+typedef struct {
+	pool_observer_t obs; // must be first:  the observer that pool threads find is the stats
+	int nThreads;
+	int nFors;
+	int64_t stageNs[JNIBWA_STATS_N_STAGES];
+	int64_t lastForEndNs;
+	int64_t* pRows;
+} jnibwa_stats_t;
+
+size_t stats_exportSize( int nThreads );
+void stats_init( jnibwa_stats_t* pStats, int nThreads );
+void stats_export( jnibwa_stats_t* pStats, int64_t* pOut );
+void stats_destroy( jnibwa_stats_t* pStats );
+int64_t stats_nowNs( void );
+
+// adds to a per-thread value for the calling thread
+static inline void stats_add( jnibwa_stats_t* pStats, int col, int64_t val ) {
+	int tid = pool_getSlot();
+	if ( tid < pStats->nThreads ) pStats->pRows[tid*STATS_ROW_STRIDE + col] += val;
+}
+
+#endif /* STATS_H_ */
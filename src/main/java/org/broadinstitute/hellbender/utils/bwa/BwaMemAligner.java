@@ -2,9 +2,14 @@ package org.broadinstitute.hellbender.utils.bwa;
 
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
+import java.nio.IntBuffer;
 import java.util.ArrayList;
 import java.util.Arrays;
+import java.util.Collection;
 import java.util.List;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.Executor;
+import java.util.concurrent.ForkJoinPool;
 import java.util.function.Function;
 
 /**
@@ -21,7 +26,24 @@ public final class BwaMemAligner implements AutoCloseable {
     private final BwaMemIndex index;
     private ByteBuffer opts;
 
-    private BwaMemPairEndStats pairEndStats;
+    private BwaMemPairEndStatsByOrientation pairEndStats; // null to have bwa infer them for each batch
+    private boolean packSeqs; // whether to hand the sequences to bwa 2 bits per base rather than as ASCII
+    private boolean dedupSeqs; // whether to align exact duplicates within a batch just once
+    private ByteBuffer resultsBuf; // reusable direct buffer for alignSeqs results, or null to let bwa allocate one
+    private ByteBuffer lentBuf; // the results buffer that a batch still open holds, or null
+    private boolean collectStats;
+    private BwaMemBatchStats lastBatchStats;
+    private int lastNPairsExamined; // by the most recent estimatePairEndStats
+
+    // maps an ASCII base call to bwa's 0-4 code for A, C, G, T, and N (or any other ambiguity code)
+    private static final byte[] BASE_CODES = new byte[256];
+    static {
+        Arrays.fill(BASE_CODES, (byte)4);
+        BASE_CODES['A'] = BASE_CODES['a'] = 0;
+        BASE_CODES['C'] = BASE_CODES['c'] = 1;
+        BASE_CODES['G'] = BASE_CODES['g'] = 2;
+        BASE_CODES['T'] = BASE_CODES['t'] = 3;
+    }
 
     public BwaMemAligner( final BwaMemIndex index ) {
         this.index = index;
@@ -158,17 +180,152 @@ public final class BwaMemAligner implements AutoCloseable {
      * that information is not-available.
      */
     public void dontInferPairEndStats() {
-        pairEndStats = BwaMemPairEndStats.DO_NOT_INFER;
+        pairEndStats = BwaMemPairEndStatsByOrientation.NONE;
     }
 
     /**
-     * Indicate the pair-end inter size stats for "properly" oriented read-pairs.
+     * Indicate the pair-end inter size stats for "properly" oriented (i.e., FR) read-pairs.
+     * Pairs in the other orientations won't be considered proper.
      * @param stats
      */
     public void setProperPairEndStats(final BwaMemPairEndStats stats) {
+        pairEndStats = stats == null ? null : BwaMemPairEndStatsByOrientation.forFRPairs(stats);
+    }
+
+    /**
+     * Indicate the pair-end insert size stats for each orientation, e.g., for a mate-pair or RF library,
+     * or as returned by {@link #estimatePairEndStats}.  Pass null to have bwa infer them for each batch.
+     */
+    public void setPairEndStats( final BwaMemPairEndStatsByOrientation stats ) {
         pairEndStats = stats;
     }
 
+    /** the stats set by one of the methods above, or null if bwa is to infer them for each batch */
+    public BwaMemPairEndStatsByOrientation getPairEndStats() { return pairEndStats; }
+
+    /**
+     * Infers the pair-end insert size stats for a sample of read pairs, just as bwa would for a batch,
+     * using the current option settings (including the number of threads).
+     * Estimate them once on a decent sample (a few thousand pairs is plenty), hand the result to
+     * {@link #setPairEndStats}, and bwa needn't infer them for every batch, and every batch (and every partition,
+     * if each uses the same sample) is aligned with the same stats.
+     * The reads are only seeded and extended, so this costs a good deal less than aligning them.
+     * @param iterable Read pairs, with mates adjacent (a trailing unpaired read is ignored).
+     * @param func A lambda that picks the sequence out of your read-like thing.
+     * @param maxPairs If positive, no more than this many pairs, spread evenly over the input, are examined.
+     *                 The others are skipped without being handed to func.
+     * @param <T> The read-like thing.
+     * @return The stats for each orientation.  Orientations with too few pairs to go on are marked failed.
+     *          (See {@link #getLastNPairsExamined} for the size of the sample.)
+     */
+    public <T> BwaMemPairEndStatsByOrientation estimatePairEndStats( final Iterable<T> iterable,
+                                                                     final Function<T,byte[]> func,
+                                                                     final int maxPairs ) {
+        final ByteBuffer contigBuf = encode(maxPairs > 0 ? samplePairs(iterable, maxPairs) : iterable, func);
+        final int[] nPairsExamined = new int[1];
+        index.refIndex();
+        try {
+            final BwaMemPairEndStatsByOrientation stats =
+                    index.inferPairEndStats(contigBuf, getSeqsFormat(), getOpts(), maxPairs, nPairsExamined);
+            lastNPairsExamined = nPairsExamined[0];
+            return stats;
+        }
+        finally {
+            index.deRefIndex();
+        }
+    }
+
+    /** the number of pairs the most recent call to estimatePairEndStats examined */
+    public int getLastNPairsExamined() { return lastNPairsExamined; }
+
+    // picks maxPairs pairs spread evenly over the input, just as the native code would pick them from all the
+    // pairs, so that only the sample is encoded
+    private static <T> Iterable<T> samplePairs( final Iterable<T> iterable, final int maxPairs ) {
+        int nReads = 0;
+        if ( iterable instanceof Collection ) {
+            nReads = ((Collection<?>)iterable).size();
+        } else {
+            for ( final T ele : iterable ) nReads += 1;
+        }
+        final int nPairs = nReads / 2;
+        if ( nPairs <= maxPairs ) return iterable;
+        final List<T> sample = new ArrayList<>(2*maxPairs);
+        int nSampled = 0;
+        long nextPair = 0; // the index of the next pair to sample
+        int readIdx = 0;
+        for ( final T ele : iterable ) {
+            if ( readIdx >> 1 == nextPair ) {
+                sample.add(ele);
+                if ( (readIdx & 1) != 0 ) {
+                    if ( ++nSampled == maxPairs ) break;
+                    nextPair = (long)nSampled * nPairs / maxPairs;
+                }
+            }
+            readIdx += 1;
+        }
+        return sample;
+    }
+
+    /** examines all the pairs */
+    public <T> BwaMemPairEndStatsByOrientation estimatePairEndStats( final Iterable<T> iterable,
+                                                                     final Function<T,byte[]> func ) {
+        return estimatePairEndStats(iterable, func, 0);
+    }
+
+    public BwaMemPairEndStatsByOrientation estimatePairEndStats( final List<byte[]> sequences ) {
+        return estimatePairEndStats(sequences, seq -> seq, 0);
+    }
+
+    /**
+     * Pack the sequences 2 bits to the base (with a separate mask for Ns) when handing them to bwa, rather
+     * than sending them as ASCII text.  The native input buffer is 4x smaller, and bwa can skip scanning for the
+     * end of each sequence and translating each base.
+     */
+    public void setPackedSeqsInput( final boolean packSeqs ) { this.packSeqs = packSeqs; }
+    public boolean isPackedSeqsInput() { return packSeqs; }
+
+    /**
+     * Align each distinct sequence in a batch just once, and hand its alignments to all its exact duplicates.
+     * When aligning pairs, it's pairs that must be identical (both mates), since a read's alignment depends on its
+     * mate.  This pays off for amplicon panels, PCR-heavy libraries, and repeatedly realigned contigs.  The results
+     * are just what you'd get otherwise, except that where bwa breaks ties among equally good alignments at random
+     * (seeded by the read's position in the batch), duplicates all get the same pick, and that pair-end stats
+     * inferred for the batch come from the distinct pairs only.
+     * Ignored by {@link #alignSeqsToBam}, since named reads are never duplicates.
+     */
+    public void setDedupSeqs( final boolean dedupSeqs ) { this.dedupSeqs = dedupSeqs; }
+    public boolean isDedupSeqs() { return dedupSeqs; }
+
+    /**
+     * Supply a direct ByteBuffer into which alignSeqs will write its raw results, so that aligning a batch
+     * needn't allocate any native memory for them.  The buffer is reused for each batch.
+     * If a batch's results don't fit, they're returned in native memory as usual, and the buffer is
+     * replaced by a larger one (which getResultsBuffer will return) for the next batch.
+     * Pass null to go back to having a new buffer allocated for each batch.
+     * Asynchronous alignments (alignSeqsAsync) always allocate their own buffer.
+     */
+    public void setResultsBuffer( final ByteBuffer resultsBuf ) {
+        if ( resultsBuf != null && !resultsBuf.isDirect() ) {
+            throw new IllegalArgumentException("The results buffer must be a direct ByteBuffer.");
+        }
+        this.resultsBuf = resultsBuf;
+    }
+    public ByteBuffer getResultsBuffer() { return resultsBuf; }
+
+    /**
+     * Turn on (or off) the collection of timings and counters for each batch aligned by alignSeqs.
+     * It's cheap, but not free:  there's a clock read or two for each alignment record.
+     * Stats aren't collected for asynchronous alignments (alignSeqsAsync).
+     */
+    public void setCollectStats( final boolean collectStats ) {
+        this.collectStats = collectStats;
+        if ( !collectStats ) lastBatchStats = null;
+    }
+    public boolean isCollectStats() { return collectStats; }
+
+    /** timings and counters for the most recent batch aligned by alignSeqs, or null if they weren't collected */
+    public BwaMemBatchStats getLastBatchStats() { return lastBatchStats; }
+
     public BwaMemIndex getIndex() {
         return index;
     }
@@ -190,31 +347,325 @@ public final class BwaMemAligner implements AutoCloseable {
      * @return A list of (possibly multiple) alignments for each input sequence.
      */
     public <T> List<List<BwaMemAlignment>> alignSeqs( final Iterable<T> iterable, final Function<T,byte[]> func ) {
+        final ByteBuffer contigBuf = encode(iterable, func);
+        final ByteBuffer alignsBuf = align(contigBuf);
+        try {
+            return decodeAlignments(alignsBuf, contigBuf.getInt(0));
+        }
+        finally {
+            releaseAlignments(alignsBuf);
+        }
+    }
+
+    /**
+     * Like {@link #alignSeqs(Iterable, Function)}, but the results are left undecoded in native memory, and you
+     * pick out just the parts you need through a {@link BwaMemAlignmentView}.
+     * Close the batch when you're done with it.
+     * If you've supplied a results buffer (see {@link #setResultsBuffer}), the batch uses it until it's closed,
+     * and other batches aligned in the meantime allocate their own.
+     * @param iterable An iterable over something like a read, that contains a sequence.
+     * @param func A lambda that picks the sequence out of your read-like thing.
+     * @param <T> The read-like thing.
+     * @return The alignments for each input sequence, in input order.
+     */
+    public <T> BwaMemAlignmentBatch alignSeqsLazily( final Iterable<T> iterable, final Function<T,byte[]> func ) {
+        final ByteBuffer contigBuf = encode(iterable, func);
+        final ByteBuffer alignsBuf = align(contigBuf);
+        final boolean isResultsBuf = alignsBuf == resultsBuf;
+        if ( isResultsBuf ) {
+            lentBuf = alignsBuf;
+        }
+        return new BwaMemAlignmentBatch(this, alignsBuf, isResultsBuf, contigBuf.getInt(0));
+    }
+
+    public BwaMemAlignmentBatch alignSeqsLazily( final List<byte[]> sequences ) {
+        return alignSeqsLazily(sequences, seq -> seq);
+    }
+
+    /**
+     * Like {@link #alignSeqsLazily(Iterable, Function)}, but the alignments are laid out as parallel columns (one
+     * for the flags, one for the reference IDs, and so on), so that whole columns can be copied or scanned at once,
+     * and any alignment can be picked out directly.
+     * Close the columns when you're done with them.  The results buffer (see {@link #setResultsBuffer}) is used
+     * as it would be by {@link #alignSeqsLazily}.
+     * @param iterable An iterable over something like a read, that contains a sequence.
+     * @param func A lambda that picks the sequence out of your read-like thing.
+     * @param <T> The read-like thing.
+     * @return The alignments for each input sequence, in input order.
+     */
+    public <T> BwaMemAlignmentColumns alignSeqsToColumns( final Iterable<T> iterable, final Function<T,byte[]> func ) {
+        final ByteBuffer contigBuf = encode(iterable, func);
+        final ByteBuffer alignsBuf = align(contigBuf, getSeqsFormat(), BwaMemIndex.OUTPUT_COLUMNS);
+        final boolean isResultsBuf = alignsBuf == resultsBuf;
+        if ( isResultsBuf ) {
+            lentBuf = alignsBuf;
+        }
+        return new BwaMemAlignmentColumns(this, alignsBuf, isResultsBuf);
+    }
+
+    public BwaMemAlignmentColumns alignSeqsToColumns( final List<byte[]> sequences ) {
+        return alignSeqsToColumns(sequences, seq -> seq);
+    }
+
+    /**
+     * Aligns reads, and returns the alignments as BAM records (uncompressed, exactly as they'd appear in a BAM file),
+     * so that they can be written straight to a BGZF stream.  The records are just like the ones bwa mem would write
+     * as SAM text:  supplementary alignments are hard-clipped, secondary alignments have no bases or qualities, and
+     * the tags are NM, MD, MC, AS, XS, and XA.  Reference IDs are bwa's contig indices.
+     * Close the records when you're done with them.  The results buffer (see {@link #setResultsBuffer}) is used
+     * as it would be by {@link #alignSeqsLazily}.
+     * @param iterable An iterable over something like a read.
+     * @param nameFunc A lambda that picks out the read name as ASCII (or returns null, if there isn't one).
+     * @param seqFunc A lambda that picks out the base calls.
+     * @param qualFunc A lambda that picks out the base qualities, phred+33 as in a FASTQ (or returns null).
+     * @param <T> The read-like thing.
+     * @return The BAM records for each input read, in input order.
+     */
+    public <T> BwaMemBamRecords alignSeqsToBam( final Iterable<T> iterable, final Function<T,byte[]> nameFunc,
+                                                final Function<T,byte[]> seqFunc, final Function<T,byte[]> qualFunc ) {
+        final ByteBuffer contigBuf = encodeNamedSeqs(iterable, nameFunc, seqFunc, qualFunc);
+        final ByteBuffer alignsBuf = align(contigBuf, BwaMemIndex.SEQS_NAMED, BwaMemIndex.OUTPUT_BAM);
+        final boolean isResultsBuf = alignsBuf == resultsBuf;
+        if ( isResultsBuf ) {
+            lentBuf = alignsBuf;
+        }
+        return new BwaMemBamRecords(this, alignsBuf, isResultsBuf, contigBuf.getInt(0));
+    }
+
+    /**
+     * Aligns reads, and returns just the primary alignment for each, which is much cheaper than
+     * {@link #alignSeqs(Iterable, Function)} when that's all you want:  bwa makes no XA hits or secondary
+     * alignments, and the native layer hands back a small fixed-size record for each read (with no supplementary
+     * alignments, MD, or XA), so there's much less to decode.
+     * The primary alignments are just the ones alignSeqs would return first, except that they have no MD or XA
+     * tags (and any XA hits wouldn't have counted toward the number of secondary alignments in the options).
+     * @param iterable An iterable over something like a read, that contains a sequence.
+     * @param func A lambda that picks the sequence out of your read-like thing.
+     * @param <T> The read-like thing.
+     * @return The primary alignment for each input sequence (which may be unmapped), in input order.
+     */
+    public <T> List<BwaMemAlignment> alignSeqsPrimary( final Iterable<T> iterable, final Function<T,byte[]> func ) {
+        final ByteBuffer contigBuf = encode(iterable, func);
+        final ByteBuffer alignsBuf = align(contigBuf, getSeqsFormat(), BwaMemIndex.OUTPUT_PRIMARY);
+        try {
+            return decodePrimaryAlignments(alignsBuf, contigBuf.getInt(0));
+        }
+        finally {
+            releaseAlignments(alignsBuf);
+        }
+    }
+
+    public List<BwaMemAlignment> alignSeqsPrimary( final List<byte[]> sequences ) {
+        return alignSeqsPrimary(sequences, seq -> seq);
+    }
+
+    // alignSeqs is encode, align, decodeAlignments, and releaseAlignments.
+    // the steps are separately accessible so that they can be benchmarked separately.
+
+    /** packs sequences into a buffer in the form that align expects */
+    <T> ByteBuffer encode( final Iterable<T> iterable, final Function<T,byte[]> func ) {
+        return packSeqs ? encodePackedSeqs(iterable, func) : encodeSeqs(iterable, func);
+    }
+
+    /** aligns encoded sequences, and returns the raw results, which must be handed to releaseAlignments */
+    ByteBuffer align( final ByteBuffer contigBuf ) {
+        return align(contigBuf, getSeqsFormat(), BwaMemIndex.OUTPUT_BAMISH);
+    }
+
+    private ByteBuffer align( final ByteBuffer contigBuf, final int seqsFormat, final int outputFormat ) {
         final ByteBuffer tmpOpts = getOpts();
+        final ByteBuffer statsBuf =
+                collectStats ? ByteBuffer.allocateDirect(BwaMemBatchStats.bufferSize(getNThreadsOption())) : null;
+        lastBatchStats = null;
         index.refIndex(); // tell the index that we're doing some aligning so that it can't be closed
         final ByteBuffer alignsBuf;
-        int nSequences = 0;
         try {
-            int bufferCapacity = 4; // buffer will have a 4-byte sequence count as it's first element
-            for ( final T ele : iterable ) {
-                nSequences += 1;
-                bufferCapacity += func.apply(ele).length + 1; // sequence length bytes + 1 for the trailing null
-            }
-            final ByteBuffer contigBuf = ByteBuffer.allocateDirect(bufferCapacity);
-            contigBuf.order(ByteOrder.nativeOrder());
-            contigBuf.putInt(nSequences);
-            for ( final T ele : iterable ) {
-                contigBuf.put(func.apply(ele)).put((byte) 0);
-            }
-            contigBuf.flip();
-            alignsBuf = index.doAlignment(contigBuf, tmpOpts, pairEndStats);
+            alignsBuf = index.doAlignment(contigBuf, seqsFormat, outputFormat, getJobFlags(), tmpOpts, pairEndStats,
+                                            resultsBuf == lentBuf ? null : resultsBuf, statsBuf);
         }
         finally {
             index.deRefIndex();
         }
+        if ( statsBuf != null ) {
+            lastBatchStats = new BwaMemBatchStats(statsBuf);
+        }
+        return alignsBuf;
+    }
+
+    /** frees the raw results, unless they're in our reusable buffer */
+    void releaseAlignments( final ByteBuffer alignsBuf ) {
+        if ( alignsBuf == resultsBuf ) {
+            return;
+        }
+        BwaMemIndex.destroyByteBuffer(alignsBuf);
+        growResultsBuffer(alignsBuf.capacity());
+    }
+
+    /** grows the reusable results buffer, if there is one, when results of the given size didn't fit in it */
+    void growResultsBuffer( final int needed ) {
+        if ( resultsBuf != null && needed > resultsBuf.capacity() ) {
+            // it was too small:  grow it, with a little headroom, for next time
+            resultsBuf = ByteBuffer.allocateDirect(needed + needed/4);
+        }
+    }
+
+    /**
+     * takes back the results buffer from a closed BwaMemAlignmentBatch:  it's matched against the buffer that was
+     * lent, because resultsBuf may have grown (and been replaced) in the meantime
+     */
+    void returnResultsBuffer( final ByteBuffer alignsBuf ) {
+        if ( alignsBuf == lentBuf ) {
+            lentBuf = null;
+        }
+    }
+
+    /**
+     * Like {@link #alignSeqs(Iterable, Function)}, but returns right away.
+     * The alignment is done by the native thread pool (see {@link BwaMemIndex#configureThreadPool}), and the
+     * results are decoded into the returned future by the common fork-join pool.
+     * So a single thread can keep several batches in flight.
+     * The current option settings and pair-end stats apply:  you're free to change them for the next batch
+     * as soon as this method returns.
+     * @param iterable An iterable over something like a read, that contains a sequence.
+     * @param func A lambda that picks the sequence out of your read-like thing.
+     * @param <T> The read-like thing.
+     * @return A future list of (possibly multiple) alignments for each input sequence.
+     */
+    public <T> CompletableFuture<List<List<BwaMemAlignment>>> alignSeqsAsync( final Iterable<T> iterable,
+                                                                              final Function<T,byte[]> func ) {
+        return alignSeqsAsync(iterable, func, ForkJoinPool.commonPool());
+    }
+
+    /**
+     * Like {@link #alignSeqsAsync(Iterable, Function)}, but the results are decoded by the executor you supply.
+     * (The thread that collects finished batches from the native pool just hands them on, so that decoding one
+     * batch never holds up the others.)
+     * @param iterable An iterable over something like a read, that contains a sequence.
+     * @param func A lambda that picks the sequence out of your read-like thing.
+     * @param decoder Where to run the decoding of the results.
+     * @param <T> The read-like thing.
+     * @return A future list of (possibly multiple) alignments for each input sequence.
+     */
+    public <T> CompletableFuture<List<List<BwaMemAlignment>>> alignSeqsAsync( final Iterable<T> iterable,
+                                                                              final Function<T,byte[]> func,
+                                                                              final Executor decoder ) {
+        final ByteBuffer tmpOpts = getOpts();
+        final ByteBuffer contigBuf = encode(iterable, func);
+        final int nSequences = contigBuf.getInt(0);
+        return index.doAlignmentAsync(contigBuf, getSeqsFormat(), BwaMemIndex.OUTPUT_BAMISH, getJobFlags(), tmpOpts,
+                                        pairEndStats)
+                .thenApplyAsync(alignsBuf -> {
+                    try {
+                        return decodeAlignments(alignsBuf, nSequences);
+                    }
+                    finally {
+                        BwaMemIndex.destroyByteBuffer(alignsBuf);
+                    }
+                }, decoder);
+    }
+
+    private static <T> ByteBuffer encodeSeqs( final Iterable<T> iterable, final Function<T,byte[]> func ) {
+        int nSequences = 0;
+        int bufferCapacity = 4; // buffer will have a 4-byte sequence count as it's first element
+        for ( final T ele : iterable ) {
+            nSequences += 1;
+            bufferCapacity += func.apply(ele).length + 1; // sequence length bytes + 1 for the trailing null
+        }
+        final ByteBuffer contigBuf = ByteBuffer.allocateDirect(bufferCapacity);
+        contigBuf.order(ByteOrder.nativeOrder());
+        contigBuf.putInt(nSequences);
+        for ( final T ele : iterable ) {
+            contigBuf.put(func.apply(ele)).put((byte) 0);
+        }
+        contigBuf.flip();
+        return contigBuf;
+    }
+
+    private static <T> ByteBuffer encodeNamedSeqs( final Iterable<T> iterable, final Function<T,byte[]> nameFunc,
+                                                   final Function<T,byte[]> seqFunc, final Function<T,byte[]> qualFunc ) {
+        int nSequences = 0;
+        int bufferCapacity = 4; // buffer will have a 4-byte sequence count as it's first element
+        for ( final T ele : iterable ) {
+            nSequences += 1;
+            final byte[] name = nameFunc.apply(ele);
+            final byte[] quals = qualFunc.apply(ele);
+            // each of name, sequence, and quals is followed by a null
+            bufferCapacity += (name == null ? 0 : name.length) + seqFunc.apply(ele).length +
+                                (quals == null ? 0 : quals.length) + 3;
+        }
+        final ByteBuffer contigBuf = ByteBuffer.allocateDirect(bufferCapacity);
+        contigBuf.order(ByteOrder.nativeOrder());
+        contigBuf.putInt(nSequences);
+        for ( final T ele : iterable ) {
+            final byte[] name = nameFunc.apply(ele);
+            final byte[] seq = seqFunc.apply(ele);
+            final byte[] quals = qualFunc.apply(ele);
+            if ( quals != null && quals.length != 0 && quals.length != seq.length ) {
+                throw new IllegalArgumentException("There are " + quals.length + " base qualities for " +
+                                                    seq.length + " bases.");
+            }
+            if ( name != null ) contigBuf.put(name);
+            contigBuf.put((byte)0).put(seq).put((byte)0);
+            if ( quals != null ) contigBuf.put(quals);
+            contigBuf.put((byte)0);
+        }
+        contigBuf.flip();
+        return contigBuf;
+    }
+
+    private int getSeqsFormat() { return packSeqs ? BwaMemIndex.SEQS_2BIT : BwaMemIndex.SEQS_ASCII; }
+
+    private int getJobFlags() { return dedupSeqs ? BwaMemIndex.JOB_DEDUP : 0; }
+
+    // each sequence is a 4-byte length, the bases packed 4 to a byte, a mask with a bit set for each N, and
+    // padding to keep things on a 4-byte boundary
+    private static int packedSeqSize( final int seqLen ) {
+        return 4 + ((((seqLen + 3) >> 2) + ((seqLen + 7) >> 3) + 3) & ~3);
+    }
+
+    private static <T> ByteBuffer encodePackedSeqs( final Iterable<T> iterable, final Function<T,byte[]> func ) {
+        int nSequences = 0;
+        int bufferCapacity = 4; // buffer will have a 4-byte sequence count as it's first element
+        for ( final T ele : iterable ) {
+            nSequences += 1;
+            bufferCapacity += packedSeqSize(func.apply(ele).length);
+        }
+        final ByteBuffer contigBuf = ByteBuffer.allocateDirect(bufferCapacity);
+        contigBuf.order(ByteOrder.nativeOrder());
+        contigBuf.putInt(nSequences);
+        for ( final T ele : iterable ) {
+            final byte[] seq = func.apply(ele);
+            final int seqLen = seq.length;
+            final int end = contigBuf.position() + packedSeqSize(seqLen);
+            contigBuf.putInt(seqLen);
+            for ( int idx = 0; idx < seqLen; idx += 4 ) {
+                int packed = 0;
+                for ( int bit = 0, lim = Math.min(4, seqLen - idx); bit < lim; ++bit ) {
+                    packed |= (BASE_CODES[seq[idx + bit] & 0xff] & 3) << (bit << 1);
+                }
+                contigBuf.put((byte)packed);
+            }
+            for ( int idx = 0; idx < seqLen; idx += 8 ) {
+                int mask = 0;
+                for ( int bit = 0, lim = Math.min(8, seqLen - idx); bit < lim; ++bit ) {
+                    if ( BASE_CODES[seq[idx + bit] & 0xff] == 4 ) mask |= 1 << bit;
+                }
+                contigBuf.put((byte)mask);
+            }
+            contigBuf.position(end);
+        }
+        contigBuf.flip();
+        return contigBuf;
+    }
+
+    static List<List<BwaMemAlignment>> decodeAlignments( final ByteBuffer alignsBuf, final int nSequences ) {
         alignsBuf.order(ByteOrder.nativeOrder()).position(0).limit(alignsBuf.capacity());
+        // the buffer begins with the offset of each sequence's results -- they're in no particular order
+        final int[] resultOffsets = new int[nSequences];
+        alignsBuf.asIntBuffer().get(resultOffsets);
         final List<List<BwaMemAlignment>> allAlignments = new ArrayList<>(nSequences);
-        while ( nSequences-- > 0 ) {
+        for ( final int resultOffset : resultOffsets ) {
+            alignsBuf.position(resultOffset);
             int nAligns = alignsBuf.getInt();
             final List<BwaMemAlignment> alignments = new ArrayList<>(nAligns);
             while ( nAligns-- > 0 ) {
@@ -306,11 +757,53 @@ public final class BwaMemAligner implements AutoCloseable {
             }
             allAlignments.add(alignments);
         }
-        BwaMemIndex.destroyByteBuffer(alignsBuf);
         return allAlignments;
     }
 
-    private String getTag( final ByteBuffer buffer ) {
+    // each record is 10 ints (see PrimaryAlignment in the JNI code), followed by the cigar ops
+    static List<BwaMemAlignment> decodePrimaryAlignments( final ByteBuffer alignsBuf, final int nSequences ) {
+        alignsBuf.order(ByteOrder.nativeOrder()).position(0).limit(alignsBuf.capacity());
+        final IntBuffer ints = alignsBuf.asIntBuffer();
+        final List<BwaMemAlignment> alignments = new ArrayList<>(nSequences);
+        final StringBuilder cigar = new StringBuilder();
+        for ( int seqIdx = 0; seqIdx != nSequences; ++seqIdx ) {
+            int idx = ints.get(seqIdx) / Integer.BYTES;
+            final int flag_mapQ = ints.get(idx);
+            final int refId = ints.get(idx + 1);
+            final int refStart = ints.get(idx + 2);
+            final int nMismatches = ints.get(idx + 3);
+            final int alignerScore = ints.get(idx + 4);
+            final int suboptimalScore = ints.get(idx + 5);
+            final int mateRefId = ints.get(idx + 6);
+            final int mateStartPos = ints.get(idx + 7);
+            final int templateLen = ints.get(idx + 8);
+            final int nCigarOps = ints.get(idx + 9);
+            idx += 10;
+            cigar.setLength(0);
+            int seqStart = -1;
+            int seqLen = 0;
+            int refLen = 0;
+            if ( refId >= 0 ) {
+                seqStart = 0;
+                for ( int opIdx = 0; opIdx != nCigarOps; ++opIdx ) {
+                    final int lenOp = ints.get(idx + opIdx);
+                    final int len = lenOp >>> 4;
+                    final char op = BwaMemAlignmentView.getCigarOpChar(lenOp);
+                    cigar.append(len).append(op);
+                    if ( op == 'S' && opIdx == 0 ) seqStart = len;
+                    if ( op == 'M' || op == 'D' ) refLen += len;
+                    if ( op == 'M' || op == 'I' ) seqLen += len;
+                }
+            }
+            alignments.add(new BwaMemAlignment(flag_mapQ >>> 16, refId, refStart, refId >= 0 ? refStart + refLen : -1,
+                    seqStart, refId >= 0 ? seqStart + seqLen : -1, flag_mapQ & 0xff,
+                    nMismatches, alignerScore, suboptimalScore, cigar.toString(), null, null,
+                    mateRefId, mateStartPos, templateLen));
+        }
+        return alignments;
+    }
+
+    private static String getTag( final ByteBuffer buffer ) {
         int tagLen = buffer.getInt();
         if ( tagLen == 0 ) return null;
         byte[] tagBytes = new byte[(tagLen+3)&~3];
@@ -0,0 +1,165 @@
+package org.broadinstitute.hellbender.utils.bwa;
+
+import java.util.ArrayDeque;
+import java.util.ArrayList;
+import java.util.Iterator;
+import java.util.List;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
+
+/**
+ * Aligns an unbounded stream of sequences, a chunk at a time, with bounded memory.
+ * Usage pattern:
+ *   Create a BwaMemAligner, and set your bwa-mem parameters
+ *   Create a BwaMemAlignerSession on the aligner
+ *   Push sequences, polling for results as they become available
+ *     (push refuses a sequence when the session is full:  poll some results, and push it again)
+ *   When the input is exhausted, call finish, and poll until there are no more results
+ *   Close the session
+ *
+ * Sequences are gathered into chunks just as the bwa command line does it:  a chunk is cut when it holds
+ * chunk_size*n_threads bases (see the ChunkSize and NThreads options), without splitting a pair when aligning
+ * pairs.  Each chunk is aligned asynchronously by the native thread pool, and, as with the bwa command line,
+ * pair-end stats are inferred separately for each chunk unless you've set them on the aligner.
+ * The aligner's options are captured when each chunk is cut, so changing them mid-stream affects only later chunks.
+ * Results are returned in the order in which the sequences were pushed:  one list of alignments per sequence.
+ *
+ * Like the aligner, this class is not thread-safe.
+ */
+public final class BwaMemAlignerSession implements AutoCloseable {
+    /** The default number of chunks that can be outstanding (in flight, or aligned but not yet polled). */
+    public static final int DEFAULT_MAX_CHUNKS = 2;
+
+    private final BwaMemAligner aligner;
+    private final int maxChunks;
+    private List<byte[]> currentChunk;
+    private long currentChunkBases;
+    private final ArrayDeque<CompletableFuture<List<List<BwaMemAlignment>>>> chunks;
+    private Iterator<List<BwaMemAlignment>> currentResults;
+    private boolean isFinished;
+
+    public BwaMemAlignerSession( final BwaMemAligner aligner ) {
+        this(aligner, DEFAULT_MAX_CHUNKS);
+    }
+
+    public BwaMemAlignerSession( final BwaMemAligner aligner, final int maxChunks ) {
+        if ( maxChunks < 1 ) {
+            throw new IllegalArgumentException("The maximum number of chunks must be positive.");
+        }
+        this.aligner = aligner;
+        this.maxChunks = maxChunks;
+        currentChunk = new ArrayList<>();
+        currentChunkBases = 0;
+        chunks = new ArrayDeque<>(maxChunks);
+        currentResults = null;
+        isFinished = false;
+    }
+
+    public BwaMemAligner getAligner() { return aligner; }
+    public int getMaxChunks() { return maxChunks; }
+
+    /**
+     * Add a sequence to the stream.
+     * @param sequence Base calls (ASCII 'A', 'C', 'G', or 'T').
+     * @return false if the session is full, in which case the sequence was not accepted:
+     *         poll some results, and push it again.
+     */
+    public boolean push( final byte[] sequence ) {
+        if ( isFinished ) {
+            throw new IllegalStateException("Can't push sequences after calling finish.");
+        }
+        if ( currentChunk.isEmpty() && !canSubmit() ) {
+            return false;
+        }
+        currentChunk.add(sequence);
+        currentChunkBases += sequence.length;
+        final boolean isPaired = (aligner.getFlagOption() & BwaMemAligner.MEM_F_PE) != 0;
+        final long chunkBases = (long)aligner.getChunkSizeOption() * Math.max(1, aligner.getNThreadsOption());
+        if ( currentChunkBases >= chunkBases && (!isPaired || (currentChunk.size() & 1) == 0) ) {
+            submitChunk();
+        }
+        return true;
+    }
+
+    /**
+     * Signal the end of the input:  any partial chunk is submitted for alignment.
+     */
+    public void finish() {
+        if ( !isFinished ) {
+            isFinished = true;
+            if ( !currentChunk.isEmpty() ) {
+                submitChunk();
+            }
+        }
+    }
+
+    /**
+     * Returns the alignments for the next sequence, if they're ready.
+     * @return The next sequence's alignments, or null if they're not available yet.
+     */
+    public List<BwaMemAlignment> poll() {
+        if ( currentResults == null || !currentResults.hasNext() ) {
+            final CompletableFuture<List<List<BwaMemAlignment>>> next = chunks.peekFirst();
+            if ( next == null || !next.isDone() ) {
+                return null;
+            }
+        }
+        return take();
+    }
+
+    /**
+     * Returns the alignments for the next sequence, waiting for them if necessary.
+     * @return The next sequence's alignments, or null if there are no more sequences outstanding.
+     *         (Sequences in a partial chunk aren't outstanding until the chunk is full, or until you call finish.)
+     */
+    public List<BwaMemAlignment> take() {
+        while ( currentResults == null || !currentResults.hasNext() ) {
+            final CompletableFuture<List<List<BwaMemAlignment>>> next = chunks.pollFirst();
+            if ( next == null ) {
+                currentResults = null;
+                return null;
+            }
+            try {
+                currentResults = next.get().iterator();
+            } catch ( final InterruptedException ie ) {
+                Thread.currentThread().interrupt();
+                throw new IllegalStateException("Interrupted while waiting for alignments.", ie);
+            } catch ( final ExecutionException ee ) {
+                throw new IllegalStateException("Alignment failed.", ee.getCause());
+            }
+        }
+        return currentResults.next();
+    }
+
+    /**
+     * @return true if every pushed sequence's results have been returned (and finish has been called).
+     */
+    public boolean isDone() {
+        return isFinished && currentChunk.isEmpty() && chunks.isEmpty() &&
+                (currentResults == null || !currentResults.hasNext());
+    }
+
+    /**
+     * Abandons any results that haven't been polled.
+     * Chunks that are still being aligned run to completion in the background.
+     */
+    @Override
+    public void close() {
+        isFinished = true;
+        currentChunk.clear();
+        chunks.clear();
+        currentResults = null;
+    }
+
+    // the chunk whose results are being returned still counts against the limit
+    private boolean canSubmit() {
+        final int nBusy = chunks.size() + (currentResults != null && currentResults.hasNext() ? 1 : 0);
+        return nBusy < maxChunks;
+    }
+
+    private void submitChunk() {
+        chunks.addLast(aligner.alignSeqsAsync(currentChunk, seq -> seq));
+        currentChunk = new ArrayList<>();
+        currentChunkBases = 0;
+    }
+}
@@ -0,0 +1,111 @@
+package org.broadinstitute.hellbender.utils.bwa;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.ArrayList;
+import java.util.List;
+
+/**
+ * The alignments for a batch of sequences, left in the native results buffer and decoded only as you ask for them.
+ * Get one from {@link BwaMemAligner#alignSeqsLazily}, look at the alignments through a
+ * {@link BwaMemAlignmentView}, and close it when you're done to release the buffer.
+ * <p>
+ *     A single view can be moved from alignment to alignment, so going through the whole batch needn't allocate
+ *     anything beyond the two small arrays that index the buffer.
+ * </p>
+ */
+public final class BwaMemAlignmentBatch implements AutoCloseable {
+    private final BwaMemAligner aligner;
+    private ByteBuffer alignsBuf;
+    private final boolean isResultsBuf; // whether alignsBuf is the aligner's reusable buffer, rather than native
+    private final int[] firstAlignment; // index into alignOffsets of each sequence's first alignment, plus an end
+    private final int[] alignOffsets;   // buffer offset of each alignment record
+
+    BwaMemAlignmentBatch( final BwaMemAligner aligner, final ByteBuffer alignsBuf, final boolean isResultsBuf,
+                          final int nSequences ) {
+        this.aligner = aligner;
+        this.alignsBuf = alignsBuf;
+        this.isResultsBuf = isResultsBuf;
+        alignsBuf.order(ByteOrder.nativeOrder()).position(0).limit(alignsBuf.capacity());
+        // the buffer begins with the offset of each sequence's results, and each result begins with a count
+        firstAlignment = new int[nSequences + 1];
+        int nAlignments = 0;
+        for ( int seqIdx = 0; seqIdx != nSequences; ++seqIdx ) {
+            firstAlignment[seqIdx] = nAlignments;
+            nAlignments += alignsBuf.getInt(alignsBuf.getInt(seqIdx * Integer.BYTES));
+        }
+        firstAlignment[nSequences] = nAlignments;
+        alignOffsets = new int[nAlignments];
+        int alignIdx = 0;
+        for ( int seqIdx = 0; seqIdx != nSequences; ++seqIdx ) {
+            int offset = alignsBuf.getInt(seqIdx * Integer.BYTES) + Integer.BYTES;
+            for ( int idx = firstAlignment[seqIdx]; idx != firstAlignment[seqIdx + 1]; ++idx ) {
+                alignOffsets[alignIdx++] = offset;
+                offset = BwaMemAlignmentView.recordEnd(alignsBuf, offset);
+            }
+        }
+    }
+
+    public int getNSequences() { return firstAlignment.length - 1; }
+
+    /** the total number of alignments for all the sequences */
+    public int getNAlignments() { return alignOffsets.length; }
+
+    /** the number of alignments for one of the sequences */
+    public int getNAlignments( final int seqIdx ) {
+        return firstAlignment[seqIdx + 1] - firstAlignment[seqIdx];
+    }
+
+    /** a view that isn't yet on any alignment:  position it with {@link BwaMemAlignmentView#moveTo} */
+    public BwaMemAlignmentView newView() { return new BwaMemAlignmentView(this); }
+
+    /** a new view of one of the alignments for one of the sequences */
+    public BwaMemAlignmentView getView( final int seqIdx, final int alignIdx ) {
+        return newView().moveTo(seqIdx, alignIdx);
+    }
+
+    /** decodes everything, just as {@link BwaMemAligner#alignSeqs} would have */
+    public List<List<BwaMemAlignment>> toAlignments() {
+        final BwaMemAlignmentView view = newView();
+        final int nSequences = getNSequences();
+        final List<List<BwaMemAlignment>> allAlignments = new ArrayList<>(nSequences);
+        for ( int seqIdx = 0; seqIdx != nSequences; ++seqIdx ) {
+            final int nAligns = getNAlignments(seqIdx);
+            final List<BwaMemAlignment> alignments = new ArrayList<>(nAligns);
+            for ( int alignIdx = 0; alignIdx != nAligns; ++alignIdx ) {
+                alignments.add(view.moveTo(seqIdx, alignIdx).toAlignment());
+            }
+            allAlignments.add(alignments);
+        }
+        return allAlignments;
+    }
+
+    public boolean isOpen() { return alignsBuf != null; }
+
+    /** releases the native results:  views of this batch are unusable afterwards */
+    @Override
+    public void close() {
+        if ( alignsBuf != null ) {
+            if ( isResultsBuf ) {
+                aligner.returnResultsBuffer(alignsBuf);
+            } else {
+                aligner.releaseAlignments(alignsBuf);
+            }
+            alignsBuf = null;
+        }
+    }
+
+    ByteBuffer getBuffer() {
+        if ( alignsBuf == null ) {
+            throw new IllegalStateException("The alignment batch has been closed.");
+        }
+        return alignsBuf;
+    }
+
+    int getRecordOffset( final int seqIdx, final int alignIdx ) {
+        if ( alignIdx < 0 || alignIdx >= getNAlignments(seqIdx) ) {
+            throw new IndexOutOfBoundsException("Sequence " + seqIdx + " has no alignment " + alignIdx);
+        }
+        return alignOffsets[firstAlignment[seqIdx] + alignIdx];
+    }
+}
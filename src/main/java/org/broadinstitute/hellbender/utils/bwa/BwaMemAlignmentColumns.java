@@ -0,0 +1,272 @@
+package org.broadinstitute.hellbender.utils.bwa;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.IntBuffer;
+import java.util.ArrayList;
+import java.util.List;
+
+/**
+ * The alignments for a batch of sequences, laid out in the native results buffer as parallel columns, with one
+ * element per alignment (each sequence's alignments together, and the sequences in input order).
+ * Get one from {@link BwaMemAligner#alignSeqsToColumns}, and close it when you're done to release the buffer.
+ * <p>
+ *     The columns are read-only views of the native buffer, so they can be bulk-copied or scanned without
+ *     decoding anything, and alignment i is just element i of each.  The cigar ops and the MD and XA tags are
+ *     packed end to end, and an alignment's share runs from its element of the offsets column to the next one.
+ *     Unmapped alignments have a reference ID and start of -1, zero NM and scores, and no cigar ops.  Alignments
+ *     without a mapped mate have a mate reference ID and start of -1, and a template length of 0.  A missing tag
+ *     is empty.  Views are unusable once the columns are closed.
+ * </p>
+ */
+public final class BwaMemAlignmentColumns implements AutoCloseable {
+    // the buffer starts with these counts, then the byte offset of each column (see columns.h)
+    private static final int N_SEQS = 0;
+    private static final int N_ALIGNS = 1;
+    private static final int N_CIGAR_OPS = 2;
+    private static final int N_MD_CHARS = 3;
+    private static final int N_XA_CHARS = 4;
+    private static final int HDR_COUNTS = 5;
+
+    private static final int COL_FIRST_ALIGN = 0;
+    private static final int COL_FLAG = 1;
+    private static final int COL_MAPQ = 2;
+    private static final int COL_REF_ID = 3;
+    private static final int COL_POS = 4;
+    private static final int COL_NM = 5;
+    private static final int COL_AS = 6;
+    private static final int COL_XS = 7;
+    private static final int COL_MATE_REF_ID = 8;
+    private static final int COL_MATE_POS = 9;
+    private static final int COL_TLEN = 10;
+    private static final int COL_CIGAR_OFF = 11;
+    private static final int COL_MD_OFF = 12;
+    private static final int COL_XA_OFF = 13;
+    private static final int COL_CIGAR = 14;
+    private static final int COL_MD = 15;
+    private static final int COL_XA = 16;
+
+    private static final int CIGAR_OP_M = 0;
+    private static final int CIGAR_OP_I = 1;
+    private static final int CIGAR_OP_D = 2;
+    private static final int CIGAR_OP_S = 4;
+
+    private final BwaMemAligner aligner;
+    private ByteBuffer alignsBuf;
+    private final boolean isResultsBuf; // whether alignsBuf is the aligner's reusable buffer, rather than native
+
+    BwaMemAlignmentColumns( final BwaMemAligner aligner, final ByteBuffer alignsBuf, final boolean isResultsBuf ) {
+        this.aligner = aligner;
+        this.alignsBuf = alignsBuf;
+        this.isResultsBuf = isResultsBuf;
+        alignsBuf.order(ByteOrder.nativeOrder()).position(0).limit(alignsBuf.capacity());
+    }
+
+    public int getNSequences() { return getBuffer().getInt(N_SEQS * Integer.BYTES); }
+
+    /** the total number of alignments for all the sequences */
+    public int getNAlignments() { return getBuffer().getInt(N_ALIGNS * Integer.BYTES); }
+
+    /** the number of alignments for one of the sequences */
+    public int getNAlignments( final int seqIdx ) {
+        return getFirstAlignment(seqIdx + 1) - getFirstAlignment(seqIdx);
+    }
+
+    /** the index in the columns of a sequence's first alignment (or, for getNSequences(), the end) */
+    public int getFirstAlignment( final int seqIdx ) {
+        if ( seqIdx < 0 || seqIdx > getNSequences() ) {
+            throw new IndexOutOfBoundsException("No sequence " + seqIdx);
+        }
+        return getInt(COL_FIRST_ALIGN, seqIdx);
+    }
+
+    /** getNSequences()+1 elements:  the index of each sequence's first alignment, and then the end */
+    public IntBuffer getFirstAlignments() { return intColumn(COL_FIRST_ALIGN, getNSequences() + 1); }
+
+    public IntBuffer getSamFlags() { return intColumn(COL_FLAG, getNAlignments()); }
+    public IntBuffer getMapQuals() { return intColumn(COL_MAPQ, getNAlignments()); }
+    public IntBuffer getRefIds() { return intColumn(COL_REF_ID, getNAlignments()); }
+    /** 0-based */
+    public IntBuffer getRefStarts() { return intColumn(COL_POS, getNAlignments()); }
+    public IntBuffer getNMismatches() { return intColumn(COL_NM, getNAlignments()); }
+    public IntBuffer getAlignerScores() { return intColumn(COL_AS, getNAlignments()); }
+    public IntBuffer getSuboptimalScores() { return intColumn(COL_XS, getNAlignments()); }
+    public IntBuffer getMateRefIds() { return intColumn(COL_MATE_REF_ID, getNAlignments()); }
+    public IntBuffer getMateRefStarts() { return intColumn(COL_MATE_POS, getNAlignments()); }
+    public IntBuffer getTemplateLens() { return intColumn(COL_TLEN, getNAlignments()); }
+
+    /** getNAlignments()+1 elements:  the index in {@link #getPackedCigars} of each alignment's first op */
+    public IntBuffer getCigarOffsets() { return intColumn(COL_CIGAR_OFF, getNAlignments() + 1); }
+
+    /** the cigar ops of all the alignments, packed as length &lt;&lt; 4 | op (with BAM op codes) */
+    public IntBuffer getPackedCigars() { return intColumn(COL_CIGAR, getCount(N_CIGAR_OPS)); }
+
+    /** getNAlignments()+1 elements:  the index in {@link #getMDChars} of each alignment's MD tag */
+    public IntBuffer getMDOffsets() { return intColumn(COL_MD_OFF, getNAlignments() + 1); }
+
+    /** the MD tags of all the alignments, as ASCII, end to end */
+    public ByteBuffer getMDChars() { return byteColumn(COL_MD, getCount(N_MD_CHARS)); }
+
+    /** getNAlignments()+1 elements:  the index in {@link #getXAChars} of each alignment's XA tag */
+    public IntBuffer getXAOffsets() { return intColumn(COL_XA_OFF, getNAlignments() + 1); }
+
+    /** the XA tags of all the alignments, as ASCII, end to end */
+    public ByteBuffer getXAChars() { return byteColumn(COL_XA, getCount(N_XA_CHARS)); }
+
+    /** the cigar of one of the alignments as a String (empty for unmapped alignments) */
+    public String getCigar( final int alignIdx ) {
+        final int beg = getInt(COL_CIGAR_OFF, checkAlignIdx(alignIdx));
+        final int end = getInt(COL_CIGAR_OFF, alignIdx + 1);
+        final StringBuilder cigar = new StringBuilder(4 * (end - beg));
+        for ( int idx = beg; idx != end; ++idx ) {
+            final int lenOp = getInt(COL_CIGAR, idx);
+            cigar.append(lenOp >>> 4).append(BwaMemAlignmentView.getCigarOpChar(lenOp));
+        }
+        return cigar.toString();
+    }
+
+    /** the MD tag of one of the alignments, or null if it hasn't got one */
+    public String getMDTag( final int alignIdx ) { return getTag(COL_MD_OFF, COL_MD, checkAlignIdx(alignIdx)); }
+
+    /** the XA tag of one of the alignments, or null if it hasn't got one */
+    public String getXATag( final int alignIdx ) { return getTag(COL_XA_OFF, COL_XA, checkAlignIdx(alignIdx)); }
+
+    /** decodes one of the alignments */
+    public BwaMemAlignment toAlignment( final int alignIdx ) {
+        final int flags = getInt(COL_FLAG, checkAlignIdx(alignIdx));
+        final int refStart = getInt(COL_POS, alignIdx);
+        int refEnd = -1;
+        int seqStart = -1;
+        int seqEnd = -1;
+        if ( (flags & 0x4) == 0 ) {
+            int refLen = 0;
+            int seqLen = 0;
+            seqStart = 0;
+            final int beg = getInt(COL_CIGAR_OFF, alignIdx);
+            final int end = getInt(COL_CIGAR_OFF, alignIdx + 1);
+            for ( int idx = beg; idx != end; ++idx ) {
+                final int lenOp = getInt(COL_CIGAR, idx);
+                final int op = lenOp & 0x0f;
+                if ( op == CIGAR_OP_S && idx == beg ) seqStart = lenOp >>> 4;
+                if ( op == CIGAR_OP_M || op == CIGAR_OP_D ) refLen += lenOp >>> 4;
+                if ( op == CIGAR_OP_M || op == CIGAR_OP_I ) seqLen += lenOp >>> 4;
+            }
+            refEnd = refStart + refLen;
+            seqEnd = seqStart + seqLen;
+        }
+        return new BwaMemAlignment(flags, getInt(COL_REF_ID, alignIdx), refStart, refEnd, seqStart, seqEnd,
+                getInt(COL_MAPQ, alignIdx), getInt(COL_NM, alignIdx), getInt(COL_AS, alignIdx),
+                getInt(COL_XS, alignIdx), getCigar(alignIdx), getMDTag(alignIdx), getXATag(alignIdx),
+                getInt(COL_MATE_REF_ID, alignIdx), getInt(COL_MATE_POS, alignIdx), getInt(COL_TLEN, alignIdx));
+    }
+
+    /** decodes everything, just as {@link BwaMemAligner#alignSeqs} would have */
+    public List<List<BwaMemAlignment>> toAlignments() {
+        final int nSequences = getNSequences();
+        final List<List<BwaMemAlignment>> allAlignments = new ArrayList<>(nSequences);
+        int alignIdx = getInt(COL_FIRST_ALIGN, 0);
+        for ( int seqIdx = 0; seqIdx != nSequences; ++seqIdx ) {
+            final int end = getInt(COL_FIRST_ALIGN, seqIdx + 1);
+            final List<BwaMemAlignment> alignments = new ArrayList<>(end - alignIdx);
+            for ( ; alignIdx != end; ++alignIdx ) {
+                alignments.add(toAlignment(alignIdx));
+            }
+            allAlignments.add(alignments);
+        }
+        return allAlignments;
+    }
+
+    /**
+     * Hands the columns over to Apache Arrow through its C data interface, without copying them (unless they're
+     * in the aligner's reusable results buffer, in which case they're copied to native memory first).
+     * The ArrowSchema and ArrowArray structs at the given addresses are filled in with a struct array that has one
+     * element per alignment, and these fields:  seq (the sequence's index in the batch), flag, mapq, refId, pos,
+     * cigar (a list of packed ops, as in {@link #getPackedCigars}), NM, AS, XS, MD and XA (strings, null if the
+     * alignment hasn't got the tag), mateRefId, matePos, and tlen, all int32 but for cigar, MD, and XA.
+     * With Arrow's Java C data module, that's something like:
+     * <pre>
+     *   try ( ArrowSchema schema = ArrowSchema.allocateNew(allocator);
+     *         ArrowArray array = ArrowArray.allocateNew(allocator) ) {
+     *       columns.exportToArrow(schema.memoryAddress(), array.memoryAddress());
+     *       root = Data.importVectorSchemaRoot(allocator, array, schema, null);
+     *   }
+     * </pre>
+     * The Arrow array owns the native memory afterwards, and frees it when it's released, so these columns are
+     * closed.
+     */
+    public void exportToArrow( final long arrowSchemaAddress, final long arrowArrayAddress ) {
+        if ( arrowSchemaAddress == 0L || arrowArrayAddress == 0L ) {
+            throw new IllegalArgumentException("The ArrowSchema and ArrowArray addresses must be non-null.");
+        }
+        final ByteBuffer buf = getBuffer();
+        BwaMemIndex.exportColumnsToArrow(buf, isResultsBuf, arrowSchemaAddress, arrowArrayAddress);
+        if ( isResultsBuf ) {
+            aligner.returnResultsBuffer(buf);
+        } else {
+            // Arrow frees the buffer now, but the aligner still needs to learn that it didn't fit
+            aligner.growResultsBuffer(buf.capacity());
+        }
+        alignsBuf = null;
+    }
+
+    public boolean isOpen() { return alignsBuf != null; }
+
+    /** releases the native results:  columns returned by the getters are unusable afterwards */
+    @Override
+    public void close() {
+        if ( alignsBuf != null ) {
+            if ( isResultsBuf ) {
+                aligner.returnResultsBuffer(alignsBuf);
+            } else {
+                aligner.releaseAlignments(alignsBuf);
+            }
+            alignsBuf = null;
+        }
+    }
+
+    private ByteBuffer getBuffer() {
+        if ( alignsBuf == null ) {
+            throw new IllegalStateException("The alignment columns have been closed.");
+        }
+        return alignsBuf;
+    }
+
+    private int getCount( final int countIdx ) { return getBuffer().getInt(countIdx * Integer.BYTES); }
+
+    private int colOffset( final int colIdx ) { return getCount(HDR_COUNTS + colIdx); }
+
+    private int getInt( final int colIdx, final int idx ) {
+        return getBuffer().getInt(colOffset(colIdx) + idx * Integer.BYTES);
+    }
+
+    private ByteBuffer byteColumn( final int colIdx, final int len ) {
+        final ByteBuffer buf = getBuffer().duplicate();
+        final int offset = colOffset(colIdx);
+        buf.limit(offset + len).position(offset);
+        return buf.slice().asReadOnlyBuffer().order(ByteOrder.nativeOrder());
+    }
+
+    private IntBuffer intColumn( final int colIdx, final int len ) {
+        return byteColumn(colIdx, len * Integer.BYTES).asIntBuffer();
+    }
+
+    private String getTag( final int offsetsColIdx, final int charsColIdx, final int alignIdx ) {
+        final int beg = getInt(offsetsColIdx, alignIdx);
+        final int tagLen = getInt(offsetsColIdx, alignIdx + 1) - beg;
+        if ( tagLen == 0 ) return null;
+        final ByteBuffer buf = getBuffer();
+        final int offset = colOffset(charsColIdx) + beg;
+        final byte[] tagBytes = new byte[tagLen];
+        for ( int idx = 0; idx != tagLen; ++idx ) {
+            tagBytes[idx] = buf.get(offset + idx);
+        }
+        return new String(tagBytes);
+    }
+
+    private int checkAlignIdx( final int alignIdx ) {
+        if ( alignIdx < 0 || alignIdx >= getNAlignments() ) {
+            throw new IndexOutOfBoundsException("No alignment " + alignIdx);
+        }
+        return alignIdx;
+    }
+}
@@ -0,0 +1,183 @@
+package org.broadinstitute.hellbender.utils.bwa;
+
+import java.nio.ByteBuffer;
+import java.nio.IntBuffer;
+
+/**
+ * A movable window onto one alignment record in a {@link BwaMemAlignmentBatch}.
+ * The getters read straight from the native buffer:  nothing is decoded until you ask for it, and Strings are
+ * built only by {@link #getCigar}, {@link #getMDTag}, and {@link #getXATag}.
+ * The CIGAR is also available as packed ints (length &lt;&lt; 4 | op, with BAM op codes).
+ * Views aren't thread-safe, and they're unusable once their batch is closed.
+ */
+public final class BwaMemAlignmentView {
+    private static final String CIGAR_OPS = "MID?S???????????";
+    private static final int CIGAR_OP_M = 0;
+    private static final int CIGAR_OP_I = 1;
+    private static final int CIGAR_OP_D = 2;
+    private static final int CIGAR_OP_S = 4;
+
+    private final BwaMemAlignmentBatch batch;
+    private int flags;
+    private int offset = -1; // of the record's first word
+    private int cigarOffset; // of the count of cigar ops
+    private int mdOffset;
+    private int xaOffset;
+    private int mateOffset;
+
+    BwaMemAlignmentView( final BwaMemAlignmentBatch batch ) { this.batch = batch; }
+
+    /** moves the view onto one of the alignments for one of the sequences in the batch */
+    public BwaMemAlignmentView moveTo( final int seqIdx, final int alignIdx ) {
+        final ByteBuffer buf = batch.getBuffer();
+        offset = batch.getRecordOffset(seqIdx, alignIdx);
+        flags = buf.getInt(offset) >>> 16;
+        int next = offset + Integer.BYTES;
+        if ( isMapped() ) {
+            cigarOffset = next + 5 * Integer.BYTES;
+            mdOffset = cigarOffset + (1 + getNCigarOps()) * Integer.BYTES;
+            xaOffset = tagEnd(buf, mdOffset);
+            next = tagEnd(buf, xaOffset);
+        }
+        mateOffset = next;
+        return this;
+    }
+
+    public int getSamFlag() { return flags; }
+    public int getMapQual() { return buf().getInt(offset) & 0xff; }
+    public int getRefId() { return isMapped() ? buf().getInt(offset + 4) : -1; }
+    public int getRefStart() { return isMapped() ? buf().getInt(offset + 8) : -1; }
+    public int getNMismatches() { return isMapped() ? buf().getInt(offset + 12) : 0; }
+    public int getAlignerScore() { return isMapped() ? buf().getInt(offset + 16) : 0; }
+    public int getSuboptimalScore() { return isMapped() ? buf().getInt(offset + 20) : 0; }
+    public int getMateRefId() { return hasMappedMate() ? buf().getInt(mateOffset) : -1; }
+    public int getMateRefStart() { return hasMappedMate() ? buf().getInt(mateOffset + 4) : -1; }
+    public int getTemplateLen() { return hasMappedMate() ? buf().getInt(mateOffset + 8) : 0; }
+
+    public int getNCigarOps() { return isMapped() ? Math.max(0, buf().getInt(cigarOffset)) : 0; }
+
+    /** one of the cigar ops, packed as length &lt;&lt; 4 | op */
+    public int getCigarOp( final int idx ) {
+        if ( idx < 0 || idx >= getNCigarOps() ) {
+            throw new IndexOutOfBoundsException("No cigar op " + idx);
+        }
+        return buf().getInt(cigarOffset + (1 + idx) * Integer.BYTES);
+    }
+
+    public static int getCigarOpLength( final int packedOp ) { return packedOp >>> 4; }
+    public static char getCigarOpChar( final int packedOp ) { return CIGAR_OPS.charAt(packedOp & 0x0f); }
+
+    /** copies the packed cigar ops into dest, if it's big enough, or else into a new array, which is returned */
+    public int[] getCigarOps( final int[] dest ) {
+        final int nOps = getNCigarOps();
+        final int[] ops = dest != null && dest.length >= nOps ? dest : new int[nOps];
+        getPackedCigar().get(ops, 0, nOps);
+        return ops;
+    }
+
+    /** a read-only view of the packed cigar ops, with no copying */
+    public IntBuffer getPackedCigar() {
+        final int nOps = getNCigarOps();
+        final ByteBuffer buf = buf().duplicate().order(buf().order());
+        if ( nOps == 0 ) {
+            buf.limit(0);
+        } else {
+            buf.limit(cigarOffset + (1 + nOps) * Integer.BYTES).position(cigarOffset + Integer.BYTES);
+        }
+        return buf.slice().order(buf().order()).asIntBuffer().asReadOnlyBuffer();
+    }
+
+    public int getRefEnd() {
+        if ( !isMapped() ) return -1;
+        int refLen = 0;
+        for ( int idx = 0, nOps = getNCigarOps(); idx != nOps; ++idx ) {
+            final int lenOp = getCigarOp(idx);
+            final int op = lenOp & 0x0f;
+            if ( op == CIGAR_OP_M || op == CIGAR_OP_D ) refLen += lenOp >>> 4;
+        }
+        return getRefStart() + refLen;
+    }
+
+    public int getSeqStart() {
+        if ( !isMapped() ) return -1;
+        if ( getNCigarOps() == 0 ) return 0;
+        final int lenOp = getCigarOp(0);
+        return (lenOp & 0x0f) == CIGAR_OP_S ? lenOp >>> 4 : 0;
+    }
+
+    public int getSeqEnd() {
+        if ( !isMapped() ) return -1;
+        int seqLen = 0;
+        for ( int idx = 0, nOps = getNCigarOps(); idx != nOps; ++idx ) {
+            final int lenOp = getCigarOp(idx);
+            final int op = lenOp & 0x0f;
+            if ( op == CIGAR_OP_M || op == CIGAR_OP_I ) seqLen += lenOp >>> 4;
+        }
+        return getSeqStart() + seqLen;
+    }
+
+    /** the cigar as a String (empty for unmapped alignments) */
+    public String getCigar() {
+        final int nOps = getNCigarOps();
+        final StringBuilder cigar = new StringBuilder(4 * nOps);
+        for ( int idx = 0; idx != nOps; ++idx ) {
+            final int lenOp = getCigarOp(idx);
+            cigar.append(lenOp >>> 4).append(getCigarOpChar(lenOp));
+        }
+        return cigar.toString();
+    }
+
+    public boolean hasMDTag() { return isMapped() && buf().getInt(mdOffset) != 0; }
+    public String getMDTag() { return isMapped() ? getTag(mdOffset) : null; }
+    public boolean hasXATag() { return isMapped() && buf().getInt(xaOffset) != 0; }
+    public String getXATag() { return isMapped() ? getTag(xaOffset) : null; }
+
+    /** decodes the whole record */
+    public BwaMemAlignment toAlignment() {
+        return new BwaMemAlignment(getSamFlag(), getRefId(), getRefStart(), getRefEnd(), getSeqStart(), getSeqEnd(),
+                getMapQual(), getNMismatches(), getAlignerScore(), getSuboptimalScore(), getCigar(), getMDTag(),
+                getXATag(), getMateRefId(), getMateRefStart(), getTemplateLen());
+    }
+
+    private boolean isMapped() {
+        if ( offset < 0 ) {
+            throw new IllegalStateException("The view hasn't been moved onto an alignment.");
+        }
+        return (flags & 0x4) == 0;
+    }
+
+    private boolean hasMappedMate() { return (flags & 0x1) != 0 && (flags & 0x8) == 0; }
+
+    private ByteBuffer buf() { return batch.getBuffer(); }
+
+    private String getTag( final int tagOffset ) {
+        final ByteBuffer buf = buf();
+        final int tagLen = buf.getInt(tagOffset);
+        if ( tagLen == 0 ) return null;
+        final byte[] tagBytes = new byte[tagLen];
+        for ( int idx = 0; idx != tagLen; ++idx ) {
+            tagBytes[idx] = buf.get(tagOffset + Integer.BYTES + idx);
+        }
+        return new String(tagBytes);
+    }
+
+    // tags are a length and the characters, padded to a 4-byte boundary
+    private static int tagEnd( final ByteBuffer buf, final int tagOffset ) {
+        return tagOffset + Integer.BYTES + ((buf.getInt(tagOffset) + 3) & ~3);
+    }
+
+    /** the offset just past the record that starts at recordOffset */
+    static int recordEnd( final ByteBuffer buf, final int recordOffset ) {
+        final int flags = buf.getInt(recordOffset) >>> 16;
+        int next = recordOffset + Integer.BYTES;
+        if ( (flags & 0x4) == 0 ) {
+            final int nCigarOps = Math.max(0, buf.getInt(next + 5 * Integer.BYTES));
+            next = tagEnd(buf, next + (6 + nCigarOps) * Integer.BYTES);
+            next = tagEnd(buf, next);
+        }
+        if ( (flags & 0x1) != 0 && (flags & 0x8) == 0 ) {
+            next += 3 * Integer.BYTES;
+        }
+        return next;
+    }
+}
@@ -0,0 +1,83 @@
+package org.broadinstitute.hellbender.utils.bwa;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.channels.WritableByteChannel;
+
+/**
+ * The alignments for a batch of reads, as BAM records in the native results buffer.
+ * Get one from {@link BwaMemAligner#alignSeqsToBam}, and close it when you're done to release the buffer.
+ * <p>
+ *     Each read's records are laid out exactly as they would be in an uncompressed BAM file (each starting with
+ *     its block_size), so you can hand them to a BGZF writer as is.  Writing the BAM header, with bwa's contigs
+ *     in index order (see {@link BwaMemIndex#getReferenceContigs}), is up to you.
+ * </p>
+ */
+public final class BwaMemBamRecords implements AutoCloseable {
+    private final BwaMemAligner aligner;
+    private ByteBuffer alignsBuf;
+    private final boolean isResultsBuf; // whether alignsBuf is the aligner's reusable buffer, rather than native
+    private final int nSequences;
+
+    BwaMemBamRecords( final BwaMemAligner aligner, final ByteBuffer alignsBuf, final boolean isResultsBuf,
+                      final int nSequences ) {
+        this.aligner = aligner;
+        this.alignsBuf = alignsBuf;
+        this.isResultsBuf = isResultsBuf;
+        this.nSequences = nSequences;
+        alignsBuf.order(ByteOrder.nativeOrder()).position(0).limit(alignsBuf.capacity());
+    }
+
+    public int getNSequences() { return nSequences; }
+
+    /**
+     * A read-only view of the records for one of the reads (there's at least one record for each read, even if
+     * it's unmapped).  It's unusable once this object is closed.
+     */
+    public ByteBuffer getRecords( final int seqIdx ) {
+        if ( seqIdx < 0 || seqIdx >= nSequences ) {
+            throw new IndexOutOfBoundsException("No sequence " + seqIdx);
+        }
+        final ByteBuffer buf = getBuffer().duplicate();
+        // the buffer begins with the offset of each read's results, which are a byte count and the records
+        final int resultOffset = alignsBuf.getInt(seqIdx * Integer.BYTES);
+        final int recordsOffset = resultOffset + Integer.BYTES;
+        buf.limit(recordsOffset + alignsBuf.getInt(resultOffset)).position(recordsOffset);
+        return buf.slice().order(ByteOrder.LITTLE_ENDIAN).asReadOnlyBuffer();
+    }
+
+    /** writes all the records, in read order, and returns the number of bytes written */
+    public long writeTo( final WritableByteChannel channel ) throws IOException {
+        long nBytes = 0;
+        for ( int seqIdx = 0; seqIdx != nSequences; ++seqIdx ) {
+            final ByteBuffer records = getRecords(seqIdx);
+            while ( records.hasRemaining() ) {
+                nBytes += channel.write(records);
+            }
+        }
+        return nBytes;
+    }
+
+    public boolean isOpen() { return alignsBuf != null; }
+
+    /** releases the native results:  buffers returned by getRecords are unusable afterwards */
+    @Override
+    public void close() {
+        if ( alignsBuf != null ) {
+            if ( isResultsBuf ) {
+                aligner.returnResultsBuffer(alignsBuf);
+            } else {
+                aligner.releaseAlignments(alignsBuf);
+            }
+            alignsBuf = null;
+        }
+    }
+
+    private ByteBuffer getBuffer() {
+        if ( alignsBuf == null ) {
+            throw new IllegalStateException("The BAM records have been closed.");
+        }
+        return alignsBuf;
+    }
+}
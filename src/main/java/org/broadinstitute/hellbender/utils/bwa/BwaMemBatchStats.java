@@ -0,0 +1,122 @@
+package org.broadinstitute.hellbender.utils.bwa;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * Timings and counters for one batch of alignments.
+ * Turn on collection with {@link BwaMemAligner#setCollectStats}, and retrieve them after each batch with
+ * {@link BwaMemAligner#getLastBatchStats}.
+ * <p>
+ *     bwa works a batch in two passes over the reads, split among the threads:  the first pass finds seeds, chains
+ *     them, and extends them with banded Smith-Waterman;  the second pairs the reads (rescuing mates as needed)
+ *     and generates the alignment records.  Between the passes it infers the pair-end insert size distribution.
+ *     Times are in nanoseconds.
+ * </p>
+ * <p>
+ *     The seed, extension, and mate rescue counts are only available on Linux, where the native library can
+ *     intercept the bwa functions that do that work.  Elsewhere they're zero.
+ * </p>
+ */
+public final class BwaMemBatchStats {
+    /** Stages whose wall-clock time is measured for the batch as a whole. */
+    public enum Stage {
+        /** Unpacking the sequences. */
+        PARSE,
+        /** Finding seeds, chaining them, and extending them. */
+        SEED_EXTEND,
+        /** Inferring the pair-end insert size distribution. */
+        PESTAT,
+        /** Pairing, mate rescue, and formatting the alignment records. */
+        PAIR_FORMAT,
+        /** The whole batch. */
+        TOTAL
+    }
+
+    /** Values measured separately for each thread. */
+    public enum ThreadValue {
+        /** Wall-clock time the thread spent on the seed/chain/extend pass. */
+        SEED_EXTEND_WALL,
+        /** CPU time the thread spent on the seed/chain/extend pass. */
+        SEED_EXTEND_CPU,
+        /** Wall-clock time the thread spent on the pairing and formatting pass. */
+        PAIR_FORMAT_WALL,
+        /** CPU time the thread spent on the pairing and formatting pass. */
+        PAIR_FORMAT_CPU,
+        /** Wall-clock time spent formatting records (part of PAIR_FORMAT_WALL). */
+        FORMAT_WALL,
+        /** Wall-clock time spent copying records into the results buffer (also part of PAIR_FORMAT_WALL). */
+        COPY_WALL,
+        /** Number of super-maximal exact match searches, in the first seeding pass and in re-seeding. */
+        SMEM_SEARCHES,
+        /** Number of seed positions looked up in the suffix array. */
+        SEEDS,
+        /** Number of Smith-Waterman extensions. */
+        EXTENSIONS,
+        /** Query length times target length, summed over the extensions (an upper bound on the cells scored). */
+        SW_CELLS,
+        /** Number of Smith-Waterman alignments attempted to rescue a mate. */
+        MATE_RESCUES,
+        /** Number of alignment records generated. */
+        RECORDS
+    }
+
+    private static final int N_STAGES = Stage.values().length;
+    private static final int N_THREAD_VALUES = ThreadValue.values().length;
+
+    private final long[] stageNanos;
+    private final long[][] threadValues;
+
+    /** the size of the buffer the native code needs for a batch aligned with nThreads threads */
+    static int bufferSize( final int nThreads ) {
+        return (1 + N_STAGES + Math.max(1, nThreads) * N_THREAD_VALUES) * Long.BYTES;
+    }
+
+    // the layout is described in stats.h
+    BwaMemBatchStats( final ByteBuffer statsBuf ) {
+        statsBuf.order(ByteOrder.nativeOrder()).position(0).limit(statsBuf.capacity());
+        final int nThreads = (int)statsBuf.getLong();
+        stageNanos = new long[N_STAGES];
+        for ( int idx = 0; idx != N_STAGES; ++idx ) {
+            stageNanos[idx] = statsBuf.getLong();
+        }
+        threadValues = new long[nThreads][N_THREAD_VALUES];
+        for ( final long[] values : threadValues ) {
+            for ( int idx = 0; idx != N_THREAD_VALUES; ++idx ) {
+                values[idx] = statsBuf.getLong();
+            }
+        }
+    }
+
+    public int getNThreads() { return threadValues.length; }
+
+    /** wall-clock time for a stage of the batch */
+    public long getStageNanos( final Stage stage ) { return stageNanos[stage.ordinal()]; }
+
+    /** a value for one of the threads that worked on the batch */
+    public long getThreadValue( final int threadIdx, final ThreadValue value ) {
+        return threadValues[threadIdx][value.ordinal()];
+    }
+
+    /** a value summed over all the threads that worked on the batch */
+    public long getTotal( final ThreadValue value ) {
+        long total = 0;
+        for ( final long[] values : threadValues ) {
+            total += values[value.ordinal()];
+        }
+        return total;
+    }
+
+    @Override
+    public String toString() {
+        final StringBuilder sb = new StringBuilder("BwaMemBatchStats{");
+        for ( final Stage stage : Stage.values() ) {
+            sb.append(stage).append('=').append(getStageNanos(stage)).append(", ");
+        }
+        for ( final ThreadValue value : ThreadValue.values() ) {
+            sb.append(value).append('=').append(getTotal(value)).append(", ");
+        }
+        sb.append("nThreads=").append(getNThreads()).append('}');
+        return sb.toString();
+    }
+}
@@ -6,6 +6,7 @@ import java.nio.ByteOrder;
 import java.nio.file.Files;
 import java.nio.file.StandardCopyOption;
 import java.util.*;
+import java.util.concurrent.CompletableFuture;
 import java.util.concurrent.atomic.AtomicInteger;
 import java.util.stream.Collectors;
 
@@ -79,12 +80,90 @@ public final class BwaMemIndex implements AutoCloseable {
         }
     }
 
+    /**
+     * Options for opening an index image, which let you trade start-up time against the cost of page faults
+     * and TLB misses while aligning.
+     * By default the image is simply memory-mapped, and pages are faulted in as bwa happens to touch them.
+     */
+    public enum OpenOption {
+        /** Fault in the whole image as it's mapped (Linux only). */
+        POPULATE(0x01),
+        /** Fault in the whole image by touching each page in parallel, using the native thread pool. */
+        TOUCH(0x02),
+        /** Copy the image into anonymous memory, and ask for transparent huge pages to back it. */
+        TRANSPARENT_HUGE_PAGES(0x04),
+        /**
+         * Copy the image into hugetlbfs pages (which must have been reserved by the administrator).
+         * Falls back to {@link #TRANSPARENT_HUGE_PAGES} if there aren't enough of them.
+         */
+        HUGETLB_PAGES(0x08),
+        /** Advise the kernel that the BWT will be accessed randomly, so that it doesn't read ahead. */
+        BWT_RANDOM(0x10),
+        /** Advise the kernel that the BWT will be needed soon, so that it can start reading it. */
+        BWT_WILLNEED(0x20),
+        /** Advise the kernel that the suffix array will be accessed randomly, so that it doesn't read ahead. */
+        SA_RANDOM(0x40),
+        /** Advise the kernel that the suffix array will be needed soon, so that it can start reading it. */
+        SA_WILLNEED(0x80),
+        /**
+         * Load the image into a named POSIX shared memory segment that every process on the host opening the same
+         * image file shares (so each executor JVM needn't have its own copy, and the pages can't be evicted while
+         * anyone's using them).  The first process to open the image loads it, later ones attach instantly, and
+         * the last one to close it removes the segment.  A process that dies without closing the index doesn't keep
+         * the segment alive, though if it was the last one using it, the segment (in /dev/shm, on Linux) stays
+         * until the next process to open the image closes it.  If there isn't room for the whole image in shared
+         * memory, the index isn't shared (see {@link BwaMemIndex#getSharedMemoryName}).  Takes precedence over
+         * {@link #TRANSPARENT_HUGE_PAGES} and {@link #HUGETLB_PAGES}, and falls back to them (or to a plain mapping)
+         * if the segment can't be made.
+         */
+        SHARED_MEMORY(0x100),
+        /** Lock the image in memory so that it can't be paged out, if RLIMIT_MEMLOCK allows (best effort). */
+        LOCK_IN_MEMORY(0x200),
+        /**
+         * Check the CRCs of all the image's components (in parallel) before using it, which reads the whole image.
+         * Every image gets a cheap structural check regardless, so a truncated or mangled image fails to open
+         * rather than crashing later; this catches corruption within the components, too.  Images written before
+         * images had an integrity header can't be checked this way, and just get the structural check.
+         */
+        VERIFY_CHECKSUMS(0x400);
+
+        private final int flag; // must match the JNIBWA_OPEN_* value in jnibwa.h
+
+        OpenOption( final int flag ) { this.flag = flag; }
+
+        private static int toFlags( final OpenOption... options ) {
+            int flags = 0;
+            for ( final OpenOption option : options ) {
+                flags |= option.flag;
+            }
+            return flags;
+        }
+    }
+
     private final String indexImageFile; // stash this for error messages
     private volatile long indexAddress; // address where the index was memory-mapped (for use by C code)
     private final AtomicInteger refCount; // keep track of how many threads are actively aligning
-    private final List<String> refContigNames; // the reference dictionary from the index
+    private final List<BwaMemReferenceContig> refContigs; // the reference dictionary from the index, in refId order
+    private final List<String> refContigNames; // just the names, in the same order
+    private final Map<String, BwaMemReferenceContig> refContigsByName;
+    private final String sharedMemoryName; // null unless the image is in a shared memory segment
     private static volatile boolean nativeLibLoaded = false; // whether we've loaded the native library or not
 
+    // asynchronous alignment jobs that have been submitted, but not yet collected, keyed by job handle
+    private static final Map<Long, PendingAlignment> pendingAlignments = new HashMap<>();
+    private static Thread alignmentCollector; // the thread that collects completed asynchronous jobs
+
+    private static final class PendingAlignment {
+        final BwaMemIndex index;
+        final ByteBuffer seqs; // held so that the sequences stay put until bwa is done with them
+        final CompletableFuture<ByteBuffer> alignments = new CompletableFuture<>();
+
+        PendingAlignment( final BwaMemIndex index, final ByteBuffer seqs ) {
+            this.index = index;
+            this.seqs = seqs;
+        }
+    }
+
     private static String resolveFastaFileExtension(final String fasta) {
         final Optional<String> extension = FASTA_FILE_EXTENSIONS.stream()
                 .filter(fasta::endsWith).findFirst();
@@ -112,6 +191,62 @@ public final class BwaMemIndex implements AutoCloseable {
      * @throws IllegalArgumentException if {@code imageFile} is {@code null}.
      */
     public static void createIndexImageFromIndexFiles(final String indexPrefix, final String imageFile) {
+        createIndexImageFromIndexFiles(indexPrefix, imageFile, null);
+    }
+
+    /**
+     * Receives progress reports while an index image is written.
+     */
+    @FunctionalInterface
+    public interface ImageProgressListener {
+        /**
+         * Called after each piece of the image has been written.
+         * Throwing an exception abandons the image (and the exception is rethrown to the caller).
+         * @param bytesWritten the number of bytes of the image written so far.
+         * @param imageSize the total size of the image.
+         */
+        void progress( long bytesWritten, long imageSize );
+    }
+
+    /**
+     * Create the index image file for a complete set of BWA index files, with progress reports.
+     * The image is streamed from the index files, so this takes little memory even for a large reference.
+     * @param indexPrefix the location of the index files.
+     * @param imageFile the location of the new index image file.
+     * @param listener receives progress reports (may be {@code null}).
+     *
+     * @throws IllegalArgumentException if {@code indexPrefix} is {@code null}
+     *  or it does not look like it points to a complete set of index files.
+     * @throws IllegalArgumentException if {@code imageFile} is {@code null}.
+     * @throws CouldNotCreateIndexImageException if the image couldn't be written.
+     */
+    public static void createIndexImageFromIndexFiles( final String indexPrefix, final String imageFile,
+                                                       final ImageProgressListener listener ) {
+        createIndexImageFromIndexFiles(indexPrefix, imageFile, listener, false);
+    }
+
+    /**
+     * Create the index image file for a complete set of BWA index files, optionally compressed.
+     * <p>
+     *     A compressed image is cut into fixed-size blocks that are deflated independently, so it's written and
+     *     (when it's opened) inflated by all the cores at once.  It's typically a good deal smaller on disk,
+     *     which makes it cheaper to ship around.  Opening one reads the whole thing into anonymous memory (or a
+     *     shared memory segment, with {@link OpenOption#SHARED_MEMORY}), since it can't be mapped as is.
+     *     Compressed images are recognized when they're opened, so there's nothing special to do to open one.
+     * </p>
+     * @param indexPrefix the location of the index files.
+     * @param imageFile the location of the new index image file.
+     * @param listener receives progress reports (may be {@code null}), in terms of uncompressed bytes.
+     * @param compressed whether to compress the image.
+     *
+     * @throws IllegalArgumentException if {@code indexPrefix} is {@code null}
+     *  or it does not look like it points to a complete set of index files.
+     * @throws IllegalArgumentException if {@code imageFile} is {@code null}.
+     * @throws CouldNotCreateIndexImageException if the image couldn't be written.
+     */
+    public static void createIndexImageFromIndexFiles( final String indexPrefix, final String imageFile,
+                                                       final ImageProgressListener listener,
+                                                       final boolean compressed ) {
         if (indexPrefix == null) {
             throw new IllegalArgumentException("the index prefix cannot be null");
         } else if (imageFile == null) {
@@ -119,7 +254,9 @@ public final class BwaMemIndex implements AutoCloseable {
         }
         assertLooksLikeIndexPrefix(indexPrefix);
         loadNativeLibrary();
-        createIndexImageFile(indexPrefix, imageFile);
+        if ( !createIndexImageFile(indexPrefix, imageFile, listener, compressed) ) {
+            throw new CouldNotCreateIndexImageException(imageFile, "unable to write the image from "+indexPrefix);
+        }
     }
 
     /**
@@ -225,8 +362,11 @@ public final class BwaMemIndex implements AutoCloseable {
         final File indexPrefix = createTempIndexPrefix(fasta);
         loadNativeLibrary();
         createReferenceIndex(fasta, indexPrefix.getPath(), algo.toBwaName());
-        createIndexImageFile(indexPrefix.getPath(), imageFile);
+        final boolean isCreated = createIndexImageFile(indexPrefix.getPath(), imageFile, null, false);
         deleteIndexFiles(indexPrefix);
+        if ( !isCreated ) {
+            throw new CouldNotCreateIndexImageException(imageFile, "unable to write the image");
+        }
     }
 
     private static void assertCanCreateOrOverwriteImageFile(final String imageFile) {
@@ -326,27 +466,54 @@ public final class BwaMemIndex implements AutoCloseable {
      *  image file.
      */
     public BwaMemIndex( final String indexImageFile ) {
+        this(indexImageFile, new OpenOption[0]);
+    }
+
+    /**
+     * Loads an index from an image file, with some control over how the image is brought into memory.
+     * @param indexImageFile the image file.
+     * @param options how to map the image (see {@link OpenOption}).
+     * @throws IllegalArgumentException if {@code indexImageFile} is {@code null}.
+     * @throws CouldNotReadImageException if some problem occurred when loading the
+     *  image file.
+     */
+    public BwaMemIndex( final String indexImageFile, final OpenOption... options ) {
         this.indexImageFile = indexImageFile;
         loadNativeLibrary();
         assertNonEmptyReadableImageFile(indexImageFile);
         refCount = new AtomicInteger();
-        indexAddress = openIndex(indexImageFile);
+        indexAddress = openIndex(indexImageFile, OpenOption.toFlags(options));
         if ( indexAddress == 0L ) {
-            throw new CouldNotReadImageException(indexImageFile, "unable to open bwa-mem index");
+            throw new CouldNotReadImageException(indexImageFile,
+                    "unable to open bwa-mem index (it may be truncated or corrupt, or built by another version of bwa)");
         }
+        sharedMemoryName = getSharedMemoryName(indexAddress);
         ByteBuffer refContigNamesBuf = getRefContigNames(indexAddress);
         if ( refContigNamesBuf == null ) {
             throw new CouldNotReadImageException("unable to retrieve reference contig names from bwa-mem index");
         }
         refContigNamesBuf.order(ByteOrder.nativeOrder()).position(0).limit(refContigNamesBuf.capacity());
-        int nRefContigNames = refContigNamesBuf.getInt();
-        refContigNames = new ArrayList<>(nRefContigNames);
-        for ( int idx = 0; idx < nRefContigNames; ++idx ) {
-            int nameLen = refContigNamesBuf.getInt();
-            byte[] nameBytes = new byte[nameLen];
+        final int nRefContigs = refContigNamesBuf.getInt(0);
+        final int namesStart = 8 + nRefContigs*REF_CONTIG_SIZE;
+        final List<BwaMemReferenceContig> contigs = new ArrayList<>(nRefContigs);
+        final List<String> names = new ArrayList<>(nRefContigs);
+        refContigsByName = new HashMap<>(2*nRefContigs);
+        for ( int idx = 0; idx < nRefContigs; ++idx ) {
+            final int contigStart = 8 + idx*REF_CONTIG_SIZE;
+            final long offset = refContigNamesBuf.getLong(contigStart);
+            final int length = refContigNamesBuf.getInt(contigStart + 8);
+            final boolean isAlt = refContigNamesBuf.getInt(contigStart + 12) != 0;
+            final byte[] nameBytes = new byte[refContigNamesBuf.getInt(contigStart + 20)];
+            refContigNamesBuf.position(namesStart + refContigNamesBuf.getInt(contigStart + 16));
             refContigNamesBuf.get(nameBytes);
-            refContigNames.add(new String(nameBytes));
+            final BwaMemReferenceContig contig =
+                    new BwaMemReferenceContig(idx, new String(nameBytes), length, offset, isAlt);
+            contigs.add(contig);
+            names.add(contig.getName());
+            refContigsByName.putIfAbsent(contig.getName(), contig);
         }
+        refContigs = Collections.unmodifiableList(contigs);
+        refContigNames = names;
         destroyByteBuffer(refContigNamesBuf);
     }
 
@@ -401,20 +568,243 @@ public final class BwaMemIndex implements AutoCloseable {
         return refContigNames;
     }
 
+    /**
+     * The name of the POSIX shared memory segment that holds the image (see {@link OpenOption#SHARED_MEMORY}),
+     * or null if the image isn't in one, either because the option wasn't given, or because the segment couldn't
+     * be made.
+     */
+    public String getSharedMemoryName() {
+        return sharedMemoryName;
+    }
+
+    /** the reference dictionary, with each contig's length and ALT flag, in refId order */
+    public List<BwaMemReferenceContig> getReferenceContigs() {
+        return refContigs;
+    }
+
+    /** the contig that alignments with this refId are on */
+    public BwaMemReferenceContig getReferenceContig( final int refId ) {
+        return refContigs.get(refId);
+    }
+
+    /** the contig with this name, or null if there isn't one */
+    public BwaMemReferenceContig getReferenceContig( final String name ) {
+        return refContigsByName.get(name);
+    }
+
+    /**
+     * the contig that covers this position in bwa's concatenation of all the contigs (see
+     * {@link BwaMemReferenceContig#getOffset}), or null if it's past the end or negative.  Like bwa's bns_pos2rid.
+     */
+    public BwaMemReferenceContig getReferenceContigAt( final long globalPos ) {
+        int lo = 0;
+        int hi = refContigs.size();
+        while ( lo < hi ) { // find the first contig that starts after globalPos
+            final int mid = (lo + hi) >>> 1;
+            if ( refContigs.get(mid).getOffset() <= globalPos ) lo = mid + 1;
+            else hi = mid;
+        }
+        if ( lo == 0 ) return null;
+        final BwaMemReferenceContig contig = refContigs.get(lo - 1);
+        return globalPos < contig.getOffset() + contig.getLength() ? contig : null;
+    }
+
+    /** the refId of the contig with this name, or -1 if there isn't one */
+    public int getReferenceContigId( final String name ) {
+        final BwaMemReferenceContig contig = refContigsByName.get(name);
+        return contig == null ? -1 : contig.getIndex();
+    }
+
+    /**
+     * Keep the results for unpaired reads in a native LRU cache, so that when the same sequence is aligned again
+     * with the same options (by any aligner using this index), it needn't be seeded or extended.  That pays off when
+     * the same contigs or reads are realigned over and over.
+     * <p>
+     *     The cache is keyed by the sequence and a hash of the options that affect the results, and it holds the
+     *     results in the form that {@link BwaMemAligner#alignSeqs} decodes, so it serves alignSeqs, alignSeqsAsync,
+     *     and alignSeqsLazily, but not pairs or {@link BwaMemAligner#alignSeqsToBam}.  Where bwa breaks ties among
+     *     equally good alignments at random (seeded by the read's position in its batch), a cached read gets the
+     *     same pick every time.
+     * </p>
+     * @param nBytes the cache's capacity, counting the sequences and results it holds, or 0 to empty it and stop
+     *               caching.  The cache lasts as long as the index.
+     * @throws IllegalArgumentException if {@code nBytes} is negative.
+     */
+    public void setResultCacheCapacity( final long nBytes ) {
+        if ( nBytes < 0 ) {
+            throw new IllegalArgumentException("the cache capacity cannot be negative");
+        }
+        final long addr = refIndex();
+        try {
+            setResultCacheCapacity(addr, nBytes);
+        }
+        finally {
+            deRefIndex();
+        }
+    }
+
+    /** a snapshot of the result cache's counters (all zero if the cache has never been given any room) */
+    public ResultCacheStats getResultCacheStats() {
+        final long[] counters = new long[ResultCacheStats.N_COUNTERS];
+        final long addr = refIndex();
+        try {
+            getResultCacheCounters(addr, counters);
+        }
+        finally {
+            deRefIndex();
+        }
+        return new ResultCacheStats(counters);
+    }
+
+    /** Counters for the result cache (see {@link #setResultCacheCapacity}), in the order the native code exports them. */
+    public static final class ResultCacheStats {
+        private static final int N_COUNTERS = 7;
+        private final long[] counters;
+
+        private ResultCacheStats( final long[] counters ) { this.counters = counters; }
+
+        /** the number of reads whose results were found in the cache */
+        public long getHits() { return counters[0]; }
+        /** the number of reads whose results weren't, and had to be aligned */
+        public long getMisses() { return counters[1]; }
+        public long getInserts() { return counters[2]; }
+        public long getEvictions() { return counters[3]; }
+        public long getNEntries() { return counters[4]; }
+        public long getNBytes() { return counters[5]; }
+        public long getCapacity() { return counters[6]; }
+
+        @Override
+        public String toString() {
+            return "hits=" + getHits() + ", misses=" + getMisses() + ", inserts=" + getInserts() +
+                    ", evictions=" + getEvictions() + ", entries=" + getNEntries() + ", bytes=" + getNBytes() +
+                    "/" + getCapacity();
+        }
+    }
+
     /** returns github GUID for the version of bwa that has been compiled */
     public static String getBWAVersion() {
         loadNativeLibrary();
         return getVersion();
     }
 
-    ByteBuffer doAlignment( final ByteBuffer seqs, final ByteBuffer opts, final BwaMemPairEndStats peStats) {
-        final ByteBuffer alignments = createAlignments(seqs, indexAddress, opts, peStats);
+    /**
+     * Sizes the process-wide pool of native threads that bwa uses to align sequences.
+     * <p>
+     *     Each call to {@link BwaMemAligner#alignSeqs} splits its work into {@link BwaMemAligner#getNThreadsOption()}
+     *     slots:  the calling thread works one of them, and the pool threads pick up the others.  The threads live
+     *     for the life of the process, so there's no cost to start and stop threads with each batch.
+     *     By default the pool grows on demand to match the largest number of threads requested by any aligner.
+     * </p>
+     * @param nThreads the number of pool threads, or 0 to go back to growing the pool on demand.
+     * @param pinThreads whether to pin each pool thread to a CPU (only honored on Linux).
+     * @throws IllegalArgumentException if {@code nThreads} is negative.
+     * @throws IllegalStateException if the requested number of threads couldn't be started.
+     */
+    public static void configureThreadPool( final int nThreads, final boolean pinThreads ) {
+        if ( nThreads < 0 ) {
+            throw new IllegalArgumentException("the number of pool threads cannot be negative");
+        }
+        loadNativeLibrary();
+        if ( !setThreadPool(nThreads, pinThreads) ) {
+            throw new IllegalStateException("Unable to start "+nThreads+" native aligner threads.");
+        }
+    }
+
+    /** returns the number of threads currently in the native aligner thread pool */
+    public static int getThreadPoolSize() {
+        loadNativeLibrary();
+        return getNPoolThreads();
+    }
+
+    // layouts of the sequences buffer
+    static final int SEQS_ASCII = 0; // null-terminated ASCII strings
+    static final int SEQS_2BIT = 1; // 2-bit packed bases with a mask for Ns
+    static final int SEQS_NAMED = 2; // null-terminated ASCII name, bases, and qualities for each sequence
+
+    // layouts of the results buffer
+    static final int OUTPUT_BAMISH = 0; // our own compact records (decoded by BwaMemAligner)
+    static final int OUTPUT_BAM = 1; // BAM records (see BwaMemBamRecords)
+    static final int OUTPUT_PRIMARY = 2; // one fixed-size record per read, for its primary alignment
+    static final int OUTPUT_COLUMNS = 3; // the whole batch as parallel arrays (see BwaMemAlignmentColumns)
+
+    // size of each contig's entry in the reference dictionary (jnibwa_contig_t)
+    private static final int REF_CONTIG_SIZE = 24;
+
+    // job flags (bits)
+    static final int JOB_DEDUP = 1; // align each distinct sequence (or pair) once, and share its results
+
+    // if resultsBuf is non-null and big enough, the results are written there and resultsBuf is returned
+    // otherwise the results are in a new, native buffer that the caller must free with destroyByteBuffer
+    // if statsBuf is non-null, it's filled with timings and counters for the batch (see BwaMemBatchStats)
+    ByteBuffer doAlignment( final ByteBuffer seqs, final int seqsFormat, final int outputFormat, final int jobFlags,
+                            final ByteBuffer opts, final BwaMemPairEndStatsByOrientation peStats,
+                            final ByteBuffer resultsBuf, final ByteBuffer statsBuf ) {
+        final ByteBuffer alignments = createAlignments(seqs, seqsFormat, outputFormat, jobFlags, indexAddress, opts,
+                                                        peStats == null ? null : peStats.asArray(), resultsBuf, statsBuf);
         if ( alignments == null ) {
-            throw new IllegalStateException("Unable to get alignments from bwa-mem index "+indexImageFile+": We don't know why.");
+            throw new IllegalStateException("Unable to get alignments from bwa-mem index "+indexImageFile+
+                    ": The batch's results may have passed 2GB, so try a smaller batch.");
         }
         return alignments;
     }
 
+    CompletableFuture<ByteBuffer> doAlignmentAsync( final ByteBuffer seqs, final int seqsFormat, final int outputFormat,
+                                                    final int jobFlags, final ByteBuffer opts,
+                                                    final BwaMemPairEndStatsByOrientation peStats ) {
+        final long indexAddr = refIndex(); // the job holds the index open until it's collected
+        final PendingAlignment pending = new PendingAlignment(this, seqs);
+        try {
+            synchronized ( pendingAlignments ) {
+                if ( alignmentCollector == null ) {
+                    alignmentCollector = new Thread(BwaMemIndex::collectAlignments, "bwa-mem-alignment-collector");
+                    alignmentCollector.setDaemon(true);
+                    alignmentCollector.start();
+                }
+                // the collector can't look for the job until we've registered it, because we're holding the lock
+                pendingAlignments.put(submitAlignments(seqs, seqsFormat, outputFormat, jobFlags, indexAddr, opts,
+                                                        peStats == null ? null : peStats.asArray()), pending);
+            }
+        } catch ( final RuntimeException e ) {
+            deRefIndex();
+            throw e;
+        }
+        return pending.alignments;
+    }
+
+    // the seqs are read pairs, with mates adjacent, and no more than maxPairs of them are examined (if positive)
+    // nPairsExamined[0] gets the number that were
+    BwaMemPairEndStatsByOrientation inferPairEndStats( final ByteBuffer seqs, final int seqsFormat,
+                                                       final ByteBuffer opts, final int maxPairs,
+                                                       final int[] nPairsExamined ) {
+        final double[] vals = new double[20]; // failed, low, high, average, and std for each orientation
+        nPairsExamined[0] = inferPairEndStats(seqs, seqsFormat, indexAddress, opts, maxPairs, vals);
+        final BwaMemPairEndStats[] stats = new BwaMemPairEndStats[4];
+        for ( int idx = 0; idx != stats.length; ++idx ) {
+            stats[idx] = BwaMemPairEndStats.fromInferred(vals[5*idx] != 0., vals[5*idx+3], vals[5*idx+4],
+                                                         (int)vals[5*idx+1], (int)vals[5*idx+2]);
+        }
+        return new BwaMemPairEndStatsByOrientation(stats[0], stats[1], stats[2], stats[3]);
+    }
+
+    private static void collectAlignments() {
+        while ( true ) {
+            final long jobAddr = awaitAlignments();
+            final PendingAlignment pending;
+            synchronized ( pendingAlignments ) {
+                pending = pendingAlignments.remove(jobAddr);
+            }
+            final ByteBuffer alignments = getAlignments(jobAddr);
+            pending.index.deRefIndex();
+            if ( alignments == null ) {
+                pending.alignments.completeExceptionally(new IllegalStateException(
+                        "Unable to get alignments from bwa-mem index "+pending.index.indexImageFile+
+                        ": The batch's results may have passed 2GB, so try a smaller batch."));
+            } else {
+                pending.alignments.complete(alignments);
+            }
+        }
+    }
+
     private static void assertNonEmptyReadableIndexFile(final String index, final String fileName ) {
         if ( !nonEmptyReadableFile(fileName) )
             throw new CouldNotReadIndexException(index, "Missing bwa index file: "+ fileName);
@@ -477,12 +867,30 @@ public final class BwaMemIndex implements AutoCloseable {
     }
 
     private static native boolean createReferenceIndex(String referenceName, String indexPrefix, String algorithmName);
-    private static native boolean createIndexImageFile(String indexPrefix, String imageName );
-    private static native long openIndex( String indexImageFile );
+    private static native boolean createIndexImageFile( String indexPrefix, String imageName,
+                                                        ImageProgressListener listener, boolean compressed );
+    private static native long openIndex( String indexImageFile, int options );
     private static native int destroyIndex( long indexAddress );
     static native ByteBuffer createDefaultOptions();
     private static native ByteBuffer getRefContigNames( long indexAddress );
-    private static native ByteBuffer createAlignments( ByteBuffer seqs, long indexAddress, ByteBuffer opts, BwaMemPairEndStats peStats);
+    private static native void setResultCacheCapacity( long indexAddress, long nBytes );
+    private static native void getResultCacheCounters( long indexAddress, long[] counters );
+    private static native String getSharedMemoryName( long indexAddress );
+    private static native ByteBuffer createAlignments( ByteBuffer seqs, int seqsFormat, int outputFormat, int jobFlags,
+                                                       long indexAddress, ByteBuffer opts, BwaMemPairEndStats[] peStats,
+                                                       ByteBuffer resultsBuf, ByteBuffer statsBuf );
+    private static native long submitAlignments( ByteBuffer seqs, int seqsFormat, int outputFormat, int jobFlags,
+                                                 long indexAddress, ByteBuffer opts, BwaMemPairEndStats[] peStats);
+    private static native int inferPairEndStats( ByteBuffer seqs, int seqsFormat, long indexAddress, ByteBuffer opts,
+                                                 int maxPairs, double[] peStatsOut );
+    private static native long awaitAlignments();
+    private static native ByteBuffer getAlignments( long jobAddress );
     static native void destroyByteBuffer( ByteBuffer alignments );
+    static native void exportColumnsToArrow( ByteBuffer columns, boolean copy, long arrowSchemaAddress,
+                                             long arrowArrayAddress );
+    // for the tests:  releases an ArrowSchema (or ArrowArray) the way an Arrow consumer would
+    static native void releaseArrowStruct( long address, boolean isArray );
     private static native String getVersion();
+    private static native boolean setThreadPool( int nThreads, boolean pinThreads );
+    private static native int getNPoolThreads();
 }
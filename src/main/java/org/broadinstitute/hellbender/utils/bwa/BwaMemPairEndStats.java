@@ -1,7 +1,8 @@
 package org.broadinstitute.hellbender.utils.bwa;
 
 /**
- * Equivalent to Bwa's mem_pestat_t struct.
+ * Equivalent to Bwa's mem_pestat_t struct, which describes the insert sizes for one orientation of read pairs.
+ * (See {@link BwaMemPairEndStatsByOrientation} for all four.)
  * At the time this was written such a type declaration looked like this:
  * <pre>
  *    // bwamem.h
@@ -14,6 +15,12 @@ package org.broadinstitute.hellbender.utils.bwa;
  */
 public final class BwaMemPairEndStats {
 
+    /**
+     * The relative orientations of a pair of reads, in bwa's order.  The first letter is the strand of the read
+     * that's leftmost on the reference, and the second that of its mate.  Ordinary paired-end libraries are FR.
+     */
+    public enum Orientation { FF, FR, RF, RR }
+
     /**
      * Default number of std. deviation from the mean for the lowest and highest insert size that is considered normal.
      * <p>
@@ -155,6 +162,24 @@ public final class BwaMemPairEndStats {
         }
     }
 
+    /**
+     * Stats that bwa inferred, which needn't satisfy the constraints of the public constructors
+     * (e.g., an orientation with few pairs can have a tiny average).
+     */
+    static BwaMemPairEndStats fromInferred( final boolean failed, final double average, final double std,
+                                            final int low, final int high ) {
+        return failed ? FAILED : new BwaMemPairEndStats(average, std, low, high, false);
+    }
+
+    private BwaMemPairEndStats(final double average, final double std, final int low, final int high,
+                               final boolean failed) {
+        this.failed = failed;
+        this.average = average;
+        this.std = std;
+        this.low = low;
+        this.high = high;
+    }
+
     /**
      * Constructor used to create the singleton {@link #FAILED} instance.
      */
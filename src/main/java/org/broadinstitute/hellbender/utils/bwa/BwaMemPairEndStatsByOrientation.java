@@ -0,0 +1,60 @@
+package org.broadinstitute.hellbender.utils.bwa;
+
+import java.util.Arrays;
+
+/**
+ * Pair-end insert size stats for each of the four orientations bwa considers (bwa's mem_pestat_t[4]).
+ * bwa only pairs reads in orientations whose stats haven't failed.
+ * <p>
+ *     You can build one yourself, or infer one from a sample of read pairs with
+ *     {@link BwaMemAligner#estimatePairEndStats}, and then hand it to any number of aligners with
+ *     {@link BwaMemAligner#setPairEndStats}, so that they needn't infer the stats anew for each batch.
+ * </p>
+ */
+public final class BwaMemPairEndStatsByOrientation {
+    /** Every orientation failed:  bwa won't infer stats, and won't consider any pair proper. */
+    public static final BwaMemPairEndStatsByOrientation NONE =
+            new BwaMemPairEndStatsByOrientation(null, null, null, null);
+
+    private final BwaMemPairEndStats[] stats; // indexed by orientation ordinal, which is bwa's index
+
+    /** null for any orientation means that it has failed */
+    public BwaMemPairEndStatsByOrientation( final BwaMemPairEndStats ff, final BwaMemPairEndStats fr,
+                                            final BwaMemPairEndStats rf, final BwaMemPairEndStats rr ) {
+        stats = new BwaMemPairEndStats[] { ff, fr, rf, rr };
+        for ( int idx = 0; idx != stats.length; ++idx ) {
+            if ( stats[idx] == null ) stats[idx] = BwaMemPairEndStats.FAILED;
+        }
+    }
+
+    /** stats for an ordinary paired-end library, where only FR pairs are proper */
+    public static BwaMemPairEndStatsByOrientation forFRPairs( final BwaMemPairEndStats fr ) {
+        return new BwaMemPairEndStatsByOrientation(null, fr, null, null);
+    }
+
+    public BwaMemPairEndStats get( final BwaMemPairEndStats.Orientation orientation ) {
+        return stats[orientation.ordinal()];
+    }
+
+    // for the native code, which reads all four
+    BwaMemPairEndStats[] asArray() { return stats; }
+
+    @Override
+    public String toString() {
+        final StringBuilder sb = new StringBuilder("{");
+        for ( final BwaMemPairEndStats.Orientation orientation : BwaMemPairEndStats.Orientation.values() ) {
+            if ( orientation.ordinal() != 0 ) sb.append(", ");
+            sb.append(orientation).append(": ").append(get(orientation));
+        }
+        return sb.append('}').toString();
+    }
+
+    @Override
+    public boolean equals( final Object other ) {
+        return other instanceof BwaMemPairEndStatsByOrientation &&
+                Arrays.equals(stats, ((BwaMemPairEndStatsByOrientation)other).stats);
+    }
+
+    @Override
+    public int hashCode() { return Arrays.hashCode(stats); }
+}
@@ -0,0 +1,35 @@
+package org.broadinstitute.hellbender.utils.bwa;
+
+/**
+ * One entry in the reference dictionary of a bwa index, as bwa's bntann1_t describes it.
+ * Get them from {@link BwaMemIndex#getReferenceContigs}, so you needn't read the .dict or the FASTA
+ * to build a sequence dictionary.
+ */
+public final class BwaMemReferenceContig {
+    private final int index;     // the refId that alignments to this contig have
+    private final String name;
+    private final int length;
+    private final long offset;   // where the contig starts in bwa's concatenation of the whole reference
+    private final boolean isAlt; // whether it's listed in the index's .alt file
+
+    public BwaMemReferenceContig( final int index, final String name, final int length,
+                                  final long offset, final boolean isAlt ) {
+        this.index = index;
+        this.name = name;
+        this.length = length;
+        this.offset = offset;
+        this.isAlt = isAlt;
+    }
+
+    /** the contig's position in the dictionary, which is the refId of the alignments to it */
+    public int getIndex() { return index; }
+    public String getName() { return name; }
+    public int getLength() { return length; }
+    /** where the contig starts in bwa's concatenation of all the contigs */
+    public long getOffset() { return offset; }
+    /** true if the contig is an ALT contig */
+    public boolean isAlt() { return isAlt; }
+
+    @Override
+    public String toString() { return name + ":" + length + (isAlt ? " (ALT)" : ""); }
+}
@@ -2,20 +2,28 @@ package org.broadinstitute.hellbender.utils.bwa;
 
 import org.testng.Assert;
 import org.testng.Reporter;
+import org.testng.SkipException;
 import org.testng.annotations.AfterClass;
 import org.testng.annotations.BeforeClass;
 import org.testng.annotations.DataProvider;
 import org.testng.annotations.Test;
 
+import java.io.ByteArrayOutputStream;
 import java.io.File;
 import java.io.FileWriter;
 import java.io.IOException;
 import java.io.PrintWriter;
+import java.nio.ByteBuffer;
+import java.nio.channels.Channels;
+import java.nio.file.Files;
 import java.util.ArrayList;
 import java.util.Collections;
 import java.util.List;
 import java.util.Random;
 import java.util.*;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
 import java.util.stream.Stream;
 
 @Test
@@ -24,12 +32,13 @@ public final class BwaMemIndexTest {
 
     private static final String[] INDEX_EXTENSIONS = {".amb", ".ann", ".bwt", ".pac", ".sa" };
 
+    private static final String INDEX_IMAGE_FILE = "src/test/resources/ref.fa.img";
+
     @BeforeClass
     void openIndex() {
-        final String indexImageFile = "src/test/resources/ref.fa.img";
-        new File(indexImageFile).deleteOnExit();
-        BwaMemIndex.createIndexImageFromIndexFiles("src/test/resources/ref.fa", indexImageFile );
-        index = new BwaMemIndex(indexImageFile);
+        new File(INDEX_IMAGE_FILE).deleteOnExit();
+        BwaMemIndex.createIndexImageFromIndexFiles("src/test/resources/ref.fa", INDEX_IMAGE_FILE );
+        index = new BwaMemIndex(INDEX_IMAGE_FILE);
     }
 
     @AfterClass
@@ -57,6 +66,101 @@ public final class BwaMemIndexTest {
         testAlignment(alignmentList.get(0), 0, 70, 0, 70, "70M", 0, 0);
     }
 
+    @Test
+    void testImageProgress() throws IOException {
+        final File imageFile = File.createTempFile("progress", ".img");
+        imageFile.deleteOnExit();
+        final long[] lastReport = new long[2];
+        BwaMemIndex.createIndexImageFromIndexFiles("src/test/resources/ref.fa", imageFile.getPath(),
+                (bytesWritten, imageSize) -> { lastReport[0] = bytesWritten; lastReport[1] = imageSize; });
+        Assert.assertEquals(lastReport[0], lastReport[1]);
+        Assert.assertEquals(imageFile.length(), lastReport[1]);
+        Assert.assertEquals(imageFile.length(), new File(INDEX_IMAGE_FILE).length());
+    }
+
+    @Test
+    void testCompressedImage() throws IOException {
+        final File imageFile = File.createTempFile("compressed", ".img");
+        imageFile.deleteOnExit();
+        BwaMemIndex.createIndexImageFromIndexFiles("src/test/resources/ref.fa", imageFile.getPath(), null, true);
+        Assert.assertTrue(imageFile.length() < new File(INDEX_IMAGE_FILE).length());
+        try ( final BwaMemIndex zIndex = new BwaMemIndex(imageFile.getPath());
+              final BwaMemAligner aligner = new BwaMemAligner(zIndex) ) {
+            final List<List<BwaMemAlignment>> alignments = aligner.alignSeqs(Collections.singletonList(
+                    "GGCTTTTAATGCTTTTCAGTGGTTGCTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT".getBytes()));
+            testAlignment(alignments.get(0).get(0), 0, 70, 0, 70, "70M", 0, 0);
+        }
+    }
+
+    @Test
+    void testOpenOptions() {
+        final BwaMemIndex.OpenOption[][] optionSets = {
+                { BwaMemIndex.OpenOption.POPULATE, BwaMemIndex.OpenOption.BWT_RANDOM, BwaMemIndex.OpenOption.SA_RANDOM },
+                { BwaMemIndex.OpenOption.TOUCH, BwaMemIndex.OpenOption.BWT_WILLNEED, BwaMemIndex.OpenOption.SA_WILLNEED },
+                { BwaMemIndex.OpenOption.TRANSPARENT_HUGE_PAGES },
+                { BwaMemIndex.OpenOption.HUGETLB_PAGES },
+                { BwaMemIndex.OpenOption.SHARED_MEMORY, BwaMemIndex.OpenOption.LOCK_IN_MEMORY },
+                { BwaMemIndex.OpenOption.VERIFY_CHECKSUMS } };
+        for ( final BwaMemIndex.OpenOption[] options : optionSets ) {
+            try ( final BwaMemIndex optIndex = new BwaMemIndex(INDEX_IMAGE_FILE, options);
+                  final BwaMemAligner aligner = new BwaMemAligner(optIndex) ) {
+                final List<List<BwaMemAlignment>> alignments = aligner.alignSeqs(Collections.singletonList(
+                        "GGCTTTTAATGCTTTTCAGTGGTTGCTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT".getBytes()));
+                testAlignment(alignments.get(0).get(0), 0, 70, 0, 70, "70M", 0, 0);
+            }
+        }
+    }
+
+    @Test
+    void testSharedMemory() {
+        final File shmDir = new File("/dev/shm");
+        if ( !shmDir.isDirectory() ) throw new SkipException("no /dev/shm to check the segment in");
+        Assert.assertNull(index.getSharedMemoryName());
+        final BwaMemIndex index1 = new BwaMemIndex(INDEX_IMAGE_FILE, BwaMemIndex.OpenOption.SHARED_MEMORY);
+        final BwaMemIndex index2 = new BwaMemIndex(INDEX_IMAGE_FILE, BwaMemIndex.OpenOption.SHARED_MEMORY);
+        final String name = index1.getSharedMemoryName();
+        Assert.assertNotNull(name, "the image should have been loaded into a shared memory segment");
+        Assert.assertEquals(index2.getSharedMemoryName(), name);
+        final File segment = new File(shmDir, name);
+        Assert.assertTrue(segment.exists());
+        index1.close();
+        Assert.assertTrue(segment.exists()); // index2 is still using it
+        index2.close();
+        Assert.assertFalse(segment.exists());
+    }
+
+    @Test
+    void testImageIntegrity() throws IOException {
+        final byte[] image = Files.readAllBytes(new File(INDEX_IMAGE_FILE).toPath());
+        final File imageFile = File.createTempFile("integrity", ".img");
+        imageFile.deleteOnExit();
+
+        // images written before there was an integrity header (which fills the first page) still open
+        Files.write(imageFile.toPath(), Arrays.copyOfRange(image, 4096, image.length));
+        new BwaMemIndex(imageFile.getPath(), BwaMemIndex.OpenOption.VERIFY_CHECKSUMS).close();
+
+        // a truncated image is caught as it's opened
+        Files.write(imageFile.toPath(), Arrays.copyOf(image, image.length - 1));
+        try {
+            new BwaMemIndex(imageFile.getPath()).close();
+            Assert.fail("a truncated image should fail to open");
+        } catch ( final CouldNotReadImageException cnrie ) {
+            // expected
+        }
+
+        // a flipped bit in the reference is caught only by the full check
+        final byte[] corrupt = image.clone();
+        corrupt[corrupt.length - 10] ^= 1;
+        Files.write(imageFile.toPath(), corrupt);
+        new BwaMemIndex(imageFile.getPath()).close();
+        try {
+            new BwaMemIndex(imageFile.getPath(), BwaMemIndex.OpenOption.VERIFY_CHECKSUMS).close();
+            Assert.fail("a corrupt image should fail its checksums");
+        } catch ( final CouldNotReadImageException cnrie ) {
+            // expected
+        }
+    }
+
     @Test
     void testMulti() {
         final List<String> seqs = new ArrayList<>();
@@ -81,6 +185,447 @@ public final class BwaMemIndexTest {
         testAlignment(alignmentList.get(0), 70, 140, 0, 68, "32M2D36M", 2, 0); // 2-base deletion
     }
 
+    @Test
+    void testThreadPool() {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        seqs.add("AATACTTCTTTTGAAGCTGCAGTTGTTGCTGCCTTCAACATTAGAATTAATGGGTATTCAATATGATT"); // 2-base deletion
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        aligner.setNThreadsOption(4);
+        try {
+            BwaMemIndex.configureThreadPool(3, false);
+            Assert.assertEquals(BwaMemIndex.getThreadPoolSize(), 3);
+            BwaMemIndex.configureThreadPool(1, false);
+            Assert.assertEquals(BwaMemIndex.getThreadPoolSize(), 1);
+            // a fixed pool doesn't grow to match the aligner's 4 slots, but the batch still gets done
+            testAlignment(aligner.alignSeqs(seqs,String::getBytes).get(2).get(0), 70, 140, 0, 68, "32M2D36M", 2, 0);
+            Assert.assertEquals(BwaMemIndex.getThreadPoolSize(), 1);
+            // changing the pinning restarts the threads
+            BwaMemIndex.configureThreadPool(2, true);
+            Assert.assertEquals(BwaMemIndex.getThreadPoolSize(), 2);
+            testAlignment(aligner.alignSeqs(seqs,String::getBytes).get(2).get(0), 70, 140, 0, 68, "32M2D36M", 2, 0);
+            BwaMemIndex.configureThreadPool(2, false);
+            Assert.assertEquals(BwaMemIndex.getThreadPoolSize(), 2);
+            try {
+                BwaMemIndex.configureThreadPool(-1, false);
+                Assert.fail("a negative number of threads should be rejected");
+            } catch ( final IllegalArgumentException iae ) {
+                // expected
+            }
+        } finally {
+            BwaMemIndex.configureThreadPool(0, false);
+        }
+        // back to growing on demand
+        Assert.assertEquals(BwaMemIndex.getThreadPoolSize(), 0);
+        testAlignment(aligner.alignSeqs(seqs,String::getBytes).get(2).get(0), 70, 140, 0, 68, "32M2D36M", 2, 0);
+        Assert.assertTrue(BwaMemIndex.getThreadPoolSize() > 0);
+    }
+
+    @Test
+    void testPackedSeqs() {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        seqs.add("AATACTTCTTTTGAAGCTGCAGTTGTTGCTGCCTTCAACATTAGAATTAATGGGTATTCAATATGATT"); // 2-base deletion
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        aligner.setPackedSeqsInput(true);
+        final List<List<BwaMemAlignment>> alignments = aligner.alignSeqs(seqs,String::getBytes);
+        Assert.assertEquals(alignments.size(), 3);
+        Assert.assertEquals(alignments.get(0).size(), 1);
+        testAlignment(alignments.get(0).get(0), 0, 70, 0, 70, "70M", 3, 0); // 3 snvs
+        Assert.assertEquals(alignments.get(1).size(), 1);
+        testAlignment(alignments.get(1).get(0), 0, 70, 0, 70, "70M", 0, 0x10); // rc
+        Assert.assertEquals(alignments.get(2).size(), 1);
+        testAlignment(alignments.get(2).get(0), 70, 140, 0, 68, "32M2D36M", 2, 0); // 2-base deletion
+    }
+
+    @Test
+    void testBatchStats() {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        aligner.setNThreadsOption(2);
+        aligner.setCollectStats(true);
+        final List<List<BwaMemAlignment>> alignments = aligner.alignSeqs(seqs,String::getBytes);
+        final BwaMemBatchStats stats = aligner.getLastBatchStats();
+        Assert.assertNotNull(stats);
+        Assert.assertEquals(stats.getNThreads(), 2);
+        Assert.assertEquals(stats.getTotal(BwaMemBatchStats.ThreadValue.RECORDS),
+                alignments.get(0).size() + alignments.get(1).size());
+        Assert.assertTrue(stats.getStageNanos(BwaMemBatchStats.Stage.TOTAL) >=
+                stats.getStageNanos(BwaMemBatchStats.Stage.SEED_EXTEND) +
+                stats.getStageNanos(BwaMemBatchStats.Stage.PAIR_FORMAT));
+        aligner.setCollectStats(false);
+        aligner.alignSeqs(seqs,String::getBytes);
+        Assert.assertNull(aligner.getLastBatchStats());
+    }
+
+    @Test
+    void testResultsBuffer() {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        final ByteBuffer tooSmall = ByteBuffer.allocateDirect(16);
+        aligner.setResultsBuffer(tooSmall);
+        List<List<BwaMemAlignment>> alignments = aligner.alignSeqs(seqs,String::getBytes);
+        testAlignment(alignments.get(0).get(0), 0, 70, 0, 70, "70M", 3, 0); // 3 snvs
+        final ByteBuffer grown = aligner.getResultsBuffer();
+        Assert.assertNotSame(grown, tooSmall);
+        alignments = aligner.alignSeqs(seqs,String::getBytes);
+        testAlignment(alignments.get(0).get(0), 0, 70, 0, 70, "70M", 3, 0); // 3 snvs
+        Assert.assertSame(aligner.getResultsBuffer(), grown);
+    }
+
+    @Test
+    void testLazyAlignments() {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        seqs.add("AATACTTCTTTTGAAGCTGCAGTTGTTGCTGCCTTCAACATTAGAATTAATGGGTATTCAATATGATT"); // 2-base deletion
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        final List<List<BwaMemAlignment>> expected = aligner.alignSeqs(seqs,String::getBytes);
+        aligner.setResultsBuffer(ByteBuffer.allocateDirect(4096));
+        final BwaMemAlignmentBatch batch = aligner.alignSeqsLazily(seqs,String::getBytes);
+        Assert.assertEquals(batch.getNSequences(), 3);
+        final BwaMemAlignmentView view = batch.newView();
+        for ( int seqIdx = 0; seqIdx != 3; ++seqIdx ) {
+            Assert.assertEquals(batch.getNAlignments(seqIdx), expected.get(seqIdx).size());
+            final BwaMemAlignment alignment = expected.get(seqIdx).get(0);
+            view.moveTo(seqIdx, 0);
+            testAlignment(view.toAlignment(), alignment.getRefStart(), alignment.getRefEnd(), alignment.getSeqStart(),
+                    alignment.getSeqEnd(), alignment.getCigar(), alignment.getNMismatches(), alignment.getSamFlag());
+            Assert.assertEquals(view.getMDTag(), alignment.getMDTag());
+        }
+        final int[] cigarOps = view.moveTo(2, 0).getCigarOps(null);
+        Assert.assertEquals(cigarOps.length, 3);
+        Assert.assertEquals(BwaMemAlignmentView.getCigarOpChar(cigarOps[1]), 'D');
+        Assert.assertEquals(BwaMemAlignmentView.getCigarOpLength(cigarOps[1]), 2);
+        // while the batch holds the results buffer, other batches get their own
+        Assert.assertEquals(aligner.alignSeqs(seqs,String::getBytes).size(), 3);
+        Assert.assertEquals(view.getRefStart(), expected.get(2).get(0).getRefStart());
+        // a batch that overflows it meanwhile replaces it with a larger one
+        final ByteBuffer lent = aligner.getResultsBuffer();
+        final List<String> manySeqs = new ArrayList<>();
+        for ( int idx = 0; idx != 100; ++idx ) {
+            manySeqs.addAll(seqs);
+        }
+        Assert.assertEquals(aligner.alignSeqs(manySeqs,String::getBytes).size(), manySeqs.size());
+        final ByteBuffer grown = aligner.getResultsBuffer();
+        Assert.assertNotSame(grown, lent);
+        Assert.assertEquals(view.getRefStart(), expected.get(2).get(0).getRefStart());
+        batch.close();
+        try {
+            view.getRefStart();
+            Assert.fail("a view of a closed batch should be unusable");
+        } catch ( final IllegalStateException ise ) {
+            // expected
+        }
+        // which is reused once the batch that held the old one is closed
+        try ( final BwaMemAlignmentBatch nextBatch = aligner.alignSeqsLazily(manySeqs,String::getBytes) ) {
+            Assert.assertSame(nextBatch.getBuffer(), grown);
+        }
+        Assert.assertSame(aligner.getResultsBuffer(), grown);
+    }
+
+    @Test
+    void testBamRecords() throws IOException {
+        final String seq = "AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"; // rc
+        final byte[] quals = new byte[seq.length()];
+        for ( int idx = 0; idx != quals.length; ++idx ) quals[idx] = (byte)('!' + idx % 40);
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        try ( final BwaMemBamRecords records = aligner.alignSeqsToBam(Collections.singletonList(seq),
+                read -> "read1".getBytes(), String::getBytes, read -> quals) ) {
+            final ByteBuffer rec = records.getRecords(0);
+            final int blockSize = rec.getInt(0);
+            Assert.assertEquals(rec.remaining(), blockSize + 4); // just the one record
+            Assert.assertEquals(rec.getInt(4), 0); // refID
+            Assert.assertEquals(rec.getInt(8), 0); // pos
+            Assert.assertEquals(rec.get(12), 6); // l_read_name
+            Assert.assertEquals(rec.getShort(14) & 0xffff, 4681); // bin
+            Assert.assertEquals(rec.getShort(16), 1); // n_cigar_op
+            Assert.assertEquals(rec.getShort(18), 0x10); // flag
+            Assert.assertEquals(rec.getInt(20), seq.length()); // l_seq
+            Assert.assertEquals(rec.getInt(24), -1); // next_refID
+            Assert.assertEquals(rec.get(36 + 5), 0); // name terminator
+            Assert.assertEquals(rec.getInt(42), 70 << 4); // 70M
+            // reverse-complemented, so the first base is the complement of the last, and the quals are reversed
+            Assert.assertEquals(rec.get(46) & 0xf0, 0x40); // G
+            Assert.assertEquals(rec.get(46 + 35), quals[quals.length - 1] - 33);
+            final ByteArrayOutputStream os = new ByteArrayOutputStream();
+            Assert.assertEquals(records.writeTo(Channels.newChannel(os)), blockSize + 4);
+        }
+    }
+
+    @Test
+    void testAsync() throws Exception {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        aligner.setNThreadsOption(2);
+        final CompletableFuture<List<List<BwaMemAlignment>>> future1 =
+                aligner.alignSeqsAsync(seqs.subList(0, 1), String::getBytes);
+        final ExecutorService decoder = Executors.newSingleThreadExecutor();
+        final CompletableFuture<List<List<BwaMemAlignment>>> future2 =
+                aligner.alignSeqsAsync(seqs.subList(1, 2), String::getBytes, decoder);
+        List<List<BwaMemAlignment>> alignments = future1.get();
+        Assert.assertEquals(alignments.size(), 1);
+        Assert.assertEquals(alignments.get(0).size(), 1);
+        testAlignment(alignments.get(0).get(0), 0, 70, 0, 70, "70M", 3, 0); // 3 snvs
+        alignments = future2.get();
+        Assert.assertEquals(alignments.size(), 1);
+        Assert.assertEquals(alignments.get(0).size(), 1);
+        testAlignment(alignments.get(0).get(0), 0, 70, 0, 70, "70M", 0, 0x10); // rc
+        decoder.shutdown();
+    }
+
+    @Test
+    void testSession() {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        seqs.add("AATACTTCTTTTGAAGCTGCAGTTGTTGCTGCCTTCAACATTAGAATTAATGGGTATTCAATATGATT"); // 2-base deletion
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        aligner.setNThreadsOption(1);
+        aligner.setChunkSizeOption(1); // one sequence per chunk
+        final List<List<BwaMemAlignment>> alignments = new ArrayList<>();
+        try ( final BwaMemAlignerSession session = new BwaMemAlignerSession(aligner, 2) ) {
+            for ( int idx = 0; idx != 6; ++idx ) {
+                final byte[] seq = seqs.get(idx % 3).getBytes();
+                while ( !session.push(seq) ) {
+                    alignments.add(session.take());
+                }
+            }
+            session.finish();
+            List<BwaMemAlignment> alignmentList;
+            while ( (alignmentList = session.take()) != null ) {
+                alignments.add(alignmentList);
+            }
+            Assert.assertTrue(session.isDone());
+        }
+        Assert.assertEquals(alignments.size(), 6);
+        for ( int idx = 0; idx != 6; idx += 3 ) {
+            testAlignment(alignments.get(idx).get(0), 0, 70, 0, 70, "70M", 3, 0); // 3 snvs
+            testAlignment(alignments.get(idx+1).get(0), 0, 70, 0, 70, "70M", 0, 0x10); // rc
+            testAlignment(alignments.get(idx+2).get(0), 70, 140, 0, 68, "32M2D36M", 2, 0); // 2-base deletion
+        }
+    }
+
+    @Test
+    void testDedupSeqs() {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // dup of the 1st
+        seqs.add("AATACTTCTTTTGAAGCTGCAGTTGTTGCTGCCTTCAACATTAGAATTAATGGGTATTCAATATGATT"); // 2-base deletion
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // dup of the 2nd
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        final List<List<BwaMemAlignment>> expected = aligner.alignSeqs(seqs, String::getBytes);
+        aligner.setDedupSeqs(true);
+        final List<List<BwaMemAlignment>> alignments = aligner.alignSeqs(seqs, String::getBytes);
+        Assert.assertEquals(alignments.size(), 5);
+        for ( int seqIdx = 0; seqIdx != 5; ++seqIdx ) {
+            Assert.assertEquals(alignments.get(seqIdx).size(), expected.get(seqIdx).size());
+            final BwaMemAlignment alignment = expected.get(seqIdx).get(0);
+            testAlignment(alignments.get(seqIdx).get(0), alignment.getRefStart(), alignment.getRefEnd(),
+                    alignment.getSeqStart(), alignment.getSeqEnd(), alignment.getCigar(), alignment.getNMismatches(),
+                    alignment.getSamFlag());
+        }
+        testAlignment(alignments.get(4).get(0), 0, 70, 0, 70, "70M", 0, 0x10); // rc
+    }
+
+    @Test
+    void testPrimaryOnly() {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        seqs.add("AATACTTCTTTTGAAGCTGCAGTTGTTGCTGCCTTCAACATTAGAATTAATGGGTATTCAATATGATT"); // 2-base deletion
+        seqs.add("ACGTACGTACGTACGTACGTACGTACGTACGTACGT"); // no good alignment, probably
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        final List<List<BwaMemAlignment>> expected = aligner.alignSeqs(seqs, String::getBytes);
+        final List<BwaMemAlignment> alignments = aligner.alignSeqsPrimary(seqs, String::getBytes);
+        Assert.assertEquals(alignments.size(), 4);
+        for ( int seqIdx = 0; seqIdx != 4; ++seqIdx ) {
+            final BwaMemAlignment primary = alignments.get(seqIdx);
+            final BwaMemAlignment alignment = expected.get(seqIdx).get(0);
+            Assert.assertEquals(primary.getSamFlag(), alignment.getSamFlag());
+            Assert.assertEquals(primary.getRefId(), alignment.getRefId());
+            Assert.assertEquals(primary.getRefStart(), alignment.getRefStart());
+            Assert.assertEquals(primary.getRefEnd(), alignment.getRefEnd());
+            Assert.assertEquals(primary.getSeqStart(), alignment.getSeqStart());
+            Assert.assertEquals(primary.getSeqEnd(), alignment.getSeqEnd());
+            Assert.assertEquals(primary.getCigar(), alignment.getCigar());
+            Assert.assertEquals(primary.getNMismatches(), alignment.getNMismatches());
+            Assert.assertEquals(primary.getMapQual(), alignment.getMapQual());
+            Assert.assertNull(primary.getMDTag());
+            Assert.assertNull(primary.getXATag());
+        }
+        testAlignment(alignments.get(2), 70, 140, 0, 68, "32M2D36M", 2, 0); // 2-base deletion
+    }
+
+    @Test
+    void testColumns() {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        seqs.add("AATACTTCTTTTGAAGCTGCAGTTGTTGCTGCCTTCAACATTAGAATTAATGGGTATTCAATATGATT"); // 2-base deletion
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        final List<List<BwaMemAlignment>> expected = aligner.alignSeqs(seqs, String::getBytes);
+        try ( final BwaMemAlignmentColumns columns = aligner.alignSeqsToColumns(seqs, String::getBytes) ) {
+            Assert.assertEquals(columns.getNSequences(), 3);
+            final List<List<BwaMemAlignment>> decoded = columns.toAlignments();
+            for ( int seqIdx = 0; seqIdx != 3; ++seqIdx ) {
+                Assert.assertEquals(columns.getNAlignments(seqIdx), expected.get(seqIdx).size());
+                final BwaMemAlignment alignment = expected.get(seqIdx).get(0);
+                testAlignment(decoded.get(seqIdx).get(0), alignment.getRefStart(), alignment.getRefEnd(),
+                        alignment.getSeqStart(), alignment.getSeqEnd(), alignment.getCigar(),
+                        alignment.getNMismatches(), alignment.getSamFlag());
+                Assert.assertEquals(decoded.get(seqIdx).get(0).getMDTag(), alignment.getMDTag());
+            }
+            final int alignIdx = columns.getFirstAlignment(2);
+            Assert.assertEquals(columns.getRefIds().get(alignIdx), 0);
+            Assert.assertEquals(columns.getRefStarts().get(alignIdx), 70);
+            Assert.assertEquals(columns.getNMismatches().get(alignIdx), 2);
+            Assert.assertEquals(columns.getCigar(alignIdx), "32M2D36M");
+            Assert.assertEquals(columns.getCigarOffsets().get(alignIdx + 1) - columns.getCigarOffsets().get(alignIdx), 3);
+            Assert.assertEquals(columns.getMDTag(alignIdx), expected.get(2).get(0).getMDTag());
+            try {
+                columns.exportToArrow(0L, 0L);
+                Assert.fail("there must be somewhere to put the Arrow structs");
+            } catch ( final IllegalArgumentException iae ) {
+                // expected
+            }
+            Assert.assertTrue(columns.isOpen());
+        }
+    }
+
+    // byte offsets into Arrow's C data interface structs, on a 64-bit machine
+    private static final int ARROW_SCHEMA_SIZE = 72;
+    private static final int SCHEMA_FORMAT = 0, SCHEMA_NAME = 8, SCHEMA_N_CHILDREN = 32, SCHEMA_CHILDREN = 40,
+                             SCHEMA_RELEASE = 56;
+    private static final int ARROW_ARRAY_SIZE = 80;
+    private static final int ARRAY_LENGTH = 0, ARRAY_NULL_COUNT = 8, ARRAY_N_CHILDREN = 32, ARRAY_BUFFERS = 40,
+                             ARRAY_CHILDREN = 48, ARRAY_RELEASE = 64;
+
+    // plays Arrow's part by reading the structs directly, and releasing them as a consumer would
+    @Test
+    void testArrowExport() throws ReflectiveOperationException {
+        final sun.misc.Unsafe unsafe = getUnsafe();
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        seqs.add("AATACTTCTTTTGAAGCTGCAGTTGTTGCTGCCTTCAACATTAGAATTAATGGGTATTCAATATGATT"); // 2-base deletion
+        seqs.add("NNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNN"); // unmapped, so no MD
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        final ByteBuffer tooSmall = ByteBuffer.allocateDirect(16);
+        aligner.setResultsBuffer(tooSmall);
+        // the first time, the columns don't fit in the results buffer, and Arrow takes over the native buffer they're
+        // in instead (and the results buffer grows);  the second time, they're copied out of the results buffer
+        for ( int pass = 0; pass != 2; ++pass ) {
+            final long schema = unsafe.allocateMemory(ARROW_SCHEMA_SIZE);
+            final long array = unsafe.allocateMemory(ARROW_ARRAY_SIZE);
+            final long movedChild = unsafe.allocateMemory(ARROW_ARRAY_SIZE);
+            try {
+                final BwaMemAlignmentColumns columns = aligner.alignSeqsToColumns(seqs, String::getBytes);
+                final int nAligns = columns.getNAlignments();
+                final int[] refStarts = new int[nAligns];
+                columns.getRefStarts().get(refStarts);
+                final boolean[] hasMD = new boolean[nAligns];
+                int nNoMD = 0;
+                for ( int alignIdx = 0; alignIdx != nAligns; ++alignIdx ) {
+                    hasMD[alignIdx] = columns.getMDTag(alignIdx) != null;
+                    if ( !hasMD[alignIdx] ) ++nNoMD;
+                }
+                Assert.assertTrue(nNoMD > 0);
+                columns.exportToArrow(schema, array);
+                Assert.assertFalse(columns.isOpen());
+                if ( pass == 0 ) {
+                    Assert.assertTrue(aligner.getResultsBuffer().capacity() > tooSmall.capacity());
+                }
+                // reusing the results buffer mustn't disturb what was exported from it
+                aligner.alignSeqs(Collections.singletonList(seqs.get(1)), String::getBytes);
+
+                Assert.assertEquals(readCString(unsafe, unsafe.getAddress(schema + SCHEMA_FORMAT)), "+s");
+                Assert.assertEquals(unsafe.getLong(schema + SCHEMA_N_CHILDREN), 14L);
+                final long schemaChildren = unsafe.getAddress(schema + SCHEMA_CHILDREN);
+                final long cigarSchema = unsafe.getAddress(schemaChildren + 5*8);
+                Assert.assertEquals(readCString(unsafe, unsafe.getAddress(cigarSchema + SCHEMA_NAME)), "cigar");
+                Assert.assertEquals(readCString(unsafe, unsafe.getAddress(cigarSchema + SCHEMA_FORMAT)), "+l");
+                Assert.assertEquals(unsafe.getLong(cigarSchema + SCHEMA_N_CHILDREN), 1L);
+                final long itemSchema = unsafe.getAddress(unsafe.getAddress(cigarSchema + SCHEMA_CHILDREN));
+                Assert.assertEquals(readCString(unsafe, unsafe.getAddress(itemSchema + SCHEMA_FORMAT)), "i");
+                final long mdSchema = unsafe.getAddress(schemaChildren + 9*8);
+                Assert.assertEquals(readCString(unsafe, unsafe.getAddress(mdSchema + SCHEMA_NAME)), "MD");
+                Assert.assertEquals(readCString(unsafe, unsafe.getAddress(mdSchema + SCHEMA_FORMAT)), "u");
+
+                Assert.assertEquals(unsafe.getLong(array + ARRAY_LENGTH), (long)nAligns);
+                Assert.assertEquals(unsafe.getLong(array + ARRAY_N_CHILDREN), 14L);
+                final long arrayChildren = unsafe.getAddress(array + ARRAY_CHILDREN);
+                final long seqArray = unsafe.getAddress(arrayChildren);
+                final long seqValues = unsafe.getAddress(unsafe.getAddress(seqArray + ARRAY_BUFFERS) + 8);
+                Assert.assertEquals(unsafe.getInt(seqValues + 4L*(nAligns - 1)), 3);
+                final long mdArray = unsafe.getAddress(arrayChildren + 9*8);
+                Assert.assertEquals(unsafe.getLong(mdArray + ARRAY_NULL_COUNT), (long)nNoMD);
+                final long mdValidity = unsafe.getAddress(unsafe.getAddress(mdArray + ARRAY_BUFFERS));
+                for ( int alignIdx = 0; alignIdx != nAligns; ++alignIdx ) {
+                    final boolean isValid = (unsafe.getByte(mdValidity + (alignIdx >> 3)) & (1 << (alignIdx & 7))) != 0;
+                    Assert.assertEquals(isValid, hasMD[alignIdx]);
+                }
+
+                // move the pos column out of its parent, which must then leave it be
+                final long posArray = unsafe.getAddress(arrayChildren + 4*8);
+                unsafe.copyMemory(posArray, movedChild, ARROW_ARRAY_SIZE);
+                unsafe.putAddress(posArray + ARRAY_RELEASE, 0L);
+                BwaMemIndex.releaseArrowStruct(array, true);
+                Assert.assertEquals(unsafe.getAddress(array + ARRAY_RELEASE), 0L);
+                Assert.assertNotEquals(unsafe.getAddress(movedChild + ARRAY_RELEASE), 0L);
+                final long posValues = unsafe.getAddress(unsafe.getAddress(movedChild + ARRAY_BUFFERS) + 8);
+                for ( int alignIdx = 0; alignIdx != nAligns; ++alignIdx ) {
+                    Assert.assertEquals(unsafe.getInt(posValues + 4L*alignIdx), refStarts[alignIdx]);
+                }
+                BwaMemIndex.releaseArrowStruct(movedChild, true);
+                Assert.assertEquals(unsafe.getAddress(movedChild + ARRAY_RELEASE), 0L);
+                BwaMemIndex.releaseArrowStruct(schema, false);
+                Assert.assertEquals(unsafe.getAddress(schema + SCHEMA_RELEASE), 0L);
+            } finally {
+                unsafe.freeMemory(schema);
+                unsafe.freeMemory(array);
+                unsafe.freeMemory(movedChild);
+            }
+        }
+    }
+
+    @Test
+    void testResultCache() {
+        final List<String> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGCTAGGTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT"); // 3 snvs
+        seqs.add("AATAATAGAGCTTACCATCTGCTGAGTAGACTCCATCTTGAGCAGCAACCACTGAAAAGCATTAAAAGCC"); // rc
+        // a separate index, so that the cache doesn't outlive the test
+        try ( final BwaMemIndex cachingIndex = new BwaMemIndex(INDEX_IMAGE_FILE);
+              final BwaMemAligner aligner = new BwaMemAligner(cachingIndex) ) {
+            Assert.assertEquals(cachingIndex.getResultCacheStats().getCapacity(), 0L);
+            cachingIndex.setResultCacheCapacity(1L << 20);
+            aligner.alignSeqs(seqs, String::getBytes);
+            BwaMemIndex.ResultCacheStats stats = cachingIndex.getResultCacheStats();
+            Assert.assertEquals(stats.getMisses(), 2L);
+            Assert.assertEquals(stats.getNEntries(), 2L);
+            final List<List<BwaMemAlignment>> alignments = aligner.alignSeqs(seqs, String::getBytes);
+            stats = cachingIndex.getResultCacheStats();
+            Assert.assertEquals(stats.getHits(), 2L);
+            Assert.assertEquals(stats.getMisses(), 2L);
+            testAlignment(alignments.get(0).get(0), 0, 70, 0, 70, "70M", 3, 0); // 3 snvs
+            testAlignment(alignments.get(1).get(0), 0, 70, 0, 70, "70M", 0, 0x10); // rc
+            // different options, different key
+            aligner.setMatchScoreOption(2);
+            aligner.alignSeqs(seqs, String::getBytes);
+            Assert.assertEquals(cachingIndex.getResultCacheStats().getMisses(), 4L);
+            cachingIndex.setResultCacheCapacity(0L);
+            Assert.assertEquals(cachingIndex.getResultCacheStats().getNEntries(), 0L);
+        }
+    }
+
     @Test(dataProvider = "testPairData")
     void testPair(final int defaultSetOrClearPEStats) {
         final List<String> seqs = new ArrayList<>();
@@ -95,9 +640,14 @@ public final class BwaMemIndexTest {
             case 2:
                 aligner.dontInferPairEndStats();
                 break;
+            case 3:
+                aligner.setPairEndStats(new BwaMemPairEndStatsByOrientation(null,
+                                            new BwaMemPairEndStats(200, 10, 1, 600), null, null));
+                break;
             default:
                 aligner.inferPairEndStats();
         }
+        final boolean properPair = defaultSetOrClearPEStats == 1 || defaultSetOrClearPEStats == 3;
         final List<List<BwaMemAlignment>> alignments = aligner.alignSeqs(seqs,String::getBytes);
         Assert.assertNotNull(alignments);
         Assert.assertEquals(alignments.size(), 2);
@@ -105,27 +655,138 @@ public final class BwaMemIndexTest {
         Assert.assertNotNull(alignmentList);
         Assert.assertEquals(alignmentList.size(), 1);
         BwaMemAlignment alignment = alignmentList.get(0);
-        testAlignment(alignment, 0, 70, 0, 70, "70M", 0, defaultSetOrClearPEStats == 1 ? 0x63 : 0x61);
+        testAlignment(alignment, 0, 70, 0, 70, "70M", 0, properPair ? 0x63 : 0x61);
         Assert.assertEquals(alignment.getMateRefStart(), 140);
         Assert.assertEquals(alignment.getTemplateLen(), 210);
         alignmentList = alignments.get(1);
         Assert.assertNotNull(alignmentList);
         Assert.assertEquals(alignmentList.size(), 1);
         alignment = alignmentList.get(0);
-        testAlignment(alignment, 140, 210, 0, 70, "70M", 0, defaultSetOrClearPEStats == 1 ? 0x93 : 0x91);
+        testAlignment(alignment, 140, 210, 0, 70, "70M", 0, properPair ? 0x93 : 0x91);
         Assert.assertEquals(alignment.getMateRefStart(), 0);
         Assert.assertEquals(alignment.getTemplateLen(), -210);
     }
 
     @DataProvider(name = "testPairData")
     public Object[][] testPairData() {
-        final List<Object[]> result = new ArrayList<>(3);
+        final List<Object[]> result = new ArrayList<>(4);
         result.add(new Object[] { 0 });
         result.add(new Object[] { 1 });
         result.add(new Object[] { 2 });
+        result.add(new Object[] { 3 });
         return result.toArray(new Object[result.size()][]);
     }
 
+    @Test
+    void testEstimatePairEndStats() {
+        final List<byte[]> seqs = new ArrayList<>();
+        seqs.add("GGCTTTTAATGCTTTTCAGTGGTTGCTGCTCAAGATGGAGTCTACTCAGCAGATGGTAAGCTCTATTATT".getBytes());
+        seqs.add("TTGTTTTTAACACCAGAGTCATCCATCACATAATCAAATTTACTTTTAACTCTGGTAAATACTTCATTGT".getBytes());
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        aligner.alignPairs();
+        // a single pair is far too few to go on, so every orientation fails
+        final BwaMemPairEndStatsByOrientation stats = aligner.estimatePairEndStats(seqs);
+        Assert.assertEquals(stats, BwaMemPairEndStatsByOrientation.NONE);
+        Assert.assertEquals(aligner.estimatePairEndStats(seqs, seq -> seq, 1), stats);
+        aligner.setPairEndStats(stats);
+        Assert.assertSame(aligner.getPairEndStats(), stats);
+        Assert.assertEquals(BwaMemPairEndStatsByOrientation.forFRPairs(new BwaMemPairEndStats(200, 10, 1, 600))
+                                .get(BwaMemPairEndStats.Orientation.RF), BwaMemPairEndStats.FAILED);
+    }
+
+    @Test
+    void testEstimatePairEndStatsByOrientation() throws IOException {
+        final Random random = new Random(17);
+        final List<byte[]> seqs = simulatePairs(300, 300, 20, false, random);
+        seqs.addAll(simulatePairs(60, 400, 15, true, random));
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        aligner.alignPairs();
+        final BwaMemPairEndStatsByOrientation stats = aligner.estimatePairEndStats(seqs);
+        final BwaMemPairEndStats fr = stats.get(BwaMemPairEndStats.Orientation.FR);
+        Assert.assertFalse(fr.failed);
+        Assert.assertEquals(fr.average, 300., 5.);
+        Assert.assertEquals(fr.std, 20., 5.);
+        Assert.assertTrue(fr.low < fr.average && fr.high > fr.average);
+        // bwa measures an RF pair's insert from the inner ends of the mates
+        final BwaMemPairEndStats rf = stats.get(BwaMemPairEndStats.Orientation.RF);
+        Assert.assertFalse(rf.failed);
+        Assert.assertEquals(rf.average, 400. - 2*70, 5.);
+        Assert.assertEquals(rf.std, 15., 5.);
+        Assert.assertTrue(stats.get(BwaMemPairEndStats.Orientation.FF).failed);
+        Assert.assertTrue(stats.get(BwaMemPairEndStats.Orientation.RR).failed);
+    }
+
+    @Test
+    void testEstimatePairEndStatsFromSample() throws IOException {
+        final List<byte[]> seqs = simulatePairs(2000, 300, 20, false, new Random(23));
+        final BwaMemAligner aligner = new BwaMemAligner(index);
+        aligner.alignPairs();
+        final BwaMemPairEndStats all = aligner.estimatePairEndStats(seqs).get(BwaMemPairEndStats.Orientation.FR);
+        Assert.assertEquals(aligner.getLastNPairsExamined(), 2000);
+        final BwaMemPairEndStatsByOrientation sampled = aligner.estimatePairEndStats(seqs, seq -> seq, 250);
+        Assert.assertEquals(aligner.getLastNPairsExamined(), 250);
+        final BwaMemPairEndStats fr = sampled.get(BwaMemPairEndStats.Orientation.FR);
+        Assert.assertFalse(fr.failed);
+        Assert.assertEquals(fr.average, all.average, 5.);
+        Assert.assertEquals(fr.std, all.std, 5.);
+        // an iterable that isn't a collection is sampled just the same
+        final Iterable<byte[]> uncounted = seqs::iterator;
+        Assert.assertEquals(aligner.estimatePairEndStats(uncounted, seq -> seq, 250), sampled);
+    }
+
+    // Pairs of 70-base reads from fragments of ref.fa with normally distributed lengths.  The first mate reads
+    // forward from the fragment's start, and the second reads back from its end (FR), or, for mate pairs, the first
+    // reads forward to the fragment's end, and the second reads back to its start (RF).
+    private static List<byte[]> simulatePairs( final int nPairs, final int meanLen, final int stdLen,
+                                               final boolean matePairs, final Random random ) throws IOException {
+        final StringBuilder sb = new StringBuilder();
+        for ( final String line : Files.readAllLines(new File("src/test/resources/ref.fa").toPath()) ) {
+            if ( !line.startsWith(">") ) sb.append(line.trim());
+        }
+        final String ref = sb.toString();
+        final int readLen = 70;
+        final List<byte[]> seqs = new ArrayList<>(2*nPairs);
+        for ( int pairIdx = 0; pairIdx != nPairs; ++pairIdx ) {
+            final int fragLen = Math.max(2*readLen,
+                    Math.min(ref.length(), (int)Math.round(meanLen + stdLen*random.nextGaussian())));
+            final int fragStart = random.nextInt(ref.length() - fragLen + 1);
+            final String left = ref.substring(fragStart, fragStart + readLen);
+            final String right = ref.substring(fragStart + fragLen - readLen, fragStart + fragLen);
+            seqs.add((matePairs ? right : left).getBytes());
+            seqs.add(reverseComplement(matePairs ? left : right).getBytes());
+        }
+        return seqs;
+    }
+
+    private static sun.misc.Unsafe getUnsafe() throws ReflectiveOperationException {
+        final java.lang.reflect.Field field = sun.misc.Unsafe.class.getDeclaredField("theUnsafe");
+        field.setAccessible(true);
+        return (sun.misc.Unsafe)field.get(null);
+    }
+
+    private static String readCString( final sun.misc.Unsafe unsafe, final long address ) {
+        final ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+        byte b;
+        for ( long addr = address; (b = unsafe.getByte(addr)) != 0; ++addr ) {
+            bytes.write(b);
+        }
+        return bytes.toString();
+    }
+
+    private static String reverseComplement( final String seq ) {
+        final StringBuilder sb = new StringBuilder(seq.length());
+        for ( int idx = seq.length() - 1; idx >= 0; --idx ) {
+            switch ( seq.charAt(idx) ) {
+                case 'A': sb.append('T'); break;
+                case 'C': sb.append('G'); break;
+                case 'G': sb.append('C'); break;
+                case 'T': sb.append('A'); break;
+                default: sb.append('N'); break;
+            }
+        }
+        return sb.toString();
+    }
+
     void testAlignment( final BwaMemAlignment alignment,
                         final int refStart, final int refEnd, final int seqStart, final int seqEnd,
                         final String cigar, final int nMismatches, final int samFlag ) {
@@ -171,6 +832,22 @@ public final class BwaMemIndexTest {
         BwaMemIndex.createIndexImageFromFastaFile(fastaFile.getPath(), imageFile.getPath());
         final BwaMemIndex index = new BwaMemIndex(imageFile.getPath()  );
         Assert.assertEquals(index.getReferenceContigNames(), Arrays.asList("seq1", "seq2"));
+        final BwaMemReferenceContig seq2 = index.getReferenceContig("seq2");
+        Assert.assertEquals(seq2.getIndex(), 1);
+        Assert.assertEquals(seq2.getLength(), refSeq2.length);
+        Assert.assertEquals(seq2.getOffset(), refSeq1.length);
+        Assert.assertFalse(seq2.isAlt());
+        Assert.assertSame(index.getReferenceContig(1), seq2);
+        Assert.assertEquals(index.getReferenceContig(0).getLength(), refSeq1.length);
+        Assert.assertEquals(index.getReferenceContigId("seq1"), 0);
+        Assert.assertEquals(index.getReferenceContigId("seq3"), -1);
+        Assert.assertNull(index.getReferenceContig("seq3"));
+        Assert.assertSame(index.getReferenceContigAt(0L), index.getReferenceContig(0));
+        Assert.assertSame(index.getReferenceContigAt(refSeq1.length - 1), index.getReferenceContig(0));
+        Assert.assertSame(index.getReferenceContigAt(refSeq1.length), seq2);
+        Assert.assertSame(index.getReferenceContigAt(refSeq1.length + refSeq2.length - 1), seq2);
+        Assert.assertNull(index.getReferenceContigAt(refSeq1.length + refSeq2.length));
+        Assert.assertNull(index.getReferenceContigAt(-1L));
         index.close();
         fastaFile.delete();
         imageFile.delete();